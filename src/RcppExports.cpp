@@ -253,6 +253,36 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// setGDALPoolSize
+void setGDALPoolSize(double x);
+RcppExport SEXP _terra_setGDALPoolSize(SEXP xSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type x(xSEXP);
+    setGDALPoolSize(x);
+    return R_NilValue;
+END_RCPP
+}
+// getGDALPoolStats
+std::vector<double> getGDALPoolStats();
+RcppExport SEXP _terra_getGDALPoolStats() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(getGDALPoolStats());
+    return rcpp_result_gen;
+END_RCPP
+}
+// forgetGDALPool
+void forgetGDALPool(std::vector<std::string> f);
+RcppExport SEXP _terra_forgetGDALPool(SEXP fSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type f(fSEXP);
+    forgetGDALPool(f);
+    return R_NilValue;
+END_RCPP
+}
 // get_proj_search_paths
 std::vector<std::string> get_proj_search_paths();
 RcppExport SEXP _terra_get_proj_search_paths() {
@@ -423,6 +453,9 @@ static const R_CallMethodDef CallEntries[] = {
     {"_terra_percRank", (DL_FUNC) &_terra_percRank, 5},
     {"_terra_setGDALCacheSizeMB", (DL_FUNC) &_terra_setGDALCacheSizeMB, 1},
     {"_terra_getGDALCacheSizeMB", (DL_FUNC) &_terra_getGDALCacheSizeMB, 0},
+    {"_terra_setGDALPoolSize", (DL_FUNC) &_terra_setGDALPoolSize, 1},
+    {"_terra_getGDALPoolStats", (DL_FUNC) &_terra_getGDALPoolStats, 0},
+    {"_terra_forgetGDALPool", (DL_FUNC) &_terra_forgetGDALPool, 1},
     {"_terra_get_proj_search_paths", (DL_FUNC) &_terra_get_proj_search_paths, 0},
     {"_terra_set_proj_search_paths", (DL_FUNC) &_terra_set_proj_search_paths, 1},
     {"_terra_PROJ_network", (DL_FUNC) &_terra_PROJ_network, 2},
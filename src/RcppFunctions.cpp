@@ -4,6 +4,7 @@
 
 #include "gdal_priv.h"
 #include "gdalio.h"
+#include "gdal_pool.h"
 #include "ogr_spatialref.h"
 
 #define GEOS_USE_ONLY_R_API
@@ -457,6 +458,23 @@ double getGDALCacheSizeMB() {
   return static_cast<double>(GDALGetCacheMax64() / 1024 / 1024);
 }
 
+// [[Rcpp::export(name = ".setGDALPoolSize")]]
+void setGDALPoolSize(double x) {
+	gdal_pool_size(x < 0 ? 0 : x);
+}
+
+// [[Rcpp::export(name = ".getGDALPoolStats")]]
+std::vector<double> getGDALPoolStats() {
+	return gdal_pool_stats();
+}
+
+// [[Rcpp::export(name = ".forgetGDALPool")]]
+void forgetGDALPool(std::vector<std::string> f) {
+	for (size_t i=0; i<f.size(); i++) {
+		gdal_pool_forget(f[i]);
+	}
+}
+
 // convert NULL-terminated array of strings to std::vector<std::string>
 std::vector<std::string> charpp2vect(char **cp) {
 	std::vector<std::string> out;
@@ -218,6 +218,7 @@ RCPP_MODULE(spat){
 		//.property("append", &SpatOptions::get_append, &SpatOptions::set_append )
 		.field("datatype_set", &SpatOptions::datatype_set)
 		.field("threads", &SpatOptions::threads)
+		.field("memmap", &SpatOptions::memmap)
 		.property("progress", &SpatOptions::get_progress, &SpatOptions::set_progress)
 		.property("ncopies", &SpatOptions::get_ncopies, &SpatOptions::set_ncopies)
 
@@ -448,7 +449,8 @@ RCPP_MODULE(spat){
 
 		.method("near_between", (SpatVector (SpatVector::*)(SpatVector, bool))( &SpatVector::nearest_point))
 		.method("near_within", (SpatVector (SpatVector::*)())( &SpatVector::nearest_point))
-		//.method("knearest", &SpatVector::knearest)
+		.method("knearest", &SpatVector::knearest)
+		.method("within_distance", &SpatVector::within_distance)
 
 		.method("split", &SpatVector::split)
 
@@ -572,6 +574,7 @@ RCPP_MODULE(spat){
 		.property("hasRange", &SpatRaster::hasRange )
 		.property("hasValues", &SpatRaster::hasValues )
 		.property("inMemory", &SpatRaster::inMemory )
+		.property("mapped", &SpatRaster::mappedValues )
 		.method("isLonLat", &SpatRaster::is_lonlat, "isLonLat")
 		.method("isGlobalLonLat", &SpatRaster::is_global_lonlat, "isGlobalLonLat") 
 
@@ -667,6 +670,10 @@ RCPP_MODULE(spat){
 		.method("aggregate", &SpatRaster::aggregate, "aggregate")
 		.method("align", &SpatRaster::align, "align")
 		.method("apply", &SpatRaster::apply, "apply")
+		.method("tapp", &SpatRaster::tapp, "tapp")
+		.method("roll", &SpatRaster::roll, "roll")
+		.method("timeIndex", &SpatRaster::timeIndex, "timeIndex")
+		.method("fillGaps", &SpatRaster::fillGaps, "fillGaps")
 		.method("rapply", &SpatRaster::rapply, "rapply")
 		.method("rappvals", &SpatRaster::rappvals, "rappvals")
 		.method("arith_rast", ( SpatRaster (SpatRaster::*)(SpatRaster, std::string, SpatOptions&) )( &SpatRaster::arith ))
@@ -725,6 +732,8 @@ RCPP_MODULE(spat){
 		.method("get_aggregate_dims", &SpatRaster::get_aggregate_dims2, "get_aggregate_dims")
 		.method("global", &SpatRaster::global, "global")
 		.method("global_weighted_mean", &SpatRaster::global_weighted_mean, "global weighted mean")
+		.method("global_weighted_area", &SpatRaster::global_weighted_area)
+		.method("global_quantile", &SpatRaster::global_quantile, "global quantile")
 
 		.method("initf", ( SpatRaster (SpatRaster::*)(std::string, bool, SpatOptions&) )( &SpatRaster::init ), "init fun")
 		.method("initv", ( SpatRaster (SpatRaster::*)(std::vector<double>, SpatOptions&) )( &SpatRaster::init ), "init value")
@@ -759,9 +768,15 @@ RCPP_MODULE(spat){
 		.method("sampleRowColValues", &SpatRaster::sampleRowColValues, "sampleRowCol")
 		.method("sampleRandomRaster", &SpatRaster::sampleRandomRaster, "sampleRandom")
 		.method("sampleRandomValues", &SpatRaster::sampleRandomValues, "sampleValues")
+		.method("sampleRandomNotNA", &SpatRaster::sampleRandomNotNA)
+		.method("sampleStratifiedCells", &SpatRaster::sampleStratifiedCells)
 		.method("scale", &SpatRaster::scale, "scale")
 		.method("shift", &SpatRaster::shift, "shift")
 		.method("terrain", &SpatRaster::terrain, "terrain")
+		.method("flowAccumulation", &SpatRaster::flowAccumulation, "flowAccumulation")
+		.method("watershed", &SpatRaster::watershed, "watershed")
+		.method("fillDepressions", &SpatRaster::fillDepressions, "fillDepressions")
+		.method("viewshed", &SpatRaster::viewshed, "viewshed")
 		.method("summary", &SpatRaster::summary, "summary")
 		.method("summary_numb", &SpatRaster::summary_numb, "summary_numb")
 		.method("transpose", &SpatRaster::transpose, "transpose")
@@ -776,6 +791,8 @@ RCPP_MODULE(spat){
 		.method("warp", &SpatRaster::warper)
 		.method("resample", &SpatRaster::resample)
 		.method("zonal", &SpatRaster::zonal)
+		.method("zonal_weighted_area", &SpatRaster::zonal_weighted_area)
+		.method("zonal_quantile", &SpatRaster::zonal_quantile)
 		.method("is_true", &SpatRaster::is_true)
 		.method("is_false", &SpatRaster::is_false)
 	;
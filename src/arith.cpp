@@ -965,17 +965,24 @@ SpatRaster SpatRaster::summary_numb(std::string fun, std::vector<double> add, bo
 	unsigned nl = nlyr();
 	std::vector<double> v(nl);
 	if (add.size() > 0) v.insert( v.end(), add.begin(), add.end() );
+	std::vector<size_t> lyrs(nl);
+	std::iota(lyrs.begin(), lyrs.end(), 0);
+	bool layerfun = haveLayerFun(fun);
 
 	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a; 
-		readBlock(a, out.bs, i);
 		unsigned nc = out.bs.nrows[i] * out.ncol();
 		std::vector<double> b(nc);
-		for (size_t j=0; j<nc; j++) {
-			for (size_t k=0; k<nl; k++) {
-				v[k] = a[j+k*nc];
+		if (layerfun) {
+			std::vector<double> a; 
+			readBlock(a, out.bs, i);
+			reduceLayers(fun, &a[0], nc, lyrs, add, narm, &b[0]);
+		} else {
+			// cell interleaved, such that the values of a cell are contiguous
+			std::vector<double> a = readBlockIP(out.bs, i);
+			for (size_t j=0; j<nc; j++) {
+				std::copy(a.begin()+j*nl, a.begin()+(j+1)*nl, v.begin());
+				b[j] = sumFun(v, narm);
 			}
-			b[j] = sumFun(v, narm);
 		}
 		if (!out.writeBlock(b, i)) return out;
 
@@ -1028,14 +1035,11 @@ SpatRaster SpatRaster::modal(std::vector<double> add, std::string ties, bool nar
 	v.insert( v.end(), add.begin(), add.end() );
 
 	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a; 
-		readBlock(a, out.bs, i);
+		std::vector<double> a = readBlockIP(out.bs, i);
 		unsigned nc = out.bs.nrows[i] * out.ncol();
 		std::vector<double> b(nc);
 		for (size_t j=0; j<nc; j++) {
-			for (size_t k=0; k<nl; k++) {
-				v[k] = a[j+k*nc];
-			}
+			std::copy(a.begin()+j*nl, a.begin()+(j+1)*nl, v.begin());
 			b[j] = modal_value(v, ities, narm, rgen, dist);
 		}
 		if (!out.writeBlock(b, i)) return out;
@@ -1065,22 +1069,16 @@ SpatRaster SpatRaster::range(std::vector<double> add, bool narm, SpatOptions &op
 		return out;
 	}
 	unsigned nl = nlyr();
-	std::vector<double> v(nl);
-	v.insert( v.end(), add.begin(), add.end() );
+	std::vector<size_t> lyrs(nl);
+	std::iota(lyrs.begin(), lyrs.end(), 0);
 
 	for (size_t i = 0; i < out.bs.n; i++) {
 		std::vector<double> a; 
 		readBlock(a, out.bs, i);
 		unsigned nc = out.bs.nrows[i] * out.ncol();
 		std::vector<double> b(nc * 2);
-		for (size_t j=0; j<nc; j++) {
-			for (size_t k=0; k<nl; k++) {
-				v[k] = a[j+k*nc];
-			}
-			std::vector<double> rng = vrange(v, narm);
-			b[j] = rng[0];
-			b[j+nc] = rng[1];
-		}
+		reduceLayers("min", &a[0], nc, lyrs, add, narm, &b[0]);
+		reduceLayers("max", &a[0], nc, lyrs, add, narm, &b[nc]);
 		if (!out.writeBlock(b, i)) return out;
 
 	}
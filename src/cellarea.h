@@ -0,0 +1,48 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATCELLAREA_GUARD
+#define SPATCELLAREA_GUARD
+
+// requires "spatRaster.h"
+
+// The area of the cells of a raster, computed when it is needed instead of
+// being written to a raster first. On a lon/lat grid, and on a planar grid
+// that is not transformed, the area only depends on the row ("byrow").
+// Otherwise the cells are projected to lon/lat, a block at a time.
+class SpatCellArea {
+	public:
+		SpatCellArea(SpatRaster &x, std::string unit, bool transform, SpatOptions &opt);
+		bool byrow = true;
+		std::string error = "";
+
+		// the area of a cell in row r (only if byrow)
+		double row(size_t r) {
+			return rows.empty() ? area : rows[r];
+		}
+		// the area of the cells in nrows rows, starting at row r
+		void cells(size_t r, size_t nrows, std::vector<double> &out);
+
+	private:
+		SpatRaster geom;
+		SpatOptions opt;
+		std::string unit;
+		double area = NAN;
+		std::vector<double> rows;
+};
+
+#endif
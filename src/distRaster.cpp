@@ -24,6 +24,7 @@
 #include "math_utils.h"
 #include "vecmath.h"
 #include "file_utils.h"
+#include "cellarea.h"
 
 
 void shortDistPoints(std::vector<double> &d, const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &px, const std::vector<double> &py, const bool& lonlat, const double &lindist) {
@@ -2143,6 +2144,77 @@ std::vector<double> SpatVector::length() {
 	return r;
 }
 
+
+// The area between the equator and latitude "lat" (degrees), per radian of
+// longitude, on the WGS84 ellipsoid
+static double zone_area(double lat) {
+	const double a = 6378137;
+	const double f = 1 / 298.257223563;
+	const double b = a * (1 - f);
+	const double e2 = f * (2 - f);
+	const double e = std::sqrt(e2);
+	double s = std::sin(std::max(-90.0, std::min(90.0, lat)) * M_PI / 180);
+	return b * b / 2 * (s / (1 - e2 * s * s) + std::log((1 + e * s) / (1 - e * s)) / (2 * e));
+}
+
+
+SpatCellArea::SpatCellArea(SpatRaster &x, std::string unit, bool transform, SpatOptions &opt) : opt(opt), unit(unit) {
+
+	std::vector<std::string> f {"m", "km", "ha"};
+	if (std::find(f.begin(), f.end(), unit) == f.end()) {
+		error = "invalid unit";
+		return;
+	}
+	if (x.source[0].srs.wkt == "") {
+		error = "empty CRS";
+		return;
+	}
+	geom = x.geometry(1);
+	double adj = unit == "m" ? 1 : unit == "km" ? 1000000 : 10000;
+	if (x.is_lonlat()) {
+		// cells are bounded by meridians and parallels, so the area of a cell
+		// is that of a zone of the ellipsoid, times the fraction of the
+		// longitude that it covers
+		double dlon = std::min(x.xres(), 360.0) * M_PI / 180;
+		double hy = x.yres() / 2;
+		size_t nr = x.nrow();
+		rows.resize(nr);
+		for (size_t i=0; i<nr; i++) {
+			double y = x.yFromRow(i);
+			rows[i] = dlon * std::fabs(zone_area(y + hy) - zone_area(y - hy)) / adj;
+		}
+	} else if (transform) {
+		byrow = false;
+	} else {
+		double m = x.source[0].srs.to_meter();
+		m = std::isnan(m) ? 1 : m;
+		area = x.xres() * x.yres() * m * m / adj;
+	}
+}
+
+
+void SpatCellArea::cells(size_t r, size_t nrows, std::vector<double> &out) {
+	if (byrow) {
+		size_t nc = geom.ncol();
+		out.resize(0);
+		out.reserve(nrows * nc);
+		for (size_t i=0; i<nrows; i++) {
+			out.insert(out.end(), nc, row(r+i));
+		}
+		return;
+	}
+	double dy = geom.yres() / 2;
+	SpatExtent e = geom.getExtent();
+	e.ymax = geom.yFromRow(r) + dy;
+	e.ymin = geom.yFromRow(r + nrows - 1) - dy;
+	SpatOptions popt(opt);
+	SpatRaster chunk = geom.crop(e, "near", popt);
+	SpatVector p = chunk.as_polygons(false, false, false, false, false, popt);
+	p = p.project("EPSG:4326");
+	out = p.area(unit, true, {});
+}
+
+
 SpatRaster SpatRaster::rst_area(bool mask, std::string unit, bool transform, int rcmax, SpatOptions &opt) {
 
 	SpatRaster out = geometry(1);
@@ -2174,95 +2246,44 @@ SpatRaster SpatRaster::rst_area(bool mask, std::string unit, bool transform, int
 
 
 	SpatOptions xopt(opt);
-	if (lonlat) { 
-		bool disagg = false;
-		SpatExtent extent = getExtent();
-		if ((out.ncol() == 1) && ((extent.xmax - extent.xmin) > 180)) {
-			disagg = true;
-			std::vector<unsigned> fact = {1,2};
-			out = out.disaggregate(fact, xopt);
-		}
-		SpatExtent e = {extent.xmin, extent.xmin+out.xres(), extent.ymin, extent.ymax};
-		SpatRaster onecol = out.crop(e, "near", xopt);
-		SpatVector p = onecol.as_polygons(false, false, false, false, false, xopt);
-		if (p.hasError()) {
-			out.setError(p.getError());
-			return out;
+	if (lonlat || (!transform)) {
+		SpatCellArea ca(*this, unit, transform, xopt);
+		if (!out.writeStart(opt)) { return out; }
+		for (size_t i = 0; i < out.bs.n; i++) {
+			std::vector<double> v;
+			ca.cells(out.bs.row[i], out.bs.nrows[i], v);
+			if (!out.writeBlock(v, i)) return out;
 		}
-		std::vector<double> a = p.area(unit, true, {});
-		size_t nc = out.ncol();
-		if (disagg) {
+		out.writeStop();
+	} else {
+		bool resample = false;
+		size_t rcx = std::max(rcmax, 10);
+		unsigned frow = 1, fcol = 1;
+		SpatRaster target = out.geometry(1);
+		if ((nrow() > rcx) || (ncol() > rcx)) {
+			resample = true;
+			frow = (nrow() / rcx) + 1;	
+			fcol = (ncol() / rcx) + 1;	
+			out = out.aggregate({frow, fcol}, "mean", false, xopt);
+			xopt.ncopies *= 5;
 			if (!out.writeStart(xopt)) { return out; }
 		} else {
+			opt.ncopies *= 5;
 			if (!out.writeStart(opt)) { return out; }
 		}
+		SpatCellArea ca(out, unit, true, xopt);
 		for (size_t i = 0; i < out.bs.n; i++) {
 			std::vector<double> v;
-			v.reserve(out.bs.nrows[i] * nc);
-			size_t r = out.bs.row[i];
-			for (size_t j=0; j<out.bs.nrows[i]; j++) {
-				v.insert(v.end(), nc, a[r]);
-				r++;
-			}
+			ca.cells(out.bs.row[i], out.bs.nrows[i], v);
 			if (!out.writeBlock(v, i)) return out;
 		}
 		out.writeStop();
-		if (disagg) {
-			SpatRaster tmp = out.to_memory_copy(xopt);
-			std::vector<unsigned> fact = {1,2};
-			opt.overwrite=true;
-			out = tmp.aggregate(fact, "sum", true, opt); 
-		}
-
-	} else {
-		if (transform) {
-			bool resample = false;
-//			SpatRaster empty = out.geometry(1);
-			size_t rcx = std::max(rcmax, 10);
-			unsigned frow = 1, fcol = 1;
-			SpatRaster target = out.geometry(1);
-			if ((nrow() > rcx) || (ncol() > rcx)) {
-				resample = true;
-				frow = (nrow() / rcx) + 1;	
-				fcol = (ncol() / rcx) + 1;	
-				out = out.aggregate({frow, fcol}, "mean", false, xopt);
-				xopt.ncopies *= 5;
-				if (!out.writeStart(xopt)) { return out; }
-			} else {
-				opt.ncopies *= 5;
-				if (!out.writeStart(opt)) { return out; }
-			}
-			SpatRaster empty = out.geometry(1);
-			SpatExtent extent = out.getExtent();
-			double dy = out.yres() / 2;
-			for (size_t i = 0; i < out.bs.n; i++) {
-				double ymax = out.yFromRow(out.bs.row[i]) + dy;
-				double ymin = out.yFromRow(out.bs.row[i] + out.bs.nrows[i]-1) - dy;
-				SpatExtent e = {extent.xmin, extent.xmax, ymin, ymax};
-				SpatRaster chunk = empty.crop(e, "near", xopt);
-				SpatVector p = chunk.as_polygons(false, false, false, false, false, xopt);		
-				std::vector<double> v = p.area(unit, true, {});
-				if (!out.writeBlock(v, i)) return out;
-				out.writeStop();
-			}
-			if (resample) {
-				double divr = frow*fcol;
-				out = out.arith(divr, "/", false, xopt);
-				out = out.warper(target, "", "bilinear", false, false, opt);
-			}
-		} else {
-			if (!out.writeStart(opt)) { return out; }
-			double u = unit == "m" ? 1 : unit == "km" ? 1000000 : 10000;
-			double m = out.source[0].srs.to_meter();
-			double a = std::isnan(m) ? 1 : m;
-			a *= xres() * yres() / u;
-			for (size_t i = 0; i < out.bs.n; i++) {
-				std::vector<double> v(out.bs.nrows[i]*ncol(), a);
-				if (!out.writeBlock(v, i)) return out;
-			}
-			out.writeStop();
+		if (resample) {
+			double divr = frow*fcol;
+			out = out.arith(divr, "/", false, xopt);
+			out = out.warper(target, "", "bilinear", false, false, opt);
 		}
-	} 
+	}
 
 	if (mask) {
 		out = out.mask(*this, false, NAN, NAN, mopt);
@@ -2273,129 +2294,62 @@ SpatRaster SpatRaster::rst_area(bool mask, std::string unit, bool transform, int
 
 std::vector<double> SpatRaster::sum_area(std::string unit, bool transform, SpatOptions &opt) {
 
-	if (source[0].srs.wkt == "") {
-		setError("empty CRS");
-		return {NAN};
-	}
-
-	std::vector<std::string> f {"m", "km", "ha"};
-	if (std::find(f.begin(), f.end(), unit) == f.end()) {
-		setError("invalid unit");
+	SpatCellArea ca(*this, unit, transform, opt);
+	if (ca.error != "") {
+		setError(ca.error);
 		return {NAN};
 	}
 
 	std::vector<double> out(nlyr(), 0);
 
-	if (transform) { //avoid very large polygon objects
+	if (!ca.byrow) { //avoid very large polygon objects
 		opt.set_memfrac(std::max(0.1, opt.get_memfrac()/2));
 	}
 	BlockSize bs = getBlockSize(opt);
-	if (!readStart()) {
-		std::vector<double> err(nlyr(), -1);
-		return(err);
-	}
-
-	if (is_lonlat()) {
-		SpatRaster x = geometry(1);
-		SpatExtent extent = x.getExtent();
-		if ((x.ncol() == 1) && ((extent.xmax - extent.xmin) > 180)) {
-			std::vector<unsigned> fact= {1,2};
-			x = x.disaggregate(fact, opt);
-		}
-		size_t nc = x.ncol();
-		SpatExtent e = {extent.xmin, extent.xmin+x.xres(), extent.ymin, extent.ymax};
-		SpatRaster onecol = x.crop(e, "near", opt);
-		SpatVector p = onecol.as_polygons(false, false, false, false, false, opt);
-		std::vector<double> ar = p.area(unit, true, {});
-		if (!hasValues()) {
-			out.resize(1);
-			for (size_t i=0; i<ar.size(); i++) {
-				out[0] += ar[i] * nc;
+	size_t nc = ncol();
+	if (!hasValues()) {
+		out.resize(1);
+		if (ca.byrow) {
+			for (size_t i=0; i<nrow(); i++) {
+				out[0] += ca.row(i) * nc;
 			}
 		} else {
 			for (size_t i=0; i<bs.n; i++) {
-				std::vector<double> v;
-				readValues(v, bs.row[i], bs.nrows[i], 0, ncol());
-				size_t blockoff = bs.nrows[i] * nc;
-				for (size_t lyr=0; lyr<nlyr(); lyr++) {
-					size_t lyroff = lyr * blockoff;
-					for (size_t j=0; j<bs.nrows[i]; j++) {
-						size_t row = bs.row[i] + j;
-						size_t offset = lyroff + row * nc;
-						size_t n = offset + nc;
-						for (size_t k=offset; k<n; k++) {
-							if (!std::isnan(v[k])) out[lyr] += ar[row];
-						}
-					}
-				}
+				std::vector<double> a;
+				ca.cells(bs.row[i], bs.nrows[i], a);
+				out[0] += accumulate(a.begin(), a.end(), 0.0);
 			}
 		}
-	} else if (transform) {
-		SpatRaster x = geometry(1);
-		SpatExtent extent = x.getExtent();
-		double dy = x.yres() / 2;
-		SpatOptions popt(opt);
-		if (!hasValues()) {
-			out.resize(1);
-			for (size_t i=0; i<bs.n; i++) {
-				double ymax = x.yFromRow(bs.row[i]) + dy;
-				double ymin = x.yFromRow(bs.row[i] + bs.nrows[i]-1) - dy;
-				SpatExtent e = {extent.xmin, extent.xmax, ymin, ymax};
-				SpatRaster onechunk = x.crop(e, "near", popt);
-				SpatVector p = onechunk.as_polygons(false, false, false, false, false, popt);
-				p = p.project("EPSG:4326");
-				std::vector<double> v = p.area(unit, true, 	{});
-				out[0] += accumulate(v.begin(), v.end(), 0.0);
-			}
-		} else {
-			for (size_t i=0; i<bs.n; i++) {
-				double ymax = x.yFromRow(bs.row[i]) + dy;
-				double ymin = x.yFromRow(bs.row[i] + bs.nrows[i]-1) - dy;
-				SpatExtent e = {extent.xmin, extent.xmax, ymin, ymax};
-				SpatRaster onechunk = x.crop(e, "near", popt);
-				SpatVector p = onechunk.as_polygons(false, false, false, false, false, popt);
-				p = p.project("EPSG:4326");
-				std::vector<double> par = p.area(unit, true, {});
-
-				std::vector<double> v;
-				readValues(v, bs.row[i], bs.nrows[i], 0, ncol());
-				unsigned off = bs.nrows[i] * ncol() ;
-				for (size_t lyr=0; lyr<nlyr(); lyr++) {
-					unsigned offset = lyr * off;
-					unsigned n = offset + off;
-					for (size_t j=offset; j<n; j++) {
-						if (!std::isnan(v[j])) {
-							out[lyr] += par[j - offset];
-						}
-					}
-				}
-			}
+		return out;
+	}
 
-		}
-	} else {
-		double adj = unit == "m" ? 1 : unit == "km" ? 1000000 : 10000;
-		double m = source[0].srs.to_meter();
-		m = std::isnan(m) ? 1 : m;
-		double ar = xres() * yres() * m * m / adj;
-		if (!hasValues()) {
-			out.resize(1);
-			out[0] = ncell() * ar;
-		} else {
-			for (size_t i=0; i<bs.n; i++) {
-				std::vector<double> v;
-				readValues(v, bs.row[i], bs.nrows[i], 0, ncol());
-				unsigned off = bs.nrows[i] * ncol() ;
-				for (size_t lyr=0; lyr<nlyr(); lyr++) {
-					unsigned offset = lyr * off;
-					unsigned n = offset + off;
-					for (size_t j=offset; j<n; j++) {
-						if (!std::isnan(v[j])) out[lyr]++;
+	if (!readStart()) {
+		std::vector<double> err(nlyr(), -1);
+		return(err);
+	}
+	for (size_t i=0; i<bs.n; i++) {
+		std::vector<double> v, a;
+		readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+		if (!ca.byrow) {
+			ca.cells(bs.row[i], bs.nrows[i], a);
+		}
+		size_t off = bs.nrows[i] * nc;
+		for (size_t lyr=0; lyr<nlyr(); lyr++) {
+			size_t lyroff = lyr * off;
+			for (size_t j=0; j<bs.nrows[i]; j++) {
+				size_t offset = lyroff + j * nc;
+				if (ca.byrow) {
+					size_t n = 0;
+					for (size_t k=offset; k<(offset+nc); k++) {
+						n += !std::isnan(v[k]);
+					}
+					out[lyr] += n * ca.row(bs.row[i] + j);
+				} else {
+					for (size_t k=0; k<nc; k++) {
+						if (!std::isnan(v[offset+k])) out[lyr] += a[j*nc + k];
 					}
 				}
 			}
-			for (size_t lyr=0; lyr<nlyr(); lyr++) {
-				out[lyr] = out[lyr] * ar;
-			}
 		}
 	}
 	readStop();
@@ -2420,542 +2374,40 @@ std::vector<std::vector<double>> SpatRaster::area_by_value(SpatOptions &opt) {
 			}
 		}
 		return f;
-	} else {
-		// to do
-		// combine freq and area to get area by latitudes
-
-		std::vector<std::vector<double>> out(nlyr());
-		return out;
-	}
-}
-
-
-
-void do_flowdir(std::vector<double> &val, std::vector<double> const &d, size_t nrow, size_t ncol, double dx, double dy, unsigned seed, bool before, bool after) {
-
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-	std::vector<double> r = {0, 0, 0, 0, 0, 0, 0, 0};
-	std::vector<double> p = {1, 2, 4, 8, 16, 32, 64, 128}; // pow(2, j)
-	double dxy = sqrt(dx * dx + dy * dy);
-
-	std::default_random_engine generator(seed);
-	std::uniform_int_distribution<> U(0, 1);
-
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			if (!std::isnan(d[i])) {
-				r[0] = (d[i] - d[i+1]) / dx;
-				r[1] = (d[i] - d[i+1+ncol]) / dxy;
-				r[2] = (d[i] - d[i+ncol]) / dy;
-				r[3] = (d[i] - d[i-1+ncol]) / dxy;
-				r[4] = (d[i] - d[i-1]) / dx;
-				r[5] = (d[i] - d[i-1-ncol]) / dxy;
-				r[6] = (d[i] - d[i-ncol]) / dy;
-				r[7] = (d[i] - d[i+1-ncol]) / dxy;
-				// using the lowest neighbor, even if it is higher than the focal cell.
-				double dmin = r[0];
-				int k = 0;
-				for (size_t j=1; j<8; j++) {
-					if (r[j] > dmin) {
-						dmin = r[j];
-						k = j;
-					} else if (r[j] == dmin) {
-						if (U(generator)) {
-							dmin = r[j];
-							k = j;
-						}
-					}
-				}
-				val.push_back( p[k] );
-			} else {
-				val.push_back( NAN );
-			}
-		}
-		val.push_back(NAN);
-	}
-
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-}
-
-
-void do_TRI(std::vector<double> &val, std::vector<double> const &d, size_t nrow, size_t ncol, bool before, bool after) {
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			val.push_back( 
-				(fabs(d[i-1-ncol]-d[i]) + fabs(d[i-1]-d[i]) + fabs(d[i-1+ncol]-d[i]) +  fabs(d[i-ncol]-d[i]) + fabs(d[i+ncol]-d[i]) +  fabs(d[i+1-ncol]-d[i]) + fabs(d[i+1]-d[i]) +  fabs(d[i+1+ncol]-d[i])) / 8 
-			);
-		}
-		val.push_back(NAN);
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-}
-
-void do_TPI(std::vector<double> &val, const std::vector<double> &d, const size_t nrow, const size_t ncol, bool before, bool after) {
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			val.push_back( d[i] - (d[i-1-ncol] + d[i-1] + d[i-1+ncol] + d[i-ncol]
-			+ d[i+ncol] + d[i+1-ncol] + d[i+1] + d[i+1+ncol]) / 8 );
-		}
-		val.push_back(NAN);
-	}
-/*
-	if (expand) {
-		for (size_t i=1; i < (ncol-1); i++) {
-			val[i+add] = d[i] - (d[i-1] + d[i-1+ncol] + d[i+ncol] + d[i+1] + d[i+1+ncol]) / 5;
-			size_t j = i+(nrow-1) * ncol;
-			val[j+add] = d[j] - (d[j-1-ncol] + d[j-1] + d[j-ncol] + d[j+1-ncol] + d[j+1]) / 5;
-		}
-		for (size_t row=1; row< (nrow-1); row++) {
-			size_t i = row * ncol;
-			val[i+add] = d[i] - (d[i-ncol] + d[i+ncol] + d[i+1-ncol] + d[i+1] + d[i+1+ncol]) / 5;
-			i += ncol - 1;
-			val[i+add] = d[i] - (d[i-ncol] + d[i] + d[i+ncol] + d[i-ncol]) / 5;
-		}
-		size_t i = 0;
-		val[i+add] = d[i] - (d[i+ncol] + d[i+1] + d[i+1+ncol]) / 3;
-		i = ncol-1;
-		val[i+add] = d[i] - (d[i+ncol] + d[i-1] + d[i-1+ncol]) / 3;
-		i = (nrow-1)*ncol;
-		val[i+add] = d[i] - (d[i-ncol] + d[i+1] + d[i+1-ncol]) / 3;
-		i = (nrow*ncol)-1;
-		val[i+add] = d[i] - (d[i-ncol] + d[i-1] + d[i-1-ncol]) / 3;
-	}
-*/
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-
-}
-
-
-
-void do_roughness(std::vector<double> &val, const std::vector<double> &d, size_t nrow, size_t ncol, bool before, bool after) {
-
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-	int incol = ncol;
-	int a[9] = { -1-incol, -1, -1+incol, -incol, 0, incol, 1-incol, 1, 1+incol };
-	double min, max, v;
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			min = d[i + a[0]];
-			max = d[i + a[0]];
-			for (size_t j = 1; j < 9; j++) {
-				v = d[i + a[j]]; 
-				if (v > max) {
-					max = v;
-				} else if (v < min) {
-					min = v;
-				}
-			}
-			val.push_back(max - min);
-		}
-		val.push_back(NAN);
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-}
-
-
-#ifndef M_PI
-#define M_PI (3.14159265358979323846)
-#endif
-
-
-
-
-void to_degrees(std::vector<double>& x, size_t start) { 
-	double adj = 180 / M_PI;
-	for (size_t i=start; i<x.size(); i++) {
-		x[i] *= adj;
-	}
-}
-
-
-void do_slope(std::vector<double> &val, const std::vector<double> &d, unsigned ngb, unsigned nrow, unsigned ncol, double dx, double dy, bool geo, std::vector<double> &gy, bool degrees, bool before, bool after) {
-
-	size_t start = val.size();
-	if (!before) {
-		val.resize(start + ncol, NAN);
-	}
-	
-	std::vector<double> ddx;
-	if (geo) {
-		ddx.resize(nrow);
-		for (size_t i=0; i<nrow; i++) {
-			ddx[i] = distHaversine(-dx, gy[i], dx, gy[i]) / 2 ;
-		}
-	} 
-
-	if (ngb == 4) {
-		if (geo) {
-			double xwi[2] = {-1,1};
-			double xw[2] = {0,0};
-			double yw[2] = {-1,1};
-
-			for (size_t i=0; i<2; i++) {
-				yw[i] = yw[i] / (2 * dy);
-			}
-
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t k=0; k<2; k++) {
-					xw[k] = xwi[k] / (-2 * ddx[row]);
-				}
-				val.push_back(NAN); // first col
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-
-					double zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					double zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					val.push_back( atan(sqrt( pow(zy, 2) + pow(zx, 2) )));
-				}
-				val.push_back(NAN); // last col
-			}
-		} else { // ngb == 8
-
-			double xw[2] = {-1,1};
-			double yw[2] = {-1,1};
-			for (size_t i=0; i<2; i++) {
-				xw[i] /= -2 * dx;
-				yw[i] /=  2 * dy;
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					double zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					val.push_back(  atan( sqrt( pow(zy, 2) + pow(zx, 2)  )));
-				}
-				val.push_back(NAN); 
-			}
-		}
-	} else {
-
-		if (geo) {
-
-			double xwi[6] = {-1,-2,-1,1,2,1};
-			double xw[6] = {0,0,0,0,0,0};
-			double yw[6] = {-1,1,-2,2,-1,1};
-
-			for (size_t i=0; i<6; i++) {
-				yw[i] = yw[i] / (8 * dy);
-			}
-
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t k=0; k<6; k++) {
-					xw[k] = xwi[k] / (8 * ddx[row]);
-				}
-				val.push_back(NAN); 
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-					   + d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					   
-					double zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					val.push_back( atan(sqrt( pow(zy, 2) + pow(zx, 2))));
-				}
-				val.push_back(NAN); 
-			}
-		} else {
-
-			double xw[6] = {-1,-2,-1,1,2,1};
-			double yw[6] = {-1,1,-2,2,-1,1};
-			for (size_t i=0; i<6; i++) {
-				xw[i] /= -8 * dx;
-				yw[i] /= 8 * dy;
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-							+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					double zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					val.push_back( atan(sqrt( pow(zy, 2) + pow(zx, 2) )));
-				}
-				val.push_back(NAN); 
-			}
-		} 
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-	
-	if (degrees) {
-		to_degrees(val, start);
-	} 
-}
-
-
-double dmod(double x, double n) {
-	return(x - n * std::floor(x/n));
-}
-
-
-
-void do_aspect(std::vector<double> &val, const std::vector<double> &d, unsigned ngb, unsigned nrow, unsigned ncol, double dx, double dy, bool geo, std::vector<double> &gy, bool degrees, bool before, bool after) {
-
-	size_t start = val.size();
-	if (!before) {
-		val.resize(start + ncol, NAN);
-	}
-	std::vector<double> ddx;
-	if (geo) {
-		ddx.resize(nrow);
-		for (size_t i=0; i<nrow; i++) {
-			ddx[i] = distHaversine(-dx, gy[i], dx, gy[i]) / 2 ;
-		}
 	} 
-	double zy, zx; 
-
-	//double const pi2 = M_PI / 2;
-	double const twoPI = 2 * M_PI;
-	double const halfPI = M_PI / 2;
-
-	if (ngb == 4) {
-		if (geo) {
-			double xwi[2] = {-1,1};
-			double xw[2] = {0,0};
-			double yw[2] = {-1,1};
 
-			for (size_t i=0; i<2; i++) {
-				yw[i] = yw[i] / (2 * dy);
-			}
-
-			for (size_t row=1; row < (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t k=0; k<2; k++) {
-					xw[k] = xwi[k] / (-2 * ddx[row]);
-				}
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					zx = atan2(zy, zx);
-					val.push_back( std::fmod( halfPI - zx, twoPI) );
-				}
-				val.push_back(NAN); 
-			}
-		} else {
-
-			double xw[2] = {-1,1};
-			double yw[2] = {-1,1};
-			for (size_t i=0; i<2; i++) {
-				xw[i] = xw[i] / (-2 * dx);
-				yw[i] = yw[i] / (2 * dy);
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					zx = atan2(zy, zx);
-					val.push_back( dmod( halfPI - zx, twoPI));
-				}
-				val.push_back(NAN); 
-			}
-		}
-	} else { //	(ngb == 8) {
-
-		if (geo) {
-
-			double xwi[6] = {-1,-2,-1,1,2,1};
-			double xw[6] = {0,0,0,0,0,0};
-			double yw[6] = {-1,1,-2,2,-1,1};
-
-			for (size_t i=0; i<6; i++) {
-				yw[i] /= (8 * dy);
-			}
-
-			for (size_t row=1; row < (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t k=0; k<6; k++) {
-					xw[k] = xwi[k] / (-8 * ddx[row]);
-				}
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-
-					zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-							+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-
-					zx = atan2(zy, zx);
-					val.push_back( dmod( halfPI - zx, twoPI) );
-				}
-				val.push_back(NAN); 
-			}
-
-		} else {
-
-			double xw[6] = {-1,-2,-1,1,2,1};
-			double yw[6] = {-1,1,-2,2,-1,1};
-			for (size_t i=0; i<6; i++) {
-				xw[i] /= -8 * dx;
-				yw[i] /= 8 * dy;
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-						+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					zx = atan2(zy, zx);
-					val.push_back( dmod( halfPI - zx, twoPI) );
-				}
-				val.push_back(NAN); 
-			}
-		}
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-	if (degrees) {
-		to_degrees(val, start);
-	}
-}
-
-
-SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, bool degrees, unsigned seed, SpatOptions &opt) {
-
-//TPI, TRI, aspect, flowdir, slope, roughness
-	//std::sort(v.begin(), v.end());
-	//v.erase(std::unique(v.begin(), v.end()), v.end());
-
-	SpatRaster out = geometry(v.size());
-	out.setNames(v);
-
-	if (nlyr() > 1) {
-		out.setError("terrain needs a single layer object");
-		return out;
-	}
-
-	bool aspslope = false;
-	std::vector<std::string> f {"TPI", "TRI", "aspect", "flowdir", "slope", "roughness"};
-	for (size_t i=0; i<v.size(); i++) {
-		if (std::find(f.begin(), f.end(), v[i]) == f.end()) {
-			out.setError("unknown terrain variable: " + v[i]);
-			return(out);
-		}
-		if (v[i] == "slope" || v[i] == "aspect") {
-			aspslope=true;
-		} 
-	}
-
-	if ((neighbors != 4) && (neighbors != 8)) {
-		out.setError("neighbors should be 4 or 8");
+	// lon/lat: the area of a cell depends on its row
+	size_t nl = nlyr();
+	std::vector<std::vector<double>> out(nl);
+	SpatCellArea ca(*this, "m", false, opt);
+	if (ca.error != "") {
+		setError(ca.error);
 		return out;
 	}
-	bool lonlat = is_lonlat();
-	double yr = yres();
-
 	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	
-	opt.minrows = 3;
-  	if (!out.writeStart(opt)) {
-		readStop();
 		return out;
 	}
+	std::vector<std::map<double, double>> sums(nl);
 	size_t nc = ncol();
-
-	if (nrow() < 3 || nc < 3) {
-		for (size_t i = 0; i < out.bs.n; i++) {
-			std::vector<double> val(out.bs.nrows[i] * nc, NAN);
-			if (!out.writeBlock(val, i)) return out;
-		}
-		return out;
-	}
-
-
-	std::vector<double> y;
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> d;
-		bool before= false;
-		bool after = false;
-		size_t rrow = out.bs.row[i];
-		size_t rnrw = out.bs.nrows[i];
-		if (i > 0) {
-			rrow--;
-			rnrw++;
-			before=true;
-		}	
-		if ((out.bs.row[i] + out.bs.nrows[i]) < nrow()) {
-			rnrw++;
-			after = true;
-		}
-		readValues(d, rrow, rnrw, 0, nc);
-		if (lonlat && aspslope) {
-			std::vector<int_64> rows(rnrw);
-			std::iota(rows.begin(), rows.end(), rrow);
-			y = yFromRow(rows);
-			yr = distHaversine(0, 0, 0, yres());
-		}
-		std::vector<double> val;
-		val.reserve(out.bs.nrows[i] * ncol() * v.size());
-		for (size_t j =0; j<v.size(); j++) {
-			if (v[j] == "slope") {
-				do_slope(val, d, neighbors, rnrw, nc, xres(), yr, lonlat, y, degrees, before, after);
-			} else if (v[j] == "aspect") {
-				do_aspect(val, d, neighbors, rnrw, nc, xres(), yr, lonlat, y, degrees, before, after);
-			} else if (v[j] == "flowdir") {
-				double dx = xres();
-				double dy = yres();
-				if (lonlat) {
-					double yhalf = yFromRow((size_t) nrow()/2);
-					dx = distHaversine(0, yhalf, dx, yhalf);
-					dy = distHaversine(0, 0, 0, dy);
+	BlockSize bs = getBlockSize(opt);
+	for (size_t i=0; i<bs.n; i++) {
+		std::vector<double> v;
+		readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+		size_t off = bs.nrows[i] * nc;
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			for (size_t j=0; j<bs.nrows[i]; j++) {
+				double a = ca.row(bs.row[i] + j);
+				size_t offset = lyr * off + j * nc;
+				for (size_t k=offset; k<(offset+nc); k++) {
+					if (!std::isnan(v[k])) sums[lyr][v[k]] += a;
 				}
-				do_flowdir(val, d, rnrw, nc, dx, dy, seed, before, after);
-			} else if (v[j] == "roughness") {
-				do_roughness(val, d, rnrw, nc, before, after);
-			} else if (v[j] == "TPI") {
-				do_TPI(val, d, rnrw, nc, before, after);
-			} else if (v[j] == "TRI") {
-				do_TRI(val, d, rnrw, nc, before, after);
-			} else {
-				out.setError("?"); return out;
 			}
 		}
-		if (!out.writeBlock(val, i)) return out;
 	}
-	out.writeStop();
 	readStop();
-	return out; 
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		for (auto &s : sums[lyr]) out[lyr].push_back(s.first);
+		for (auto &s : sums[lyr]) out[lyr].push_back(s.second);
+	}
+	return out;
 }
-
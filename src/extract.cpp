@@ -858,7 +858,9 @@ std::vector<std::vector<double>> SpatRaster::extractCell(std::vector<double> &ce
 			//	srcout = readCellsBinary(src, cell);
 			//} else {
 			#ifdef useGDAL
-			if (win) {
+			if (source[src].multidim) {
+				srcout = readRowColMulti(src, win ? wrc[0] : rc[0], win ? wrc[1] : rc[1]);
+			} else if (win) {
 				srcout = readRowColGDAL(src, wrc[0], wrc[1]);
 			} else {
 				srcout = readRowColGDAL(src, rc[0], rc[1]);
@@ -937,7 +939,12 @@ std::vector<double> SpatRaster::extractCellFlat(std::vector<double> &cell) {
 			//} else {
 			#ifdef useGDAL
 			std::vector<double> g;
-			if (win) {
+			if (source[src].multidim) {
+				std::vector<std::vector<double>> m = readRowColMulti(src, win ? wrc[0] : rc[0], win ? wrc[1] : rc[1]);
+				for (size_t i=0; i<m.size(); i++) {
+					g.insert(g.end(), m[i].begin(), m[i].end());
+				}
+			} else if (win) {
 				g = readRowColGDALFlat(src, wrc[0], wrc[1]);
 			} else {
 				g = readRowColGDALFlat(src, rc[0], rc[1]);
@@ -1,4 +1,7 @@
 #include "spatBase.h"
+#ifdef useGDAL
+#include "gdal_pool.h"
+#endif
 #include <fstream>
 #include <random>
 #include <chrono>
@@ -131,6 +134,9 @@ bool filepath_exists(const std::string& name) {
 bool can_write(std::string filename, bool overwrite, std::string &msg) {
 	if (file_exists(filename)) {
 		if (overwrite) {
+			#ifdef useGDAL
+			gdal_pool_forget(filename);
+			#endif
 			if (remove(filename.c_str()) != 0) {
 				msg = ("cannot overwrite existing file");
 				return false;
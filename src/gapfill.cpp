@@ -0,0 +1,312 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include <cmath>
+#include <algorithm>
+
+
+struct GapPars {
+	// the position (e.g. time) of each layer
+	std::vector<double> z;
+	std::string method;
+	double maxgap;
+	// rule: 1 (NA) or 2 (nearest value) before the first and after the last value
+	int ruleleft, ruleright;
+	double yleft, yright;
+	double f;
+	bool narule;
+};
+
+
+// Fritsch-Carlson derivatives for monotone piecewise cubic (PCHIP)
+// interpolation through the points (x, y)
+static void pchip_slopes(const std::vector<double> &x, const std::vector<double> &y, std::vector<double> &d) {
+	size_t n = x.size();
+	d.resize(n);
+	if (n == 2) {
+		d[0] = d[1] = (y[1] - y[0]) / (x[1] - x[0]);
+		return;
+	}
+	std::vector<double> h(n-1), del(n-1);
+	for (size_t i=0; i<(n-1); i++) {
+		h[i] = x[i+1] - x[i];
+		del[i] = (y[i+1] - y[i]) / h[i];
+	}
+	for (size_t i=1; i<(n-1); i++) {
+		if ((del[i-1] * del[i]) <= 0) {
+			d[i] = 0;
+		} else {
+			double w1 = 2 * h[i] + h[i-1];
+			double w2 = h[i] + 2 * h[i-1];
+			d[i] = (w1 + w2) / (w1 / del[i-1] + w2 / del[i]);
+		}
+	}
+	// one-sided, shape preserving, three-point estimates at the ends
+	for (size_t e=0; e<2; e++) {
+		size_t i = e == 0 ? 0 : n-1;
+		size_t a = e == 0 ? 0 : n-2;
+		size_t b = e == 0 ? 1 : n-3;
+		double de = ((2 * h[a] + h[b]) * del[a] - h[a] * del[b]) / (h[a] + h[b]);
+		if ((de * del[a]) <= 0) {
+			de = 0;
+		} else if (((del[a] * del[b]) <= 0) && (std::fabs(de) > std::fabs(3 * del[a]))) {
+			de = 3 * del[a];
+		}
+		d[i] = de;
+	}
+}
+
+
+// fill the NA values of one cell. "v" has the value of layer i at v[i*stride]
+static void gap_cell(const GapPars &p, const double *v, size_t stride, double *out, std::vector<double> &x, std::vector<double> &y, std::vector<double> &d) {
+
+	size_t nl = p.z.size();
+	x.resize(0);
+	y.resize(0);
+	for (size_t i=0; i<nl; i++) {
+		double val = v[i*stride];
+		out[i*stride] = val;
+		if (!std::isnan(val)) {
+			x.push_back(p.z[i]);
+			y.push_back(val);
+		}
+	}
+	size_t n = x.size();
+	if ((n == nl) || (n == 0)) return;
+	if (n == 1) {
+		if (p.narule) {
+			for (size_t i=0; i<nl; i++) out[i*stride] = y[0];
+		}
+		return;
+	}
+	bool pchip = p.method == "pchip";
+	if (pchip) pchip_slopes(x, y, d);
+
+	size_t j = 0;
+	for (size_t i=0; i<nl; i++) {
+		if (!std::isnan(v[i*stride])) continue;
+		double zi = p.z[i];
+		if (zi < x[0]) {
+			out[i*stride] = !std::isnan(p.yleft) ? p.yleft : (p.ruleleft == 2 ? y[0] : NAN);
+			continue;
+		}
+		if (zi > x[n-1]) {
+			out[i*stride] = !std::isnan(p.yright) ? p.yright : (p.ruleright == 2 ? y[n-1] : NAN);
+			continue;
+		}
+		while (x[j+1] < zi) j++;
+		double h = x[j+1] - x[j];
+		if (h > p.maxgap) continue;
+		double t = (zi - x[j]) / h;
+		double val;
+		if (p.method == "constant") {
+			val = p.f == 0 ? y[j] : (p.f == 1 ? y[j+1] : y[j] * (1 - p.f) + y[j+1] * p.f);
+		} else if (p.method == "nearest") {
+			val = t <= 0.5 ? y[j] : y[j+1];
+		} else if (pchip) {
+			double t2 = t * t;
+			double t3 = t2 * t;
+			val = (2*t3 - 3*t2 + 1) * y[j] + (t3 - 2*t2 + t) * h * d[j] + (-2*t3 + 3*t2) * y[j+1] + (t3 - t2) * h * d[j+1];
+		} else {
+			val = y[j] + t * (y[j+1] - y[j]);
+		}
+		out[i*stride] = val;
+	}
+}
+
+
+// the weights of the values at positions "x" (relative to the target
+// position) for the value at zero of a least squares polynomial
+static bool sg_weights(const std::vector<double> &x, unsigned degree, std::vector<double> &w) {
+	size_t n = x.size();
+	size_t m = std::min((size_t)degree + 1, n);
+	if (m == 0) return false;
+	double s = 0;
+	for (size_t k=0; k<n; k++) s = std::max(s, std::fabs(x[k]));
+	if (s == 0) s = 1;
+	// normal equations A = X'X; solve A c = e1, then w = X c
+	std::vector<double> A(m * m, 0), c(m, 0);
+	for (size_t k=0; k<n; k++) {
+		double xk = x[k] / s;
+		double pa = 1;
+		for (size_t a=0; a<m; a++) {
+			double pb = 1;
+			for (size_t b=0; b<m; b++) {
+				A[a*m+b] += pa * pb;
+				pb *= xk;
+			}
+			pa *= xk;
+		}
+	}
+	c[0] = 1;
+	for (size_t col=0; col<m; col++) {
+		size_t piv = col;
+		for (size_t r=col+1; r<m; r++) {
+			if (std::fabs(A[r*m+col]) > std::fabs(A[piv*m+col])) piv = r;
+		}
+		if (std::fabs(A[piv*m+col]) < 1e-12) return false;
+		if (piv != col) {
+			for (size_t b=0; b<m; b++) std::swap(A[col*m+b], A[piv*m+b]);
+			std::swap(c[col], c[piv]);
+		}
+		for (size_t r=0; r<m; r++) {
+			if (r == col) continue;
+			double fr = A[r*m+col] / A[col*m+col];
+			if (fr == 0) continue;
+			for (size_t b=col; b<m; b++) A[r*m+b] -= fr * A[col*m+b];
+			c[r] -= fr * c[col];
+		}
+	}
+	for (size_t a=0; a<m; a++) c[a] /= A[a*m+a];
+	w.resize(n);
+	for (size_t k=0; k<n; k++) {
+		double xk = x[k] / s;
+		double pa = 1, val = 0;
+		for (size_t a=0; a<m; a++) {
+			val += c[a] * pa;
+			pa *= xk;
+		}
+		w[k] = val;
+	}
+	return true;
+}
+
+
+SpatRaster SpatRaster::fillGaps(std::vector<double> z, std::string method, double maxgap, std::vector<int> rule, double yleft, double yright, double f, bool narule, unsigned window, SpatOptions &opt) {
+
+	SpatRaster out = geometry(nlyr(), true, true, true);
+	size_t nl = nlyr();
+
+	std::vector<std::string> methods {"linear", "constant", "nearest", "pchip", "sgolay"};
+	if (std::find(methods.begin(), methods.end(), method) == methods.end()) {
+		out.setError("unknown method: " + method);
+		return out;
+	}
+	if (z.empty()) {
+		for (size_t i=0; i<nl; i++) z.push_back(i+1);
+	}
+	if (z.size() != nl) {
+		out.setError("the number of z values does not match the number of layers");
+		return out;
+	}
+	for (size_t i=1; i<nl; i++) {
+		if (!(z[i] > z[i-1])) {
+			out.setError("z values must be increasing");
+			return out;
+		}
+	}
+	if (rule.empty()) rule.push_back(1);
+	if (rule.size() == 1) rule.push_back(rule[0]);
+	if ((method == "sgolay") && (window < 3)) {
+		out.setError("window should be at least 3");
+		return out;
+	}
+	if (!hasValues()) return out;
+
+	GapPars p;
+	p.z = z;
+	p.method = method == "sgolay" ? "linear" : method;
+	p.maxgap = std::isnan(maxgap) ? INFINITY : maxgap;
+	p.ruleleft = rule[0];
+	p.ruleright = rule[1];
+	p.yleft = yleft;
+	p.yright = yright;
+	p.f = f;
+	p.narule = narule;
+
+	// Savitzky-Golay: a quadratic fit to the values of "window" layers
+	// around each layer. The weights for windows without NA are computed
+	// once and applied to all cells; windows with NA are fitted by cell
+	size_t half = window / 2;
+	const unsigned degree = 2;
+	std::vector<size_t> sg0(nl), sg1(nl);
+	std::vector<std::vector<double>> sgw(nl);
+	if (method == "sgolay") {
+		std::vector<double> dx;
+		for (size_t i=0; i<nl; i++) {
+			sg0[i] = i < half ? 0 : i - half;
+			sg1[i] = std::min(nl, i + half + 1);
+			dx.resize(0);
+			for (size_t k=sg0[i]; k<sg1[i]; k++) dx.push_back(z[k] - z[i]);
+			if (!sg_weights(dx, degree, sgw[i])) sgw[i].resize(0);
+		}
+	}
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+ 	if (!out.writeStart(opt)) {
+		readStop();
+		return out;
+	}
+	std::vector<double> x, y, d, dx, yw, w;
+	for (size_t i=0; i<out.bs.n; i++) {
+		std::vector<double> v;
+		readBlock(v, out.bs, i);
+		size_t nc = out.bs.nrows[i] * ncol();
+		std::vector<double> s(v.size());
+		for (size_t j=0; j<nc; j++) {
+			gap_cell(p, &v[j], nc, &s[j], x, y, d);
+		}
+		if (method == "sgolay") {
+			v.assign(v.size(), NAN);
+			for (size_t k=0; k<nl; k++) {
+				const std::vector<double> &wk = sgw[k];
+				double *vk = &v[k*nc];
+				const double *sk = &s[k*nc];
+				for (size_t j=0; j<nc; j++) {
+					// values that could not be filled are not estimated
+					if (std::isnan(sk[j])) continue;
+					double val = 0;
+					if (!wk.empty()) {
+						for (size_t m=sg0[k]; m<sg1[k]; m++) {
+							val += wk[m - sg0[k]] * s[m*nc + j];
+						}
+					}
+					if (std::isnan(val) || wk.empty()) {
+						dx.resize(0);
+						yw.resize(0);
+						for (size_t m=sg0[k]; m<sg1[k]; m++) {
+							double sm = s[m*nc + j];
+							if (std::isnan(sm)) continue;
+							dx.push_back(z[m] - z[k]);
+							yw.push_back(sm);
+						}
+						val = sk[j];
+						if (sg_weights(dx, degree, w)) {
+							val = 0;
+							for (size_t m=0; m<w.size(); m++) val += w[m] * yw[m];
+						}
+					}
+					vk[j] = val;
+				}
+			}
+		} else {
+			v = std::move(s);
+		}
+		if (!out.writeBlock(v, i)) {
+			readStop();
+			return out;
+		}
+	}
+	out.writeStop();
+	readStop();
+	return out;
+}
+
@@ -28,6 +28,7 @@
 #include "crs.h"
 #include "gdalio.h"
 #include "recycle.h"
+#include "cpl_worker_thread_pool.h"
 
 
 //#include <vector>
@@ -274,6 +275,8 @@ bool getAlgo(GDALResampleAlg &alg, std::string m) {
 }
 
 
+bool is_native_resample_method(const std::string &method);
+
 bool is_valid_warp_method(const std::string &method) {
 	std::vector<std::string> m { "near", "bilinear", "cubic", "cubicspline", "lanczos", "average", "mode", "max", "min", "med", "q1", "q3", "sum", "rms"};
 	return (std::find(m.begin(), m.end(), method) != m.end());
@@ -371,6 +374,198 @@ bool gdal_warper(GDALWarpOptions *psWarpOptions, GDALDatasetH &hSrcDS, GDALDatas
 	return true;
 }
 
+// what is needed to warp blocks of the output raster; one per thread
+struct WarpJob {
+	std::vector<GDALDatasetH> src;
+	GDALDatasetH dst = NULL;
+	// the bands of each source, and where they go in dst
+	std::vector<std::vector<unsigned>> srcbands, dstbands;
+	std::string method, srccrs;
+	bool threads = false;
+	// the warp operations (one per source), and their GenImgProj
+	// transformers that are wrapped by an approximate transformer
+	std::vector<GDALWarpOptions*> wopt;
+	std::vector<GDALWarpOperation*> ops;
+	std::vector<void*> gen;
+	size_t ncol = 0, nlyr = 0;
+	std::vector<double> naflag;
+	std::vector<bool> has_so;
+	std::vector<double> scale, offset;
+	// the block to warp
+	double xmin, ymax, xres, yres;
+	size_t nrows = 0;
+	std::vector<double> v;
+	bool success = false;
+	std::string msg;
+};
+
+
+static void warp_release(WarpJob &job) {
+	for (size_t j=0; j<job.ops.size(); j++) {
+		delete job.ops[j];
+	}
+	for (size_t j=0; j<job.wopt.size(); j++) {
+		if (job.wopt[j]->pTransformerArg != NULL) {
+			GDALDestroyApproxTransformer(job.wopt[j]->pTransformerArg);
+		}
+		GDALDestroyWarpOptions(job.wopt[j]);
+	}
+	job.ops.resize(0);
+	job.wopt.resize(0);
+	job.gen.resize(0);
+}
+
+
+void warp_cleanup(WarpJob &job) {
+	warp_release(job);
+	for (size_t j=0; j<job.src.size(); j++) {
+		if (job.src[j] != NULL) GDALClose(job.src[j]);
+	}
+	if (job.dst != NULL) GDALClose(job.dst);
+	job.src.resize(0);
+	job.dst = NULL;
+}
+
+
+// create the warp operations of all sources. They are used for all blocks;
+// only the geotransform of the destination changes between blocks
+static bool warp_prepare(WarpJob &job, std::string &msg, bool verbose) {
+	for (size_t j=0; j<job.src.size(); j++) {
+		GDALWarpOptions *psWarpOptions = GDALCreateWarpOptions();
+		if (!set_warp_options(psWarpOptions, job.src[j], job.dst, job.srcbands[j], job.dstbands[j], job.method, job.srccrs, msg, verbose, job.threads)) {
+			GDALDestroyWarpOptions(psWarpOptions);
+			msg = "cannot set warp options";
+			return false;
+		}
+		if (psWarpOptions->pTransformerArg == NULL) {
+			GDALDestroyWarpOptions(psWarpOptions);
+			msg = "cannot create transformer for warping";
+			return false;
+		}
+		// transform exactly at the edges of chunks, and interpolate in between
+		// (as gdalwarp does by default, with an error threshold of 0.125 cell)
+		void *gen = psWarpOptions->pTransformerArg;
+		psWarpOptions->pTransformerArg = GDALCreateApproxTransformer(GDALGenImgProjTransform, gen, 0.125);
+		GDALApproxTransformerOwnsSubtransformer(psWarpOptions->pTransformerArg, TRUE);
+		psWarpOptions->pfnTransformer = GDALApproxTransform;
+		job.wopt.push_back(psWarpOptions);
+		job.gen.push_back(gen);
+
+		GDALWarpOperation *op = new GDALWarpOperation;
+		job.ops.push_back(op);
+		if (op->Initialize(psWarpOptions) != CE_None) {
+			msg = "cannot initialize warp";
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// open the sources and create the destination and the warp operations.
+// With "separate", files are not opened as shared datasets, such that
+// each thread has its own handles
+bool warp_setup(WarpJob &job, SpatRaster &x, SpatRaster &block, std::string method, std::string srccrs, std::vector<bool> has_so, std::vector<double> scale, std::vector<double> offset, bool separate, SpatOptions &opt, std::string &msg) {
+
+	if (!block.create_gdalDS(job.dst, "", "MEM", false, NAN, has_so, scale, offset, opt)) {
+		msg = "cannot create dataset for warping";
+		return false;
+	}
+	job.ncol = block.ncol();
+	job.nlyr = block.nlyr();
+	job.has_so = has_so;
+	job.scale = scale;
+	job.offset = offset;
+
+	size_t ns = x.nsrc();
+	int bandstart = 0;
+	for (size_t j=0; j<ns; j++) {
+		GDALDatasetH hSrcDS;
+		if (separate) {
+			hSrcDS = (GDALDatasetH) openGDAL(x.source[j].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, x.source[j].open_ops);
+		} else if (!x.open_gdal(hSrcDS, j, false, opt)) {
+			hSrcDS = NULL;
+		}
+		if (hSrcDS == NULL) {
+			msg = "cannot create dataset from source";
+			return false;
+		}
+		job.src.push_back(hSrcDS);
+
+		std::vector<unsigned> srcbands = x.source[j].layers;
+		std::vector<unsigned> dstbands(srcbands.size());
+		std::iota(dstbands.begin(), dstbands.end(), bandstart);
+		bandstart += dstbands.size();
+		job.srcbands.push_back(srcbands);
+		job.dstbands.push_back(dstbands);
+	}
+	job.method = method;
+	job.srccrs = srccrs;
+	job.threads = opt.threads && (!separate);
+	// this also sets the NA flags of the destination
+	if (!warp_prepare(job, msg, opt.get_verbose())) {
+		return false;
+	}
+
+	int hasNA;
+	job.naflag.resize(job.nlyr, NAN);
+	for (size_t i=0; i<job.nlyr; i++) {
+		GDALRasterBandH hBand = GDALGetRasterBand(job.dst, i+1);
+		double naflag = GDALGetRasterNoDataValue(hBand, &hasNA);
+		if (hasNA) job.naflag[i] = naflag;
+	}
+	return true;
+}
+
+
+// warp one block into job.v
+void warp_block(WarpJob &job) {
+	job.success = false;
+	double gt[6] = {job.xmin, job.xres, 0, job.ymax, 0, -job.yres};
+	GDALSetGeoTransform(job.dst, gt);
+	for (size_t j=0; j<job.ops.size(); j++) {
+		GDALSetGenImgProjTransformerDstGeoTransform(job.gen[j], gt);
+		if (job.ops[j]->ChunkAndWarpImage(0, 0, job.ncol, job.nrows) != CE_None) {
+			job.msg = "warp failure";
+			return;
+		}
+	}
+	size_t nc = job.ncol * job.nrows;
+	job.v.resize(nc * job.nlyr);
+	for (size_t i=0; i<job.nlyr; i++) {
+		double *d = &job.v[i * nc];
+		GDALRasterBandH hBand = GDALGetRasterBand(job.dst, i+1);
+		if (GDALRasterIO(hBand, GF_Read, 0, 0, job.ncol, job.nrows, d, job.ncol, job.nrows, GDT_Float64, 0, 0) != CE_None) {
+			job.msg = "cannot do this transformation (warp)";
+			return;
+		}
+		double flag = job.naflag[i];
+		if (!std::isnan(flag)) {
+			if (flag < -3.4e+37) {
+				for (size_t k=0; k<nc; k++) if (d[k] < -3.4e+37) d[k] = NAN;
+			} else {
+				std::replace(d, d+nc, flag, (double) NAN);
+			}
+		}
+		if (job.has_so[i]) {
+			for (size_t k=0; k<nc; k++) d[k] = d[k] * job.scale[i] + job.offset[i];
+		}
+	}
+	job.success = true;
+}
+
+static void warp_job(void *p) {
+	WarpJob *job = static_cast<WarpJob*>(p);
+	// the default error handler calls R, which is not allowed from this thread
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+	warp_block(*job);
+	if ((!job->success) && (CPLGetLastErrorMsg()[0] != '\0')) {
+		job->msg += " (" + std::string(CPLGetLastErrorMsg()) + ")";
+	}
+	CPLPopErrorHandler();
+}
+
+
 SpatRaster SpatRaster::warper(SpatRaster x, std::string crs, std::string method, bool mask, bool align, SpatOptions &opt) {
 
 
@@ -444,6 +639,15 @@ SpatRaster SpatRaster::warper(SpatRaster x, std::string crs, std::string method,
 		return out;
 	}
 
+	// with the same crs, the cells can be computed without the GDAL warper
+	bool native = (!use_crs) && (!align) && (!mask) && is_native_resample_method(method)
+			&& source[0].srs.is_same(out.source[0].srs, false);
+	for (size_t i=0; i<source.size(); i++) native = native && (!source[i].rotated);
+	if (native) {
+		resample_native(out, method, opt);
+		return out;
+	}
+
 	SpatOptions mopt;
 	if (mask) {
 		mopt = opt;
@@ -469,59 +673,60 @@ SpatRaster SpatRaster::warper(SpatRaster x, std::string crs, std::string method,
 		offset.insert(offset.end(), source[0].offset.begin(), source[0].offset.end());
 	}
 
-	for (size_t i = 0; i < out.bs.n; i++) {
-		int bandstart = 0;
-		eout.ymax = out.yFromRow(out.bs.row[i]);
-		eout.ymin = out.yFromRow(out.bs.row[i] + out.bs.nrows[i]-1);
-		SpatRaster crop_out = out.crop(eout, "out", sopt);
-		GDALDatasetH hDstDS;
-
-		if (!crop_out.create_gdalDS(hDstDS, "", "MEM", false, NAN, has_so, scale, offset, sopt)) {
-			return crop_out;
-		}
+	// the destination is created once (per thread) with the size of the largest
+	// block. For each block, it is moved, and the warp operations are created
+	// anew
+	size_t maxrows = *std::max_element(out.bs.nrows.begin(), out.bs.nrows.end());
+	SpatRaster block = out.geometry();
+	block.source[0].nrow = maxrows;
+	block.source[0].extent.ymin = eout.ymax - maxrows * out.yres();
 
-		for (size_t j=0; j<ns; j++) {
+	// concurrent warping requires separate handles to the files
+	bool fromfile = true;
+	for (size_t j=0; j<ns; j++) fromfile = fromfile && (!source[j].memory);
+	size_t nthreads = fromfile ? std::min((size_t)gdal_read_threads(), (size_t)out.bs.n) : 1;
 
-			GDALDatasetH hSrcDS;
-
-			if (!open_gdal(hSrcDS, j, false, sopt)) {
-				out.setError("cannot create dataset from source");
-				if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
-				return out;
-			}
-			std::vector<unsigned> srcbands = source[j].layers;
-			std::vector<unsigned> dstbands(srcbands.size()); 
-			std::iota (dstbands.begin(), dstbands.end(), bandstart); 
-			bandstart += dstbands.size();
+	std::vector<WarpJob> jobs(nthreads);
+	for (size_t t=0; t<nthreads; t++) {
+		if (!warp_setup(jobs[t], *this, block, method, srccrs, has_so, scale, offset, nthreads > 1, sopt, errmsg)) {
+			for (size_t k=0; k<=t; k++) warp_cleanup(jobs[k]);
+			out.setError(errmsg);
+			return out;
+		}
+		jobs[t].xmin = eout.xmin;
+		jobs[t].xres = out.xres();
+		jobs[t].yres = out.yres();
+	}
 
+	CPLWorkerThreadPool pool;
+	if ((nthreads > 1) && (!pool.Setup(nthreads, NULL, NULL))) {
+		for (size_t t=0; t<nthreads; t++) warp_cleanup(jobs[t]);
+		out.setError("cannot start threads for warping");
+		return out;
+	}
 
-			GDALWarpOptions *psWarpOptions = GDALCreateWarpOptions();
-			bool ok = set_warp_options(psWarpOptions, hSrcDS, hDstDS, srcbands, dstbands, method, srccrs, errmsg, opt.get_verbose(), opt.threads);
-			if (!ok) {
-				if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
-				out.setError(errmsg);
-				return out;
+	// blocks are warped in batches of nthreads, and written in order
+	for (size_t i = 0; i < out.bs.n; i += nthreads) {
+		size_t nb = std::min(nthreads, (size_t)out.bs.n - i);
+		for (size_t t=0; t<nb; t++) {
+			jobs[t].ymax = out.yFromRow(out.bs.row[i+t]) + jobs[t].yres / 2;
+			jobs[t].nrows = out.bs.nrows[i+t];
+			if (nthreads > 1) {
+				pool.SubmitJob(warp_job, &jobs[t]);
+			} else {
+				warp_block(jobs[t]);
 			}
-
-			//bool success = gdal_warper(hSrcDS, hDstDS, srcbands, dstbands, method, srccrs, errmsg, opt.get_verbose(), opt.threads);
-			ok = gdal_warper(psWarpOptions, hSrcDS, hDstDS);
-			if( hSrcDS != NULL ) GDALClose( (GDALDatasetH) hSrcDS );
-			if (!ok) {
-				if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
-				out.setError("warp failure");
+		}
+		if (nthreads > 1) pool.WaitCompletion();
+		for (size_t t=0; t<nb; t++) {
+			if ((!jobs[t].success) || (!out.writeBlock(jobs[t].v, i+t))) {
+				if (!jobs[t].success) out.setError(jobs[t].msg);
+				for (size_t k=0; k<nthreads; k++) warp_cleanup(jobs[k]);
 				return out;
 			}
 		}
-
-		bool ok = crop_out.from_gdalMEM(hDstDS, false, true); 
-		if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
-		if (!ok) {
-			out.setError("cannot do this transformation (warp)");
-			return out;
-		}
-		std::vector<double> v = crop_out.getValues(-1, opt);
-		if (!out.writeBlock(v, i)) return out;
 	}
+	for (size_t t=0; t<nthreads; t++) warp_cleanup(jobs[t]);
 	out.writeStop();
 
 
@@ -712,145 +917,6 @@ SpatRaster SpatRaster::rectify(std::string method, SpatRaster aoi, unsigned usea
 
 
 
-SpatVector SpatRaster::polygonize(bool trunc, bool values, bool narm, bool aggregate, SpatOptions &opt) {
-
-	SpatVector out;
-	out.srs = source[0].srs;
-	SpatOptions topt(opt);
-
-	SpatRaster tmp;
-	if (nlyr() > 1) {
-		out.addWarning("only the first layer is polygonized when 'dissolve=TRUE'");
-		tmp = subset({0}, topt);
-	} else {
-		tmp = *this;
-	}
-
-//	bool usemask = false;
-	SpatRaster mask;
-	if (narm) {
-//		usemask = true;
-		SpatOptions mopt(topt);
-		mopt.set_datatype("INT1U"); 
-		mask = tmp.isfinite(mopt);
-	} else if (trunc) {
-		tmp = tmp.math("trunc", topt);
-		trunc = false; 
-	} else if (tmp.sources_from_file()) {
-		// for NAN and INT files. Should have a check for that
-		//tmp = tmp.arith(0, "+", false, topt);
-		// riskier  
-		tmp.readAll();
-	}
-	if (tmp.source[0].extset) {
-		tmp = tmp.hardCopy(topt);
-	}
-
-	GDALDatasetH rstDS;
-	if (!tmp.open_gdal(rstDS, 0, false, topt)) {
-		out.setError("cannot open dataset");
-		return out;
-	}
-
-    GDALDataset *srcDS=NULL;
-
-#if GDAL_VERSION_MAJOR <= 2 && GDAL_VERSION_MINOR <= 2
-	srcDS = (GDALDataset *) rstDS;
-#else
-	srcDS = srcDS->FromHandle(rstDS);
-#endif
-
-	GDALDataset *maskDS=NULL;
-	GDALDatasetH rstMask;
-	if (narm) {
-		if (!mask.open_gdal(rstMask, 0, false, opt)) {
-			out.setError("cannot open dataset");
-			return out;
-		}
-#if GDAL_VERSION_MAJOR <= 2 && GDAL_VERSION_MINOR <= 2
-		maskDS = (GDALDataset *) rstMask;
-#else
-		maskDS = srcDS->FromHandle(rstMask);
-#endif
-	}
-
-    GDALDataset *poDS = NULL;
-    GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName( "Memory" );
-    if( poDriver == NULL )  {
-        out.setError( "cannot create output driver");
-        return out;
-    }
-    poDS = poDriver->Create("", 0, 0, 0, GDT_Unknown, NULL );
-    if( poDS == NULL ) {
-        out.setError("Creation of output dataset failed" );
-        return out;
-    }
-	std::vector<std::string> nms = getNames();
-	std::string name = nms[0];
-
-	OGRSpatialReference *SRS = NULL;
-
-    OGRLayer *poLayer;
-    poLayer = poDS->CreateLayer(name.c_str(), SRS, wkbPolygon, NULL );
-    if( poLayer == NULL ) {
-        out.setError( "Layer creation failed" );
-        return out;
-    }
-	if (SRS != NULL) SRS->Release();
-
-	OGRFieldDefn oField(name.c_str(), trunc ?  OFTInteger : OFTReal);
-	if( poLayer->CreateField( &oField ) != OGRERR_NONE ) {
-		out.setError( "Creating field failed");
-		return out;
-	}
-
-	GDALRasterBand  *poBand;
-	poBand = srcDS->GetRasterBand(1);
-
-	//int hasNA=1;
-	//double naflag = poBand->GetNoDataValue(&hasNA);
-
-	CPLErr err;
-	if (narm) {
-		GDALRasterBand *maskBand;
-		maskBand = maskDS->GetRasterBand(1);
-		if (trunc) {
-			err = GDALPolygonize(poBand, maskBand, poLayer, 0, NULL, NULL, NULL);
-		} else {
-			err = GDALFPolygonize(poBand, maskBand, poLayer, 0, NULL, NULL, NULL);
-		}
-		GDALClose(maskDS);
-	} else {
-		if (trunc) {
-			err = GDALPolygonize(poBand, NULL, poLayer, 0, NULL, NULL, NULL);
-		} else {
-			err = GDALFPolygonize(poBand, NULL, poLayer, 0, NULL, NULL, NULL);
-		}
-	}
-	if (err == 4) {
-		out.setError("polygonize error");
-		return out;
-	}
-	GDALClose(srcDS);
-
-	std::vector<double> fext;
-	SpatVector fvct;
-	out.read_ogr(poDS, "", "", fext, fvct, false);
-	GDALClose(poDS);
-
-	if (aggregate && (out.nrow() > 0)) {
-		out = out.aggregate(name, false);
-	}
-
-	if (!values) {
-		out.df = SpatDataFrame();
-	} 
-
-	return out;
-}
-
-
-
 SpatRaster SpatRaster::rgb2col(size_t r,  size_t g, size_t b, SpatOptions &opt) {
 	SpatRaster out = geometry(1);
 	if (nlyr() < 3) {
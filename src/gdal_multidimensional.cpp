@@ -1,16 +1,45 @@
-
 #include "spatRaster.h"
 
-/*
-#if GDAL_VERSION_MAJOR >= 3 && GDAL_VERSION_MINOR >= 1
 
-#include "proj.h"
+std::vector<double>* SpatChunkCache::get(uint64_t key) {
+	auto it = chunks.find(key);
+	if (it == chunks.end()) {
+		return NULL;
+	}
+	// move to the front of the queue
+	lru.splice(lru.begin(), lru, it->second.second);
+	return &(it->second.first);
+}
+
+
+std::vector<double>* SpatChunkCache::put(uint64_t key, std::vector<double> &v) {
+	while ((!lru.empty()) && ((size + v.size()) > maxsize)) {
+		auto it = chunks.find(lru.back());
+		size -= it->second.first.size();
+		chunks.erase(it);
+		lru.pop_back();
+	}
+	lru.push_front(key);
+	size += v.size();
+	std::pair<std::vector<double>, std::list<uint64_t>::iterator> &p = chunks[key];
+	p.first.swap(v);
+	p.second = lru.begin();
+	return &p.first;
+}
+
+
+void SpatChunkCache::clear() {
+	chunks.clear();
+	lru.clear();
+	size = 0;
+}
 
-#include "ogr_spatialref.h"
 
-#include "gdal_priv.h"
+
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,1,0)
+
+#include "ogr_spatialref.h"
 #include "gdal.h"
-#include "crs.h"
 #include "string_utils.h"
 
 
@@ -18,111 +47,133 @@ bool SpatRaster::constructFromFileMulti(std::string fname, std::string sub, std:
 
 	if (xyz.size() != 3) {
 		setError("you must supply three dimension indices");
-        return false;
+		return false;
 	}
 
-    auto poDataset = std::unique_ptr<GDALDataset>(
-        GDALDataset::Open(fname.c_str(), GDAL_OF_MULTIDIM_RASTER ));
-    if( !poDataset ) {
+	GDALDatasetH hDS = GDALOpenEx(fname.c_str(), GDAL_OF_MULTIDIM_RASTER, NULL, NULL, NULL);
+	if (!hDS) {
 		setError("not a good dataset");
-        return false;
-    }
-
-	auto poRootGroup = poDataset->GetRootGroup();
-    if( !poRootGroup ) {
+		return false;
+	}
+	GDALGroupH hGroup = GDALDatasetGetRootGroup(hDS);
+	GDALReleaseDataset(hDS);
+	if (!hGroup) {
 		setError("no roots");
 		return false;
-    }
+	}
 
 	bool warngroup = false;
 	std::vector<std::string> gnames;
+	char** names = GDALGroupGetMDArrayNames(hGroup, NULL);
+	for (int i=0; i<CSLCount(names); i++) {
+		gnames.push_back(names[i]);
+	}
+	CSLDestroy(names);
 	if (sub == "") {
-		char** papszOptions = NULL;
-		gnames = poRootGroup->GetMDArrayNames(papszOptions);
-		CSLDestroy(papszOptions);
+		if (gnames.size() == 0) {
+			GDALGroupRelease(hGroup);
+			setError("no arrays found");
+			return false;
+		}
 		sub = gnames[0];
 		if (gnames.size() > 1) warngroup = true;
 	}
 
-    auto poVar = poRootGroup->OpenMDArray(sub.c_str());
-    if( !poVar )   {
+	GDALMDArrayH hVar = GDALGroupOpenMDArray(hGroup, sub.c_str(), NULL);
+	GDALGroupRelease(hGroup);
+	if (!hVar) {
 		setError("cannot find: " + sub);
 		return false;
-    }
+	}
 
 	SpatRasterSource s;
 
 	std::string wkt = "";
-	std::shared_ptr<OGRSpatialReference> srs = poVar->GetSpatialRef();
-	if (srs != NULL) {
-		char *cp;
+	OGRSpatialReferenceH hSRS = GDALMDArrayGetSpatialRef(hVar);
+	if (hSRS != NULL) {
+		char *cp = NULL;
 		const char *options[3] = { "MULTILINE=YES", "FORMAT=WKT2", NULL };
-		OGRErr err = srs->exportToWkt(&cp, options);
-		if (err == OGRERR_NONE) {
+		if (OSRExportToWktEx(hSRS, &cp, options) == OGRERR_NONE) {
 			wkt = std::string(cp);
-		} 
+		}
 		CPLFree(cp);
+		OSRDestroySpatialReference(hSRS);
 	}
 	std::string msg;
 	if (!s.srs.set({wkt}, msg)) {
 		addWarning(msg);
 	}
 
-
 	std::vector<size_t> dimcount;
 	std::vector<std::string> dimnames;
 	std::vector<double> dim_start, dim_end;
 
+	size_t ndims;
+	GDALDimensionH* hDims = GDALMDArrayGetDimensions(hVar, &ndims);
 	GDALExtendedDataTypeH hDT = GDALExtendedDataTypeCreate(GDT_Float64);
-    for ( const auto &poDim: poVar->GetDimensions() ) {
-        dimcount.push_back(static_cast<size_t>(poDim->GetSize()));
-        dimnames.push_back(static_cast<std::string>(poDim->GetName()));
-
-		std::vector<size_t> count = {dimcount[dimcount.size()-1]};
-		std::vector<double> vals(count[0]);
-
-		const auto indvar = poDim->GetIndexingVariable();
-		indvar->Read(
-			std::vector<GUInt64>{0}.data(),
-            count.data(), nullptr, nullptr, 
-            GDALExtendedDataType::Create(GDT_Float64),
-            &vals[0]);
-
-		// to do: check for equal spacing if x or y dim
-		dim_start.push_back(vals[0]);
-        dim_end.push_back(vals[vals.size()-1]);
-		Rcpp::Rcout << vals[0] << " - " << vals[vals.size()-1] << std::endl;
-
-    }
-    GDALExtendedDataTypeRelease(hDT); 
+	for (size_t i=0; i<ndims; i++) {
+		size_t n = GDALDimensionGetSize(hDims[i]);
+		dimcount.push_back(n);
+		dimnames.push_back(GDALDimensionGetName(hDims[i]));
+		// without an indexing variable, the cell numbers are used
+		double first = 0;
+		double last = n - 1;
+		GDALMDArrayH hIdx = GDALDimensionGetIndexingVariable(hDims[i]);
+		if (hIdx && (n > 0)) {
+			GUInt64 start = 0;
+			size_t count = 1;
+			GDALMDArrayRead(hIdx, &start, &count, NULL, NULL, hDT, &first, NULL, 0);
+			start = n - 1;
+			GDALMDArrayRead(hIdx, &start, &count, NULL, NULL, hDT, &last, NULL, 0);
+			GDALMDArrayRelease(hIdx);
+		}
+		dim_start.push_back(first);
+		dim_end.push_back(last);
+	}
+	GDALExtendedDataTypeRelease(hDT);
+	GDALReleaseDimensions(hDims, ndims);
 
-	s.m_ndims = dimcount.size();
+	s.m_ndims = ndims;
 
 	if (warngroup) {
 		std::string gn = "";
 		for (size_t i=0; i<gnames.size(); i++) {
-			if (!is_in_vector(gnames[i], dimnames) &&  (gnames[i] != sub)) { 
+			if (!is_in_vector(gnames[i], dimnames) && (gnames[i] != sub)) {
 				gn += gnames[i] + ", ";
 			}
 		}
 		addWarning("using: " + sub + ". Other groups are: \n" + gn);
 	}
 	s.source_name = sub;
-	s.source_name_long = poVar->GetAttribute("long_name")->ReadAsString();
+	GDALAttributeH hAtt = GDALMDArrayGetAttribute(hVar, "long_name");
+	if (hAtt) {
+		const char* ln = GDALAttributeReadAsString(hAtt);
+		if (ln != NULL) s.source_name_long = ln;
+		GDALAttributeRelease(hAtt);
+	}
 
-	s.m_hasNA = false;
-	double NAval = poVar->GetNoDataValueAsDouble(&s.m_hasNA);
+	int hasNA = false;
+	double NAval = GDALMDArrayGetNoDataValueAsDouble(hVar, &hasNA);
+	s.m_hasNA = hasNA;
 	if (s.m_hasNA) {
 		s.m_missing_value = NAval;
 	}
+	int hasScale = false;
+	int hasOffset = false;
+	double scale = GDALMDArrayGetScale(hVar, &hasScale);
+	double offset = GDALMDArrayGetOffset(hVar, &hasOffset);
+	std::string unit = GDALMDArrayGetUnit(hVar);
+	GDALMDArrayRelease(hVar);
 
 	SpatExtent e;
 	if (xyz[0] < s.m_ndims) {
 		s.nrow = dimcount[xyz[0]];
 		s.m_dimnames.push_back(dimnames[xyz[0]]);
-		double res = (dim_start[xyz[0]] - dim_end[xyz[0]]) / (s.nrow-1);
-		e.ymax = dim_start[xyz[0]] + 0.5 * res;
-		e.ymin = dim_end[xyz[0]] - 0.5 * res;
+		double res = s.nrow > 1 ? std::abs(dim_end[xyz[0]] - dim_start[xyz[0]]) / (s.nrow-1) : 1;
+		e.ymax = std::max(dim_start[xyz[0]], dim_end[xyz[0]]) + 0.5 * res;
+		e.ymin = std::min(dim_start[xyz[0]], dim_end[xyz[0]]) - 0.5 * res;
+		// the first row is the southern-most row
+		s.flipped = dim_start[xyz[0]] < dim_end[xyz[0]];
 	} else {
 		setError("the second dimension is not valid");
 		return false;
@@ -130,56 +181,53 @@ bool SpatRaster::constructFromFileMulti(std::string fname, std::string sub, std:
 	if (xyz[1] < s.m_ndims) {
 		s.ncol = dimcount[xyz[1]];
 		s.m_dimnames.push_back(dimnames[xyz[1]]);
-		double res = (dim_end[xyz[1]] - dim_start[xyz[1]]) / (s.ncol-1);
+		double res = s.ncol > 1 ? (dim_end[xyz[1]] - dim_start[xyz[1]]) / (s.ncol-1) : 1;
 		e.xmin = dim_start[xyz[1]] - 0.5 * res;
 		e.xmax = dim_end[xyz[1]] + 0.5 * res;
 	} else {
 		setError("the first dimension is not valid");
 		return false;
 	}
+	s.m_dims = {xyz[0], xyz[1]};
+	size_t nl = 1;
 	if (s.m_ndims > 2) {
 		if (xyz[2] < s.m_ndims) {
-			s.nlyr = dimcount[xyz[2]];
+			nl = dimcount[xyz[2]];
+			s.m_dims.push_back(xyz[2]);
 			s.m_dimnames.push_back(dimnames[xyz[2]]);
 		} else {
 			setError("the third dimension is not valid");
 			return false;
 		}
 	}
-	s.m_dims = xyz;
 	s.extent = e;
-	if (s.m_ndims > 3) {
-		for (size_t i=0; i<s.m_ndims; i++) {
-			bool found = false;
-			for (size_t j=0; j<3; j++) {
-				if (i == xyz[j]) found = true;
-			}
-			if (!found) {
-				s.m_dims.push_back(i);
-				s.m_dimnames.push_back(dimnames[i]);
-			}
+	// other dimensions are read at their first index
+	for (size_t i=0; i<s.m_ndims; i++) {
+		if (std::find(s.m_dims.begin(), s.m_dims.end(), i) == s.m_dims.end()) {
+			s.m_dims.push_back(i);
+			s.m_dimnames.push_back(dimnames[i]);
 		}
 	}
 
-	s.nlyrfile = s.nlyr;
-	s.layers.resize(s.nlyr);
-    std::iota(s.layers.begin(), s.layers.end(), 0);
-	s.flipped = false;
+	s.resize(nl);
+	s.nlyrfile = nl;
+	for (size_t i=0; i<nl; i++) {
+		s.names[i] = sub + "_" + std::to_string(i+1);
+	}
+	s.unit = std::vector<std::string>(nl, unit);
+	s.hasUnit = unit != "";
+	if (hasScale || hasOffset) {
+		s.has_scale_offset = std::vector<bool>(nl, true);
+		s.scale = std::vector<double>(nl, hasScale ? scale : 1);
+		s.offset = std::vector<double>(nl, hasOffset ? offset : 0);
+	}
 	s.rotated = false;
 	s.memory = false;
 	s.filename = fname;
 	s.hasValues = true;
-	s.unit = std::vector<std::string>(s.nlyr, poVar->GetUnit());
 	s.multidim = true;
-
-// layer names
-// time 
-// extent
 	s.m_counts = dimcount;
 	setSource(s);
-	for (size_t i=0; i<s.m_ndims; i++){
-		Rcpp::Rcout << s.m_dims[i] << " " << s.m_dimnames[i] << " " << s.m_counts[s.m_dims[i]] << std::endl;
-	}
 	return true;
 }
 
@@ -187,96 +235,270 @@ bool SpatRaster::constructFromFileMulti(std::string fname, std::string sub, std:
 
 bool SpatRaster::readStartMulti(unsigned src) {
 
-    GDALDatasetH hDS = GDALOpenEx( source[src].filename.c_str(), GDAL_OF_MULTIDIM_RASTER, NULL, NULL, NULL);
-    if (!hDS) {
+	GDALDatasetH hDS = GDALOpenEx( source[src].filename.c_str(), GDAL_OF_MULTIDIM_RASTER, NULL, NULL, NULL);
+	if (!hDS) {
 		setError("not a good dataset");
-        return false;
-    }
-    GDALGroupH hGroup = GDALDatasetGetRootGroup(hDS);
-    GDALReleaseDataset(hDS);
-    if (!hGroup) {
+		return false;
+	}
+	GDALGroupH hGroup = GDALDatasetGetRootGroup(hDS);
+	GDALReleaseDataset(hDS);
+	if (!hGroup) {
 		setError("not a good root group");
 		return false;
-    }
-    
+	}
+
 	GDALMDArrayH hVar = GDALGroupOpenMDArray(hGroup, source[src].source_name.c_str(), NULL);
-    GDALGroupRelease(hGroup);
-    if (!hVar) {
+	GDALGroupRelease(hGroup);
+	if (!hVar) {
 		setError("not a good array");
 		return false;
-    }
+	}
 
-	source[src].gdalmdarray = hVar;
+	// values are read with their own data type and converted to double after reading
+	GDALDataType gdt = GDT_Float64;
+	GDALExtendedDataTypeH hDT = GDALMDArrayGetDataType(hVar);
+	if (GDALExtendedDataTypeGetClass(hDT) == GEDTC_NUMERIC) {
+		gdt = GDALExtendedDataTypeGetNumericDataType(hDT);
+	}
+	GDALExtendedDataTypeRelease(hDT);
+	switch (gdt) {
+		case GDT_Byte: case GDT_UInt16: case GDT_Int16: case GDT_UInt32: case GDT_Int32: case GDT_Float32:
+			break;
+		default:
+			gdt = GDT_Float64;
+	}
+
+	// the cache holds whole chunks as stored in the file. For arrays that are
+	// not chunked, a chunk is a number of rows of a single layer
+	SpatRasterSource &s = source[src];
+	size_t nrows = s.m_counts[s.m_dims[0]];
+	size_t ncols = s.m_counts[s.m_dims[1]];
+	size_t nbs;
+	GUInt64* bs = GDALMDArrayGetBlockSize(hVar, &nbs);
+	std::vector<size_t> chunk = {0, 0, 1};
+	for (size_t i=0; i<s.m_dims.size() && i<3; i++) {
+		if ((bs != NULL) && (s.m_dims[i] < nbs)) {
+			chunk[i] = bs[s.m_dims[i]];
+		}
+	}
+	CPLFree(bs);
+	if (chunk[1] == 0) chunk[1] = ncols;
+	if (chunk[0] == 0) chunk[0] = std::max((size_t)1, std::min(nrows, (size_t)1048576 / chunk[1]));
+	if (chunk[2] == 0) chunk[2] = 1;
+
+	s.m_cache.clear();
+	s.m_cache.chunk = chunk;
+	s.m_cache.nchunks = {(nrows + chunk[0] - 1) / chunk[0], (ncols + chunk[1] - 1) / chunk[1]};
+	// a quarter of the GDAL block cache
+	s.m_cache.maxsize = GDALGetCacheMax64() / (4 * sizeof(double));
+	s.m_datatype = gdt;
+	s.gdalmdarray = hVar;
+	s.open_read = true;
 	return true;
 }
 
 
 bool SpatRaster::readStopMulti(unsigned src) {
 	GDALMDArrayRelease(source[src].gdalmdarray);
+	source[src].m_cache.clear();
 	source[src].open_read = false;
 	return true;
 }
 
 
-bool SpatRaster::readValuesMulti(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols) {
+template <typename T>
+bool read_md_native(GDALMDArrayH hVar, GDALDataType gdt, std::vector<GUInt64> &start, std::vector<size_t> &count, std::vector<GPtrDiff_t> &stride, std::vector<double> &out) {
+	std::vector<T> v(out.size());
+	GDALExtendedDataTypeH hDT = GDALExtendedDataTypeCreate(gdt);
+	int ok = GDALMDArrayRead(hVar, &start[0], &count[0], NULL, &stride[0], hDT, &v[0], NULL, 0);
+	GDALExtendedDataTypeRelease(hDT);
+	if (ok) {
+		std::copy(v.begin(), v.end(), out.begin());
+	}
+	return ok;
+}
 
 
-	std::vector<GUInt64> offset(source[src].m_ndims, 0);
-	std::vector<size_t> dims = source[src].m_dims;
+// get a chunk (row, column, layer) from the cache or read it from file.
+// The values are ordered by layer, row and column
+std::vector<double>* get_md_chunk(SpatRasterSource &s, size_t cr, size_t cc, size_t cl) {
 
-	offset[source[src].m_dims[0]] = row;
-	offset[source[src].m_dims[1]] = col;
-	offset[source[src].m_dims[2]] = 0;
+	uint64_t key = s.m_cache.key(cr, cc, cl);
+	std::vector<double>* v = s.m_cache.get(key);
+	if (v != NULL) {
+		return v;
+	}
 
-//	std::vector<size_t> count = source[src].m_counts;
-	std::vector<size_t> count(source[src].m_ndims, 1);
-	count[source[src].m_dims[0]] = nrows;
-	count[source[src].m_dims[1]] = ncols;
-	count[source[src].m_dims[2]] = nlyr();
+	const std::vector<size_t> &chunk = s.m_cache.chunk;
+	bool lyrdim = s.m_ndims > 2;
+	size_t r0 = cr * chunk[0];
+	size_t c0 = cc * chunk[1];
+	size_t l0 = cl * chunk[2];
+	size_t rn = std::min(chunk[0], s.m_counts[s.m_dims[0]] - r0);
+	size_t cn = std::min(chunk[1], s.m_counts[s.m_dims[1]] - c0);
+	size_t ln = lyrdim ? std::min(chunk[2], s.m_counts[s.m_dims[2]] - l0) : 1;
+
+	std::vector<GUInt64> start(s.m_ndims, 0);
+	std::vector<size_t> count(s.m_ndims, 1);
+	std::vector<GPtrDiff_t> stride(s.m_ndims, 0);
+	start[s.m_dims[0]] = r0;
+	start[s.m_dims[1]] = c0;
+	count[s.m_dims[0]] = rn;
+	count[s.m_dims[1]] = cn;
+	stride[s.m_dims[0]] = cn;
+	stride[s.m_dims[1]] = 1;
+	if (lyrdim) {
+		start[s.m_dims[2]] = l0;
+		count[s.m_dims[2]] = ln;
+		stride[s.m_dims[2]] = rn * cn;
+	}
+
+	std::vector<double> d(rn * cn * ln);
+	bool ok;
+	switch (s.m_datatype) {
+		case GDT_Byte: ok = read_md_native<uint8_t>(s.gdalmdarray, GDT_Byte, start, count, stride, d); break;
+		case GDT_UInt16: ok = read_md_native<uint16_t>(s.gdalmdarray, GDT_UInt16, start, count, stride, d); break;
+		case GDT_Int16: ok = read_md_native<int16_t>(s.gdalmdarray, GDT_Int16, start, count, stride, d); break;
+		case GDT_UInt32: ok = read_md_native<uint32_t>(s.gdalmdarray, GDT_UInt32, start, count, stride, d); break;
+		case GDT_Int32: ok = read_md_native<int32_t>(s.gdalmdarray, GDT_Int32, start, count, stride, d); break;
+		case GDT_Float32: ok = read_md_native<float>(s.gdalmdarray, GDT_Float32, start, count, stride, d); break;
+		default: {
+			GDALExtendedDataTypeH hDT = GDALExtendedDataTypeCreate(GDT_Float64);
+			ok = GDALMDArrayRead(s.gdalmdarray, &start[0], &count[0], NULL, &stride[0], hDT, &d[0], NULL, 0);
+			GDALExtendedDataTypeRelease(hDT);
+		}
+	}
+	if (!ok) {
+		return NULL;
+	}
 
-	size_t n=1;
-	for (size_t i=0; i<count.size(); i++) {
-		n *= count[i];
+	if (s.m_hasNA) {
+		double na = s.m_missing_value;
+		for (double &x : d) {
+			x = x == na ? NAN : x;
+		}
+	}
+	if ((s.has_scale_offset.size() > 0) && s.has_scale_offset[0]) {
+		double scale = s.scale[0];
+		double offset = s.offset[0];
+		for (double &x : d) {
+			x = x * scale + offset;
+		}
 	}
+	if (s.hasNAflag) {
+		double na = s.NAflag;
+		for (double &x : d) {
+			x = x == na ? NAN : x;
+		}
+	}
+	return s.m_cache.put(key, d);
+}
 
-	//count = {3600, 1, 1, 7200, 1};
 
-	GDALExtendedDataTypeH hDT = GDALExtendedDataTypeCreate(GDT_Float64);
+bool SpatRaster::readValuesMulti(double *out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols, size_t cellstride, size_t bandstride) {
 
-	std::vector<double> temp;
-	temp.resize(n);
-	GDALMDArrayRead(source[src].gdalmdarray,
-						&offset[0],
-						&count[0],
-						NULL, // step: defaults to 1,1,1
-						NULL, // stride: default to row-major convention
-						hDT,
-						&temp[0],
-						NULL, // array start. Omitted 
-						0 // array size in bytes. Omitted 
-						);
-    GDALExtendedDataTypeRelease(hDT); 
-
-	size_t nc = ncell();
-	size_t nl = nlyr();
-	out.resize(0);
-	out.reserve(n);
-	for (size_t i=0; i<nl; i++) {
-		for (size_t j=0; j<nc; j++) {
-			out.push_back( temp[nl*j + i] );
+	SpatRasterSource &s = source[src];
+	if (!s.open_read) {
+		setError("the file is not open for reading");
+		return false;
+	}
+	if (s.hasWindow) {
+		row += s.window.off_row;
+		col += s.window.off_col;
+	}
+	const std::vector<size_t> chunk = s.m_cache.chunk;
+	size_t fnr = s.m_counts[s.m_dims[0]];
+	size_t endcol = col + ncols;
+
+	// only the chunks that intersect with the requested window are read
+	for (size_t i=0; i<s.layers.size(); i++) {
+		size_t cl = s.layers[i] / chunk[2];
+		size_t lo = s.layers[i] - cl * chunk[2];
+		double *d = out + i * bandstride;
+		for (size_t r=0; r<nrows; r++) {
+			size_t fr = s.flipped ? fnr - 1 - (row + r) : row + r;
+			size_t cr = fr / chunk[0];
+			size_t ro = fr - cr * chunk[0];
+			size_t rn = std::min(chunk[0], fnr - cr * chunk[0]);
+			double *dr = d + r * ncols * cellstride;
+			for (size_t c=col; c<endcol; ) {
+				size_t cc = c / chunk[1];
+				size_t c0 = cc * chunk[1];
+				std::vector<double>* v = get_md_chunk(s, cr, cc, cl);
+				if (v == NULL) {
+					setError("cannot read values");
+					return false;
+				}
+				size_t cn = std::min(chunk[1], s.m_counts[s.m_dims[1]] - c0);
+				size_t cend = std::min(endcol, c0 + cn);
+				const double *x = &(*v)[(lo * rn + ro) * cn + (c - c0)];
+				for (; c<cend; c++) {
+					dr[(c - col) * cellstride] = *x++;
+				}
+			}
 		}
 	}
+	return true;
+}
 
-	if (source[src].m_hasNA) {
-		std::replace (out.begin(), out.end(), source[src].m_missing_value, (double)NAN);
+
+std::vector<std::vector<double>> SpatRaster::readRowColMulti(size_t src, const std::vector<int_64> &rows, const std::vector<int_64> &cols) {
+
+	SpatRasterSource &s = source[src];
+	size_t nl = s.layers.size();
+	size_t n = rows.size();
+	std::vector<std::vector<double>> out(nl, std::vector<double>(n, NAN));
+
+	bool opened = false;
+	if (!s.open_read) {
+		if (!readStartMulti(src)) return out;
+		opened = true;
 	}
-	return true;
+
+	const std::vector<size_t> chunk = s.m_cache.chunk;
+	size_t fnr = s.m_counts[s.m_dims[0]];
+	size_t fnc = s.m_counts[s.m_dims[1]];
+
+	// visit the cells chunk by chunk, such that each chunk is read only once
+	std::vector<size_t> cr(n), cc(n), idx;
+	idx.reserve(n);
+	for (size_t j=0; j<n; j++) {
+		if ((rows[j] < 0) || (cols[j] < 0) || (rows[j] >= (int_64)fnr) || (cols[j] >= (int_64)fnc)) continue;
+		size_t fr = s.flipped ? fnr - 1 - rows[j] : rows[j];
+		cr[j] = fr / chunk[0];
+		cc[j] = cols[j] / chunk[1];
+		idx.push_back(j);
+	}
+	std::stable_sort(idx.begin(), idx.end(), [&cr, &cc](size_t a, size_t b) {
+		return (cr[a] < cr[b]) || ((cr[a] == cr[b]) && (cc[a] < cc[b]));
+	});
+
+	for (size_t j : idx) {
+		size_t fr = s.flipped ? fnr - 1 - rows[j] : rows[j];
+		size_t ro = fr - cr[j] * chunk[0];
+		size_t co = cols[j] - cc[j] * chunk[1];
+		size_t rn = std::min(chunk[0], fnr - cr[j] * chunk[0]);
+		size_t cn = std::min(chunk[1], fnc - cc[j] * chunk[1]);
+		for (size_t i=0; i<nl; i++) {
+			size_t cl = s.layers[i] / chunk[2];
+			size_t lo = s.layers[i] - cl * chunk[2];
+			std::vector<double>* v = get_md_chunk(s, cr[j], cc[j], cl);
+			if (v == NULL) {
+				setError("cannot read values");
+				if (opened) readStopMulti(src);
+				return out;
+			}
+			out[i][j] = (*v)[(lo * rn + ro) * cn + co];
+		}
+	}
+	if (opened) readStopMulti(src);
+	return out;
 }
 
-  
-#else  
 
-*/
+#else
+
+
 bool SpatRaster::constructFromFileMulti(std::string fname, std::string sub, std::vector<size_t> xyz) {
 	setError("multidim is not supported by GDAL < 3.1");
 	return false;
@@ -292,12 +514,14 @@ bool SpatRaster::readStopMulti(unsigned src) {
 }
 
 
-bool SpatRaster::readValuesMulti(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols) {
+bool SpatRaster::readValuesMulti(double *out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols, size_t cellstride, size_t bandstride) {
 	setError("multidim is not supported by GDAL < 3.1");
 	return false;
 }
 
-/*
-#endif
+std::vector<std::vector<double>> SpatRaster::readRowColMulti(size_t src, const std::vector<int_64> &rows, const std::vector<int_64> &cols) {
+	setError("multidim is not supported by GDAL < 3.1");
+	return std::vector<std::vector<double>>();
+}
 
-*/
\ No newline at end of file
+#endif
@@ -0,0 +1,218 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include <mutex>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include "gdal_priv.h"
+#include "cpl_vsi.h"
+#include "gdal_pool.h"
+#include "gdalio.h"
+
+
+struct GDALPoolEntry {
+	GDALDataset *ds;
+	std::string key;
+	std::string filename;
+	bool busy;
+	// the file was changed while the dataset was in use
+	bool stale;
+	uint64_t used;
+	long long mtime;
+	long long size;
+};
+
+
+class GDALPool {
+	public:
+		std::mutex mtx;
+		std::vector<GDALPoolEntry> entries;
+		size_t maxsize = 32;
+		uint64_t clock = 0;
+		double hits = 0;
+		double misses = 0;
+		double evictions = 0;
+
+		// close idle datasets until there are no more than maxsize
+		void evict() {
+			while (entries.size() > maxsize) {
+				size_t j = entries.size();
+				for (size_t i=0; i<entries.size(); i++) {
+					if (entries[i].busy) continue;
+					if ((j == entries.size()) || (entries[i].used < entries[j].used)) j = i;
+				}
+				if (j == entries.size()) return;
+				GDALClose((GDALDatasetH) entries[j].ds);
+				entries.erase(entries.begin() + j);
+				evictions++;
+			}
+		}
+};
+
+static GDALPool& pool() {
+	static GDALPool p;
+	return p;
+}
+
+
+// modification time (in nanoseconds where the system has it) and size of
+// a local file, to detect changes. Not for virtual file systems, where
+// that may require a request to a server
+static void file_stamp(const std::string &filename, long long &mtime, long long &size) {
+	mtime = -1;
+	size = -1;
+	if (filename.compare(0, 4, "/vsi") == 0) return;
+	VSIStatBufL st;
+	if (VSIStatL(filename.c_str(), &st) == 0) {
+		mtime = (long long)st.st_mtime * 1000000000LL;
+#if defined(__APPLE__)
+		mtime += st.st_mtimespec.tv_nsec;
+#elif defined(__linux__) || defined(__FreeBSD__) || defined(__sun)
+		mtime += st.st_mtim.tv_nsec;
+#endif
+		size = st.st_size;
+	}
+}
+
+
+// the absolute path of a local file, such that different names for the
+// same file (relative, with "." or "..", or a symbolic link) have the
+// same pool entry
+static std::string pool_path(const std::string &filename) {
+	if (filename.compare(0, 4, "/vsi") == 0) return filename;
+#ifdef _WIN32
+	char buf[_MAX_PATH];
+	if (_fullpath(buf, filename.c_str(), _MAX_PATH) != NULL) {
+		std::string f = buf;
+		std::replace(f.begin(), f.end(), '\\', '/');
+		return f;
+	}
+#else
+	char *rp = realpath(filename.c_str(), NULL);
+	if (rp != NULL) {
+		std::string f = rp;
+		free(rp);
+		return f;
+	}
+#endif
+	return filename;
+}
+
+
+GDALDataset* openGDALpooled(const std::string &filename, const std::vector<std::string> &open_options) {
+	std::string path = pool_path(filename);
+	std::string key = path;
+	for (size_t i=0; i<open_options.size(); i++) {
+		key += "\n" + open_options[i];
+	}
+	long long mtime, size;
+	file_stamp(filename, mtime, size);
+
+	GDALPool &p = pool();
+	{
+		std::lock_guard<std::mutex> lock(p.mtx);
+		for (size_t i=0; i<p.entries.size(); i++) {
+			GDALPoolEntry &e = p.entries[i];
+			if (e.busy || (e.key != key)) continue;
+			if ((e.mtime != mtime) || (e.size != size)) {
+				GDALClose((GDALDatasetH) e.ds);
+				p.entries.erase(p.entries.begin() + i);
+				break;
+			}
+			e.busy = true;
+			p.hits++;
+			return e.ds;
+		}
+		p.misses++;
+	}
+
+	GDALDataset *poDS = openGDAL(filename, GDAL_OF_RASTER | GDAL_OF_READONLY, open_options);
+	if (poDS == NULL) return NULL;
+
+	std::lock_guard<std::mutex> lock(p.mtx);
+	GDALPoolEntry e;
+	e.ds = poDS;
+	e.key = key;
+	e.filename = path;
+	e.busy = true;
+	e.stale = false;
+	e.used = ++p.clock;
+	e.mtime = mtime;
+	e.size = size;
+	p.entries.push_back(e);
+	p.evict();
+	return poDS;
+}
+
+
+void closeGDALpooled(GDALDataset *poDS) {
+	if (poDS == NULL) return;
+	GDALPool &p = pool();
+	std::lock_guard<std::mutex> lock(p.mtx);
+	for (size_t i=0; i<p.entries.size(); i++) {
+		GDALPoolEntry &e = p.entries[i];
+		if (e.ds != poDS) continue;
+		if (e.stale) {
+			GDALClose((GDALDatasetH) poDS);
+			p.entries.erase(p.entries.begin() + i);
+		} else {
+			e.busy = false;
+			e.used = ++p.clock;
+			p.evict();
+		}
+		return;
+	}
+	// not from the pool
+	GDALClose((GDALDatasetH) poDS);
+}
+
+
+void gdal_pool_forget(const std::string &filename) {
+	std::string path = pool_path(filename);
+	GDALPool &p = pool();
+	std::lock_guard<std::mutex> lock(p.mtx);
+	for (size_t i=p.entries.size(); i>0; i--) {
+		GDALPoolEntry &e = p.entries[i-1];
+		if ((e.filename != path) && (e.filename != filename)) continue;
+		if (e.busy) {
+			e.stale = true;
+		} else {
+			GDALClose((GDALDatasetH) e.ds);
+			p.entries.erase(p.entries.begin() + (i-1));
+		}
+	}
+}
+
+
+void gdal_pool_size(size_t n) {
+	GDALPool &p = pool();
+	std::lock_guard<std::mutex> lock(p.mtx);
+	p.maxsize = n;
+	p.evict();
+}
+
+
+std::vector<double> gdal_pool_stats() {
+	GDALPool &p = pool();
+	std::lock_guard<std::mutex> lock(p.mtx);
+	double idle = 0;
+	for (size_t i=0; i<p.entries.size(); i++) {
+		idle += !p.entries[i].busy;
+	}
+	return {(double)p.maxsize, (double)p.entries.size(), idle, p.hits, p.misses, p.evictions};
+}
@@ -0,0 +1,40 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GDALPOOL_GUARD
+#define GDALPOOL_GUARD
+
+#include <string>
+#include <vector>
+
+class GDALDataset;
+
+// A process-wide pool of datasets that are open for reading. A dataset is
+// used by one caller at a time; when it is returned it stays open (with
+// its block cache) for the next caller that opens the same file with the
+// same options. Idle datasets are closed, least recently used first,
+// when there are more than "gdal_pool_size" open datasets.
+GDALDataset* openGDALpooled(const std::string &filename, const std::vector<std::string> &open_options);
+void closeGDALpooled(GDALDataset *poDS);
+// close the idle datasets of a file that is about to be changed or removed,
+// or that was written
+void gdal_pool_forget(const std::string &filename);
+void gdal_pool_size(size_t n);
+// size, open, idle, hits, misses, evictions
+std::vector<double> gdal_pool_stats();
+
+#endif
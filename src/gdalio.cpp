@@ -503,6 +503,21 @@ bool SpatRaster::as_gdalvrt(GDALDatasetH &hVRT, SpatOptions &opt) {
 
 
 
+// add a band to a MEM dataset that uses the values at "d" without copying them
+static bool addMEMband(GDALDatasetH hDS, const double *d, size_t nc) {
+	char szPtrValue[128] = { '\0' };
+	int nRet = CPLPrintPointer(szPtrValue, reinterpret_cast<void*>(const_cast<double*>(d)), sizeof(szPtrValue));
+	szPtrValue[nRet] = 0;
+	char **papszOptions = NULL;
+	papszOptions = CSLSetNameValue(papszOptions, "DATAPOINTER", szPtrValue);
+	papszOptions = CSLSetNameValue(papszOptions, "PIXELOFFSET", std::to_string(sizeof(double)).c_str());
+	papszOptions = CSLSetNameValue(papszOptions, "LINEOFFSET", std::to_string(sizeof(double) * nc).c_str());
+	CPLErr err = GDALAddBand(hDS, GDT_Float64, papszOptions);
+	CSLDestroy(papszOptions);
+	return err == CE_None;
+}
+
+
 bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, bool update, SpatOptions &opt) {
 
 	size_t isrc = src < 0 ? 0 : src;
@@ -563,26 +578,33 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, bool update, SpatOptions
 		size_t ncls = nrow() * ncol();
 		GDALDriverH hDrv = GDALGetDriverByName("MEM");
 
-/*https://gis.stackexchange.com/questions/196048/how-to-reuse-memory-pointer-of-gdal-memory-driver
-		char **papszOptions = NULL;
-		hDS = GDALCreate(hDrv, "", ncol(), nrow(), 0, GDT_Float64, papszOptions);
-		if (hDS == NULL) return false;
-		std::vector<double> vals;
-		for(size_t i=0; i<nl; i++)	{
-			size_t off = ncls * i;
-			vals = std::vector<double>(source[0].values.begin() +off, source[0].values.begin() +off+ncls);
-			char szPtrValue[128] = { '\0' };
-			int nRet = CPLPrintPointer( szPtrValue, reinterpret_cast<void*>(&vals[0]), sizeof(szPtrValue) );
-			szPtrValue[nRet] = 0;
-			papszOptions = CSLSetNameValue(papszOptions, "DATAPOINTER", szPtrValue);
-			GDALAddBand(hDS, GDT_Float64, papszOptions);
-		}
-		CSLDestroy(papszOptions);
-*/
-
 		size_t nr = nrow();
 		size_t nc = ncol();
-		hDS = GDALCreate(hDrv, "", nc, nr, nl, GDT_Float64, NULL);
+
+		// the values of in-memory sources can be used by the MEM dataset without
+		// copying them. That is not possible if some layers are read from file,
+		// or with a window. The dataset must be closed before the values change.
+		std::vector<size_t> srcs;
+		if (src < 0) {
+			for (size_t i=0; i<nsrc(); i++) srcs.push_back(i);
+		} else {
+			srcs.push_back(src);
+		}
+		bool wrap = hasval;
+		for (size_t i : srcs) {
+			if ((!source[i].memory) || source[i].hasWindow || (!source[i].hasValues)) {
+				wrap = false;
+				break;
+			}
+			for (size_t j : source[i].layers) {
+				if (source[i].values.size() < ((j+1) * ncls)) {
+					wrap = false;
+					break;
+				}
+			}
+		}
+
+		hDS = GDALCreate(hDrv, "", nc, nr, wrap ? 0 : nl, GDT_Float64, NULL);
 		if (hDS == NULL) return false;
 
 		std::vector<double> rs = resolution();
@@ -595,6 +617,20 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, bool update, SpatOptions
 			return false;
 		}
 
+		if (wrap) {
+			for (size_t i : srcs) {
+				// GDAL may write to the values when updating
+				const double *d = update ? source[i].values.unique() : source[i].values.data();
+				for (size_t j : source[i].layers) {
+					if (!addMEMband(hDS, d + j * ncls, nc)) {
+						GDALClose(hDS);
+						setError("cannot create dataset");
+						return false;
+					}
+				}
+			}
+		}
+
 		CPLErr err = CE_None;
 
 		if (hasval) {
@@ -606,12 +642,14 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, bool update, SpatOptions
 			}
 
 			std::vector<double> vv, vals;
-			if (src < 0) {
-				vv = getValues(-1, opt);
-			} else {
-				if (!getValuesSource(src, vv)) {
-					setError("cannot read from source");
-					return false;
+			if (!wrap) {
+				if (src < 0) {
+					vv = getValues(-1, opt);
+				} else {
+					if (!getValuesSource(src, vv)) {
+						setError("cannot read from source");
+						return false;
+					}
 				}
 			}
 
@@ -619,6 +657,7 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, bool update, SpatOptions
 				GDALRasterBandH hBand = GDALGetRasterBand(hDS, i+1);
 				GDALSetRasterNoDataValue(hBand, NAN);
 				GDALSetDescription(hBand, nms[i].c_str());
+				if (wrap) continue;
 
 				size_t offset = ncls * i;
 				vals = std::vector<double>(vv.begin() + offset, vv.begin() + offset+ncls);
@@ -696,8 +735,9 @@ bool SpatRaster::from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_valu
 	}
 
 	if (get_values) {
-		source[0].values.resize(0);
-		source[0].values.reserve(ncell() * nlyr());
+		// hDS may use the current values (see open_gdal); replace them at the end
+		std::vector<double> v;
+		v.reserve(ncell() * nlyr());
 		CPLErr err = CE_None;
 		int hasNA;
 		size_t nl = nlyr();
@@ -747,9 +787,10 @@ bool SpatRaster::from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_valu
 			if (has_so) {
 				for (double &d : lyrout) { d = d * mscale + moffset;}
 			}
-			source[0].values.insert(source[0].values.end(), lyrout.begin(), lyrout.end());
+			v.insert(v.end(), lyrout.begin(), lyrout.end());
 		}
 
+		source[0].values = std::move(v);
 		source[0].hasValues = true;
 		source[0].memory = true;
 		source[0].driver = "memory";
@@ -968,7 +1009,7 @@ bool SpatRaster::setValuesMEM(GDALDatasetH hDS, bool set_geometry) {
 		//double naflag = -3.4e+38;
 		double naflag = GDALGetRasterNoDataValue(hBand, &hasNA);
 		if (hasNA) std::replace(lyrout.begin(), lyrout.end(), naflag, (double) NAN);
-		source[0].values.insert(source[0].values.end(), lyrout.begin(), lyrout.end());
+		source[0].values.append(lyrout.data(), lyrout.data() + lyrout.size());
 
 	}
 	source[0].hasValues = TRUE;
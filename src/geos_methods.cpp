@@ -1,6 +1,7 @@
 #include <numeric>
 #include "geos_spat.h"
 #include "distance.h"
+#include "nearest.h"
 #include "recycle.h"
 #include "string_utils.h"
 
@@ -1999,6 +2000,227 @@ SpatVector SpatVector::nearest_point() {
 	return out;
 }
 
+static void strtree_cb(void *item, void *userdata) {
+	std::vector<size_t> *ids = (std::vector<size_t> *) userdata;
+	ids->push_back(*((size_t *) item));
+}
+
+static GEOSGeometry* geos_rect(const SpatExtent &e, double d, GEOSContextHandle_t hGEOSCtxt) {
+	std::vector<double> x = {e.xmin-d, e.xmax+d, e.xmax+d, e.xmin-d, e.xmin-d};
+	std::vector<double> y = {e.ymin-d, e.ymin-d, e.ymax+d, e.ymax+d, e.ymin-d};
+	std::vector<std::vector<double>> hx, hy;
+	return geos_polygon(x, y, hx, hy, hGEOSCtxt);
+}
+
+// the extent "e" of lon/lat geometries expanded such that it includes
+// everything within distance "d" (m). A degree of latitude is at least
+// 110574 m, and a degree of longitude at least that times the cosine of
+// the latitude. Wrapping around the dateline is not considered
+static SpatExtent lonlat_expand(const SpatExtent &e, double d) {
+	SpatExtent out = e;
+	double dy = d / 110000;
+	out.ymin = e.ymin - dy;
+	out.ymax = e.ymax + dy;
+	double lat = std::max(std::fabs(e.ymin), std::fabs(e.ymax)) + dy;
+	if (lat >= 89) {
+		out.xmin = std::min(e.xmin, -180.0);
+		out.xmax = std::max(e.xmax, 180.0);
+	} else {
+		double dx = dy / std::cos(lat * M_PI / 180);
+		out.xmin = e.xmin - dx;
+		out.xmax = e.xmax + dx;
+	}
+	return out;
+}
+
+// the distance between two geometries. For lon/lat it is the geodesic
+// distance (m) between their nearest points (found in lon/lat coordinates)
+static bool geos_dist(GEOSContextHandle_t hGEOSCtxt, const GEOSGeometry *a, const GEOSGeometry *b, bool lonlat, double &d) {
+	if (!lonlat) {
+		return GEOSDistance_r(hGEOSCtxt, a, b, &d);
+	}
+	GEOSCoordSequence *cs = GEOSNearestPoints_r(hGEOSCtxt, a, b);
+	if (cs == NULL) return false;
+	double x1, y1, x2, y2;
+	bool ok = GEOSCoordSeq_getX_r(hGEOSCtxt, cs, 0, &x1) && GEOSCoordSeq_getY_r(hGEOSCtxt, cs, 0, &y1) && GEOSCoordSeq_getX_r(hGEOSCtxt, cs, 1, &x2) && GEOSCoordSeq_getY_r(hGEOSCtxt, cs, 1, &y2);
+	GEOSCoordSeq_destroy_r(hGEOSCtxt, cs);
+	if (ok) d = distance_lonlat(x1, y1, x2, y2);
+	return ok;
+}
+
+// the search box around geometry "e" for distance "d" (in m for lon/lat,
+// and otherwise in map units)
+static GEOSGeometry* search_rect(const SpatExtent &e, double d, bool lonlat, GEOSContextHandle_t hGEOSCtxt) {
+	if (lonlat) {
+		return geos_rect(lonlat_expand(e, d), 0, hGEOSCtxt);
+	}
+	return geos_rect(e, d, hGEOSCtxt);
+}
+
+static bool single_points(SpatVector &v) {
+	if (v.type() != "points") return false;
+	for (size_t i=0; i<v.size(); i++) {
+		if (v.geoms[i].size() != 1) return false;
+	}
+	return true;
+}
+
+
+// Neighbours found with a spatial index. Points use a kd-tree (see nearest.h);
+// lines and polygons a GEOS STRtree that is searched with the bounding box
+// of each geometry, expanded by the distance of interest. The result has the
+// (0-based) index in this SpatVector and in "y", and the distance.
+// With "self", y is ignored and the neighbours are found within this SpatVector.
+// The point queries are threaded. The GEOS queries are not, as the STRtree
+// is built by the first query, and the GEOS message handlers call R.
+// For lon/lat lines and polygons, the distances of the candidates in the
+// search box are geodesic (see geos_dist). Empty geometries have no neighbours
+std::vector<std::vector<double>> SpatVector::within_distance(SpatVector y, double d, bool self) {
+
+	std::vector<std::vector<double>> out(3);
+	if (self) y = *this;
+	if (srs.is_empty() || y.srs.is_empty()) {
+		setError("crs not defined");
+		return(out);
+	}
+	if (!srs.is_same(y.srs, false)) {
+		setError("SRS do not match");
+		return(out);
+	}
+	bool lonlat = is_lonlat();
+	double m = srs.to_meter();
+	m = std::isnan(m) ? 1 : m;
+	if (single_points(*this) && single_points(y)) {
+		std::vector<std::vector<double>> p = coordinates();
+		std::vector<std::vector<double>> py = self ? p : y.coordinates();
+		return within_points(p[0], p[1], py[0], py[1], d, self, lonlat, m);
+	}
+	if ((size() == 0) || (y.size() == 0)) return out;
+	if (lonlat) {
+		m = 1;
+	} else {
+		d /= m;
+	}
+
+	GEOSContextHandle_t hGEOSCtxt = geos_init();
+	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
+	std::vector<GeomPtr> gy = geos_geoms(&y, hGEOSCtxt);
+	std::vector<size_t> items(gy.size());
+	std::iota(items.begin(), items.end(), 0);
+	GEOSSTRtree *tree = GEOSSTRtree_create_r(hGEOSCtxt, 10);
+	for (size_t j=0; j<gy.size(); j++) {
+		GEOSSTRtree_insert_r(hGEOSCtxt, tree, gy[j].get(), &items[j]);
+	}
+	std::vector<size_t> ids;
+	for (size_t i=0; i<x.size(); i++) {
+		if (GEOSisEmpty_r(hGEOSCtxt, x[i].get())) continue;
+		GeomPtr r = geos_ptr(search_rect(geoms[i].extent, d, lonlat, hGEOSCtxt), hGEOSCtxt);
+		ids.resize(0);
+		GEOSSTRtree_query_r(hGEOSCtxt, tree, r.get(), strtree_cb, &ids);
+		std::sort(ids.begin(), ids.end());
+		for (size_t j : ids) {
+			if (self && (j == i)) continue;
+			double dist;
+			if (geos_dist(hGEOSCtxt, x[i].get(), gy[j].get(), lonlat, dist) && (dist <= d)) {
+				out[0].push_back(i);
+				out[1].push_back(j);
+				out[2].push_back(dist * m);
+			}
+		}
+	}
+	GEOSSTRtree_destroy_r(hGEOSCtxt, tree);
+	geos_finish(hGEOSCtxt);
+	return out;
+}
+
+
+std::vector<std::vector<double>> SpatVector::knearest(SpatVector y, size_t k, bool self) {
+
+	std::vector<std::vector<double>> out(3);
+	if (self) y = *this;
+	if (srs.is_empty() || y.srs.is_empty()) {
+		setError("crs not defined");
+		return(out);
+	}
+	if (!srs.is_same(y.srs, false)) {
+		setError("SRS do not match");
+		return(out);
+	}
+	bool lonlat = is_lonlat();
+	double m = srs.to_meter();
+	m = std::isnan(m) ? 1 : m;
+	if (single_points(*this) && single_points(y)) {
+		std::vector<std::vector<double>> p = coordinates();
+		std::vector<std::vector<double>> py = self ? p : y.coordinates();
+		return knn_points(p[0], p[1], py[0], py[1], k, self, lonlat, m);
+	}
+	size_t ny = y.size();
+	if ((size() == 0) || (ny == 0)) return out;
+	k = std::min(k, self ? ny - 1 : ny);
+	if (k == 0) return out;
+	if (lonlat) m = 1;
+
+	GEOSContextHandle_t hGEOSCtxt = geos_init();
+	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
+	std::vector<GeomPtr> gy = geos_geoms(&y, hGEOSCtxt);
+	std::vector<size_t> items(ny);
+	std::iota(items.begin(), items.end(), 0);
+	GEOSSTRtree *tree = GEOSSTRtree_create_r(hGEOSCtxt, 10);
+	for (size_t j=0; j<ny; j++) {
+		GEOSSTRtree_insert_r(hGEOSCtxt, tree, gy[j].get(), &items[j]);
+	}
+	// start with a distance at which there is about one geometry per search
+	// box. The search stops when the box covers all geometries, as empty
+	// geometries are not in the tree and may never be found
+	SpatExtent e = y.getExtent();
+	SpatExtent ex = getExtent();
+	double r0 = std::sqrt((e.xmax - e.xmin) * (e.ymax - e.ymin) / ny) + 1e-9;
+	double rmax = std::hypot(std::max(e.xmax, ex.xmax) - std::min(e.xmin, ex.xmin), std::max(e.ymax, ex.ymax) - std::min(e.ymin, ex.ymin));
+	if (lonlat) {
+		r0 *= 110000;
+		// half the circumference of the earth
+		rmax = 20037509;
+	}
+	if (!std::isfinite(r0)) r0 = 1;
+	if (!std::isfinite(rmax)) rmax = 0;
+	std::vector<size_t> ids;
+	std::vector<std::pair<double, size_t>> cand;
+	for (size_t i=0; i<x.size(); i++) {
+		if (GEOSisEmpty_r(hGEOSCtxt, x[i].get())) continue;
+		double r = r0;
+		while (true) {
+			GeomPtr rect = geos_ptr(search_rect(geoms[i].extent, r, lonlat, hGEOSCtxt), hGEOSCtxt);
+			ids.resize(0);
+			GEOSSTRtree_query_r(hGEOSCtxt, tree, rect.get(), strtree_cb, &ids);
+			cand.resize(0);
+			size_t nin = 0;
+			for (size_t j : ids) {
+				if (self && (j == i)) continue;
+				double dist;
+				if (geos_dist(hGEOSCtxt, x[i].get(), gy[j].get(), lonlat, dist)) {
+					cand.push_back(std::make_pair(dist, j));
+					nin += dist <= r;
+				}
+			}
+			// all geometries within distance r are in the box, so the k
+			// nearest are known once there are k of them
+			if ((nin >= k) || (ids.size() >= ny) || (r > rmax)) break;
+			r *= 2;
+		}
+		size_t kk = std::min(k, cand.size());
+		std::partial_sort(cand.begin(), cand.begin() + kk, cand.end());
+		for (size_t j=0; j<kk; j++) {
+			out[0].push_back(i);
+			out[1].push_back(cand[j].second);
+			out[2].push_back(cand[j].first * m);
+		}
+	}
+	GEOSSTRtree_destroy_r(hGEOSCtxt, tree);
+	geos_finish(hGEOSCtxt);
+	return out;
+}
+
+
 SpatVector SpatVector::cross_dateline(bool &fixed) {
 	SpatVector out;
 	fixed = false;
@@ -0,0 +1,464 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include <cmath>
+#include <queue>
+#include <functional>
+#include <unordered_map>
+
+
+// Flow direction rasters are processed by block (a strip of rows). Only
+// the first and last row of a block can exchange water with other blocks.
+// A first pass over the blocks finds, for each of these "boundary" cells,
+// where the water that passes through it leaves the block. These links
+// are then resolved for the whole raster, and a second pass over the blocks
+// computes the output with the inflow from other blocks added.
+
+
+// D8 flow directions as in terrain(v="flowdir")
+// 32 64 128
+// 16  x   1
+//  8  4   2
+static inline bool flow_offset(double d, int &dr, int &dc) {
+	if (std::isnan(d)) return false;
+	switch ((int) d) {
+		case 1: dr= 0; dc= 1; return true;
+		case 2: dr= 1; dc= 1; return true;
+		case 4: dr= 1; dc= 0; return true;
+		case 8: dr= 1; dc=-1; return true;
+		case 16: dr= 0; dc=-1; return true;
+		case 32: dr=-1; dc=-1; return true;
+		case 64: dr=-1; dc= 0; return true;
+		case 128: dr=-1; dc= 1; return true;
+		default: return false;
+	}
+}
+
+
+// the boundary cells (first and last row) of all blocks
+class FlowNodes {
+	public:
+		size_t nc;
+		std::vector<size_t> brow, bnrows, block;
+
+		FlowNodes(const BlockSize &bs, size_t nrow, size_t ncol) {
+			nc = ncol;
+			brow = bs.row;
+			bnrows = bs.nrows;
+			block.resize(nrow);
+			for (size_t i=0; i<bs.n; i++) {
+				for (size_t r=bs.row[i]; r<(bs.row[i]+bs.nrows[i]); r++) block[r] = i;
+			}
+		}
+		size_t size() {
+			return brow.size() * 2 * nc;
+		}
+		// the node for a cell, or -1 if it is not on the boundary of a block
+		int_64 node(size_t row, size_t col) {
+			size_t b = block[row];
+			if (row == brow[b]) return b * 2 * nc + col;
+			if (row == (brow[b] + bnrows[b] - 1)) return b * 2 * nc + nc + col;
+			return -1;
+		}
+};
+
+
+// For each cell of a block, the downstream cell in the block (>= 0), or
+// -1 if there is none, or -2 if it is in another block. In that case,
+// "out" has the node of that cell.
+static void flow_down(const std::vector<double> &dir, size_t row0, size_t nr, size_t nc, size_t nrow, FlowNodes &nodes, std::vector<int_64> &down, std::vector<int_64> &out) {
+	size_t n = nr * nc;
+	down.resize(0);
+	down.resize(n, -1);
+	out.resize(0);
+	out.resize(n, -1);
+	for (size_t i=0; i<n; i++) {
+		int dr, dc;
+		if (!flow_offset(dir[i], dr, dc)) continue;
+		long r = (long) (i / nc) + dr;
+		long c = (long) (i % nc) + dc;
+		if ((c < 0) || (c >= (long)nc)) continue;
+		long gr = (long)row0 + r;
+		if ((gr < 0) || (gr >= (long)nrow)) continue;
+		if ((r < 0) || (r >= (long)nr)) {
+			down[i] = -2;
+			out[i] = nodes.node(gr, c);
+		} else {
+			size_t j = r * nc + c;
+			if (!std::isnan(dir[j])) down[i] = j;
+		}
+	}
+}
+
+
+// cells in topological order (upstream cells first). Cells on a cycle are
+// not included
+static void flow_order(const std::vector<int_64> &down, std::vector<size_t> &order) {
+	size_t n = down.size();
+	std::vector<unsigned char> indeg(n, 0);
+	for (size_t i=0; i<n; i++) {
+		if (down[i] >= 0) indeg[down[i]]++;
+	}
+	order.resize(0);
+	order.reserve(n);
+	for (size_t i=0; i<n; i++) {
+		if (indeg[i] == 0) order.push_back(i);
+	}
+	for (size_t k=0; k<order.size(); k++) {
+		int_64 d = down[order[k]];
+		if (d >= 0) {
+			if (--indeg[d] == 0) order.push_back(d);
+		}
+	}
+}
+
+
+static void flow_accumulate(const std::vector<double> &dir, const std::vector<int_64> &down, const std::vector<size_t> &order, std::vector<double> &acc) {
+	for (size_t k=0; k<order.size(); k++) {
+		size_t i = order[k];
+		if (down[i] >= 0) acc[down[i]] += acc[i];
+	}
+	for (size_t i=0; i<dir.size(); i++) {
+		if (std::isnan(dir[i])) acc[i] = NAN;
+	}
+}
+
+
+SpatRaster SpatRaster::flowAccumulation(SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	out.setNames({"flowacc"});
+	if (nlyr() > 1) {
+		out.setError("flowAccumulation needs a single layer object (flow direction)");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("the input raster has no values");
+		return out;
+	}
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!out.writeStart(opt)) {
+		readStop();
+		return out;
+	}
+	size_t nc = ncol();
+	size_t nr = nrow();
+	FlowNodes nodes(out.bs, nr, nc);
+	size_t nn = nodes.size();
+
+	// for each node: the accumulation within its block, the node where its
+	// water leaves the block, and the node that water flows to
+	std::vector<double> acc(nn, 0);
+	std::vector<int_64> link(nn, -1), target(nn, -1);
+	std::vector<double> dir, a;
+	std::vector<int_64> down, bout, lk;
+	std::vector<size_t> order;
+
+	for (size_t b = 0; b < out.bs.n; b++) {
+		size_t row0 = out.bs.row[b];
+		size_t bnr = out.bs.nrows[b];
+		readValues(dir, row0, bnr, 0, nc);
+		flow_down(dir, row0, bnr, nc, nr, nodes, down, bout);
+		flow_order(down, order);
+		a.resize(0);
+		a.resize(dir.size(), 1);
+		flow_accumulate(dir, down, order, a);
+		// downstream cells first
+		lk.resize(0);
+		lk.resize(dir.size(), -1);
+		for (size_t k=order.size(); k>0; k--) {
+			size_t i = order[k-1];
+			if (down[i] == -2) {
+				lk[i] = i;
+			} else if (down[i] >= 0) {
+				lk[i] = lk[down[i]];
+			}
+		}
+		for (size_t i=0; i<dir.size(); i++) {
+			int_64 n = nodes.node(row0 + i / nc, i % nc);
+			if (n < 0) continue;
+			acc[n] = std::isnan(a[i]) ? 0 : a[i];
+			if (lk[i] >= 0) {
+				link[n] = nodes.node(row0 + lk[i] / nc, lk[i] % nc);
+			}
+			target[n] = bout[i];
+		}
+	}
+
+	// inflow from other blocks for each node, resolved in topological order
+	std::vector<double> inflow(nn, 0), passed(nn, 0);
+	std::vector<size_t> indeg(nn, 0);
+	for (size_t n=0; n<nn; n++) {
+		if (link[n] == (int_64)n) {
+			if (target[n] >= 0) indeg[target[n]]++;
+		} else if (link[n] >= 0) {
+			indeg[link[n]]++;
+		}
+	}
+	std::vector<size_t> todo;
+	for (size_t n=0; n<nn; n++) {
+		if (indeg[n] == 0) todo.push_back(n);
+	}
+	for (size_t k=0; k<todo.size(); k++) {
+		size_t n = todo[k];
+		int_64 next = -1;
+		if (link[n] == (int_64)n) {
+			next = target[n];
+			if (next >= 0) inflow[next] += acc[n] + inflow[n] + passed[n];
+		} else if (link[n] >= 0) {
+			next = link[n];
+			passed[next] += inflow[n];
+		}
+		if (next >= 0) {
+			if (--indeg[next] == 0) todo.push_back(next);
+		}
+	}
+
+	for (size_t b = 0; b < out.bs.n; b++) {
+		size_t row0 = out.bs.row[b];
+		size_t bnr = out.bs.nrows[b];
+		readValues(dir, row0, bnr, 0, nc);
+		flow_down(dir, row0, bnr, nc, nr, nodes, down, bout);
+		flow_order(down, order);
+		a.resize(0);
+		a.resize(dir.size(), 1);
+		for (size_t c=0; c<nc; c++) {
+			a[c] += inflow[nodes.node(row0, c)];
+			if (bnr > 1) {
+				size_t i = (bnr - 1) * nc + c;
+				a[i] += inflow[nodes.node(row0 + bnr - 1, c)];
+			}
+		}
+		flow_accumulate(dir, down, order, a);
+		if (!out.writeBlock(a, b)) return out;
+	}
+	out.writeStop();
+	readStop();
+	return out;
+}
+
+
+
+SpatRaster SpatRaster::watershed(std::vector<double> cells, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	out.setNames({"watershed"});
+	if (nlyr() > 1) {
+		out.setError("watershed needs a single layer object (flow direction)");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("the input raster has no values");
+		return out;
+	}
+	std::unordered_map<int_64, double> pour;
+	double nc_ = ncell();
+	for (size_t i=0; i<cells.size(); i++) {
+		if (std::isnan(cells[i]) || (cells[i] < 0) || (cells[i] >= nc_)) continue;
+		pour[(int_64) cells[i]] = i + 1;
+	}
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!out.writeStart(opt)) {
+		readStop();
+		return out;
+	}
+	size_t nc = ncol();
+	size_t nr = nrow();
+	FlowNodes nodes(out.bs, nr, nc);
+	size_t nn = nodes.size();
+
+	// > 0 is a pour point ID; 0 is none; < 0 refers to node (-id - 1)
+	std::vector<double> dir;
+	std::vector<int_64> down, bout;
+	std::vector<size_t> order;
+	std::vector<double> ws;
+	std::vector<double> nodews(nn, 0);
+
+	auto label = [&](size_t row0, std::vector<double> &v, bool resolved) {
+		v.resize(0);
+		v.resize(dir.size(), 0);
+		size_t off = row0 * nc;
+		for (size_t k=order.size(); k>0; k--) {
+			size_t i = order[k-1];
+			auto p = pour.find(off + i);
+			if (p != pour.end()) {
+				v[i] = p->second;
+			} else if (down[i] >= 0) {
+				v[i] = v[down[i]];
+			} else if ((down[i] == -2) && (bout[i] >= 0)) {
+				v[i] = resolved ? nodews[bout[i]] : -(double)bout[i] - 1;
+			}
+		}
+		// cells on a cycle, or without flow direction, can still be pour points
+		for (auto &p : pour) {
+			if ((p.first >= (int_64)off) && (p.first < (int_64)(off + dir.size()))) {
+				v[p.first - off] = p.second;
+			}
+		}
+	};
+
+	for (size_t b = 0; b < out.bs.n; b++) {
+		size_t row0 = out.bs.row[b];
+		size_t bnr = out.bs.nrows[b];
+		readValues(dir, row0, bnr, 0, nc);
+		flow_down(dir, row0, bnr, nc, nr, nodes, down, bout);
+		flow_order(down, order);
+		label(row0, ws, false);
+		for (size_t i=0; i<ws.size(); i++) {
+			int_64 n = nodes.node(row0 + i / nc, i % nc);
+			if (n >= 0) nodews[n] = ws[i];
+		}
+	}
+
+	// follow the references to other nodes
+	std::vector<int_64> path;
+	for (size_t n=0; n<nn; n++) {
+		path.resize(0);
+		int_64 m = n;
+		while ((nodews[m] < 0) && (path.size() <= nn)) {
+			path.push_back(m);
+			m = -(int_64)nodews[m] - 1;
+		}
+		double id = nodews[m] < 0 ? 0 : nodews[m];
+		for (size_t k=0; k<path.size(); k++) nodews[path[k]] = id;
+	}
+
+	for (size_t b = 0; b < out.bs.n; b++) {
+		size_t row0 = out.bs.row[b];
+		size_t bnr = out.bs.nrows[b];
+		readValues(dir, row0, bnr, 0, nc);
+		flow_down(dir, row0, bnr, nc, nr, nodes, down, bout);
+		flow_order(down, order);
+		label(row0, ws, true);
+		for (double &d : ws) {
+			if (d <= 0) d = NAN;
+		}
+		if (!out.writeBlock(ws, b)) return out;
+	}
+	out.writeStop();
+	readStop();
+	return out;
+}
+
+
+
+// Priority-Flood (Barnes, Lehman and Mulla, 2014; algorithm 2). Cells on
+// the edge of the raster, or next to a cell that is NA, are the outlets.
+// This is done in memory.
+SpatRaster SpatRaster::fillDepressions(SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	if (nlyr() > 1) {
+		out.setError("fillDepressions needs a single layer object (elevation)");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("the input raster has no values");
+		return out;
+	}
+	// the elevation, the filled elevation, the closed cells and the queues
+	SpatOptions ops(opt);
+	ops.ncopies = 4;
+	ops.set_todisk(false);
+	if (!canProcessInMemory(ops)) {
+		out.setError("the raster is too large for fillDepressions (it is processed in memory)");
+		return out;
+	}
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	size_t nc = ncol();
+	size_t nr = nrow();
+	std::vector<double> z;
+	readValues(z, 0, nr, 0, nc);
+	readStop();
+	if (z.size() != (nr * nc)) {
+		out.setError("cannot read values");
+		return out;
+	}
+
+	typedef std::pair<double, size_t> cell;
+	std::priority_queue<cell, std::vector<cell>, std::greater<cell>> open;
+	std::queue<size_t> pit;
+	std::vector<bool> closed(z.size(), false);
+	const int dr[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+	const int dc[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t i = r * nc + c;
+			if (std::isnan(z[i])) {
+				closed[i] = true;
+				continue;
+			}
+			bool edge = (r == 0) || (c == 0) || (r == (nr-1)) || (c == (nc-1));
+			for (size_t k=0; (!edge) && (k<8); k++) {
+				edge = std::isnan(z[(r + dr[k]) * nc + c + dc[k]]);
+			}
+			if (edge) {
+				closed[i] = true;
+				open.push(std::make_pair(z[i], i));
+			}
+		}
+	}
+
+	while ((!open.empty()) || (!pit.empty())) {
+		size_t i;
+		if (!pit.empty()) {
+			i = pit.front();
+			pit.pop();
+		} else {
+			i = open.top().second;
+			open.pop();
+		}
+		long r = i / nc;
+		long c = i % nc;
+		for (size_t k=0; k<8; k++) {
+			long rr = r + dr[k];
+			long cc = c + dc[k];
+			if ((rr < 0) || (cc < 0) || (rr >= (long)nr) || (cc >= (long)nc)) continue;
+			size_t j = rr * nc + cc;
+			if (closed[j]) continue;
+			closed[j] = true;
+			if (z[j] <= z[i]) {
+				z[j] = z[i];
+				pit.push(j);
+			} else {
+				open.push(std::make_pair(z[j], j));
+			}
+		}
+	}
+
+	if (!out.writeStart(opt)) {
+		return out;
+	}
+	for (size_t i = 0; i < out.bs.n; i++) {
+		std::vector<double> v(z.begin() + out.bs.row[i] * nc, z.begin() + (out.bs.row[i] + out.bs.nrows[i]) * nc);
+		if (!out.writeBlock(v, i)) return out;
+	}
+	out.writeStop();
+	return out;
+}
@@ -91,6 +91,33 @@ std::vector<double> SpatRaster::mem_needs(SpatOptions &opt) {
 	return out;
 }
 
+
+bool SpatRaster::nativeBlockRows(size_t &rows, size_t &offset) {
+	// the row tiling of the first file source that is tiled in more than
+	// one row; or that of the raster this one was derived from 
+	for (size_t i=0; i<source.size(); i++) {
+		if (source[i].memory || source[i].multidim) continue;
+		size_t tr = 0;
+		for (size_t j=0; j<source[i].blockrows.size(); j++) {
+			if (source[i].blockrows[j] > 0) {
+				tr = std::max(tr, (size_t) source[i].blockrows[j]);
+			}
+		}
+		if ((tr > 1) && (tr < nrow())) {
+			rows = tr;
+			offset = source[i].hasWindow ? source[i].window.off_row : 0;
+			return true;
+		}
+	}
+	if ((blockrows_hint > 1) && (blockrows_hint < nrow()) && (blockrows_nrow == nrow())) {
+		rows = blockrows_hint;
+		offset = blockrows_offset;
+		return true;
+	}
+	return false;
+}
+
+
 //BlockSize SpatRaster::getBlockSize(unsigned n, double frac, unsigned steps) {
 BlockSize SpatRaster::getBlockSize( SpatOptions &opt) {
 
@@ -107,6 +134,29 @@ BlockSize SpatRaster::getBlockSize( SpatOptions &opt) {
 		cs = nrow() / steps;
 	} else {
 		cs = chunkSize(opt);
+		size_t trows, toff;
+		if ((cs < nrow()) && nativeBlockRows(trows, toff)) {
+			// align the blocks with the tiles (or strips) of the file 
+			// such that each tile is only read (decompressed) once
+			if (cs >= trows) {
+				cs = (cs / trows) * trows;
+			} else {
+				size_t d = cs;
+				while ((trows % d) != 0) d--;
+				cs = d;
+			}
+			size_t r = 0;
+			size_t first = cs - (toff % cs);
+			while (r < nrow()) {
+				size_t nr = (r == 0) ? first : cs;
+				nr = std::min(nr, nrow() - r);
+				bs.row.push_back(r);
+				bs.nrows.push_back(nr);
+				r += nr;
+			}
+			bs.n = bs.row.size();
+			return bs;
+		}
 		bs.n = std::ceil(nrow() / double(cs));
 	}
 	bs.row = std::vector<size_t>(bs.n);
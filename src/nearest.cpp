@@ -0,0 +1,385 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "nearest.h"
+#include "distance.h"
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+
+#ifdef useGDAL
+#include <string>
+#include "gdal_priv.h"
+#include "gdalio.h"
+#include "cpl_worker_thread_pool.h"
+#endif
+
+
+// points with a missing (NaN) coordinate are not in the tree, as they
+// cannot be ordered
+KDTree::KDTree(const std::vector<std::vector<double>> &xyz) {
+	dim = xyz.size();
+	size_t np = dim > 0 ? xyz[0].size() : 0;
+	id.reserve(np);
+	pts.reserve(np * dim);
+	for (size_t i=0; i<np; i++) {
+		bool ok = true;
+		for (size_t j=0; j<dim; j++) {
+			ok = ok && !std::isnan(xyz[j][i]);
+		}
+		if (!ok) continue;
+		id.push_back(i);
+		for (size_t j=0; j<dim; j++) {
+			pts.push_back(xyz[j][i]);
+		}
+	}
+	n = id.size();
+	build(0, n, 0);
+}
+
+// the median point of a range splits it along one of the axes,
+// such that the tree is implicit in the order of the points
+void KDTree::build(size_t lo, size_t hi, size_t depth) {
+	if ((hi - lo) < 2) return;
+	size_t mid = (lo + hi) / 2;
+	size_t axis = depth % dim;
+	std::vector<size_t> ord(hi - lo);
+	std::iota(ord.begin(), ord.end(), lo);
+	std::nth_element(ord.begin(), ord.begin() + (mid - lo), ord.end(), [&](size_t a, size_t b) {
+		return pts[a*dim+axis] < pts[b*dim+axis];
+	});
+	std::vector<double> p(ord.size() * dim);
+	std::vector<size_t> d(ord.size());
+	for (size_t i=0; i<ord.size(); i++) {
+		std::copy(&pts[ord[i]*dim], &pts[ord[i]*dim] + dim, &p[i*dim]);
+		d[i] = id[ord[i]];
+	}
+	std::copy(p.begin(), p.end(), &pts[lo*dim]);
+	std::copy(d.begin(), d.end(), &id[lo]);
+	build(lo, mid, depth+1);
+	build(mid+1, hi, depth+1);
+}
+
+double KDTree::dist2(const double *q, size_t i) const {
+	double d = 0;
+	for (size_t j=0; j<dim; j++) {
+		double a = q[j] - pts[i*dim+j];
+		d += a * a;
+	}
+	return d;
+}
+
+void KDTree::knn_node(const double *q, size_t k, long skip, size_t lo, size_t hi, size_t depth, std::vector<std::pair<double, size_t>> &heap) const {
+	if (lo >= hi) return;
+	size_t mid = (lo + hi) / 2;
+	if ((long)id[mid] != skip) {
+		double d = dist2(q, mid);
+		if (heap.size() < k) {
+			heap.push_back(std::make_pair(d, id[mid]));
+			std::push_heap(heap.begin(), heap.end());
+		} else if (d < heap[0].first) {
+			std::pop_heap(heap.begin(), heap.end());
+			heap.back() = std::make_pair(d, id[mid]);
+			std::push_heap(heap.begin(), heap.end());
+		}
+	}
+	size_t axis = depth % dim;
+	double diff = q[axis] - pts[mid*dim+axis];
+	if (diff < 0) {
+		knn_node(q, k, skip, lo, mid, depth+1, heap);
+		if ((heap.size() < k) || ((diff * diff) < heap[0].first)) {
+			knn_node(q, k, skip, mid+1, hi, depth+1, heap);
+		}
+	} else {
+		knn_node(q, k, skip, mid+1, hi, depth+1, heap);
+		if ((heap.size() < k) || ((diff * diff) < heap[0].first)) {
+			knn_node(q, k, skip, lo, mid, depth+1, heap);
+		}
+	}
+}
+
+void KDTree::knn(const double *q, size_t k, long skip, std::vector<size_t> &idx, std::vector<double> &d2) const {
+	std::vector<std::pair<double, size_t>> heap;
+	heap.reserve(k+1);
+	if (k > 0) knn_node(q, k, skip, 0, n, 0, heap);
+	std::sort_heap(heap.begin(), heap.end());
+	idx.resize(heap.size());
+	d2.resize(heap.size());
+	for (size_t i=0; i<heap.size(); i++) {
+		d2[i] = heap[i].first;
+		idx[i] = heap[i].second;
+	}
+}
+
+void KDTree::within_node(const double *q, double r2, size_t lo, size_t hi, size_t depth, std::vector<size_t> &idx) const {
+	if (lo >= hi) return;
+	size_t mid = (lo + hi) / 2;
+	if (dist2(q, mid) <= r2) idx.push_back(id[mid]);
+	size_t axis = depth % dim;
+	double diff = q[axis] - pts[mid*dim+axis];
+	if ((diff <= 0) || ((diff * diff) <= r2)) within_node(q, r2, lo, mid, depth+1, idx);
+	if ((diff >= 0) || ((diff * diff) <= r2)) within_node(q, r2, mid+1, hi, depth+1, idx);
+}
+
+void KDTree::within(const double *q, double r, std::vector<size_t> &idx) const {
+	idx.resize(0);
+	within_node(q, r * r, 0, n, 0, idx);
+}
+
+
+// lon/lat points are indexed on the unit sphere, where the straight-line
+// (chord) distance increases with the great circle distance. The geodesic
+// distance on the ellipsoid differs from the great circle distance by less
+// than 0.5%, so candidates are searched with a 1% margin and then ranked
+// by their geodesic distance
+static const double mean_radius = 6371008.8;
+
+static std::vector<std::vector<double>> to_sphere(const std::vector<double> &lon, const std::vector<double> &lat) {
+	size_t n = lon.size();
+	std::vector<std::vector<double>> xyz(3, std::vector<double>(n));
+	for (size_t i=0; i<n; i++) {
+		double lo = lon[i] * M_PI / 180;
+		double la = lat[i] * M_PI / 180;
+		xyz[0][i] = std::cos(la) * std::cos(lo);
+		xyz[1][i] = std::cos(la) * std::sin(lo);
+		xyz[2][i] = std::sin(la);
+	}
+	return xyz;
+}
+
+// chord length for a distance (m) along the sphere, with a margin
+static double chord(double d) {
+	double a = std::min(M_PI, 1.01 * d / mean_radius);
+	return 2 * std::sin(a / 2) + 1e-12;
+}
+
+
+// the queries of points i0 to i1 of the first set
+struct PointJoin {
+	const std::vector<double> *x1, *y1, *x2, *y2;
+	// the points on the unit sphere (lon/lat only)
+	const std::vector<std::vector<double>> *s1;
+	const KDTree *tree;
+	size_t k;
+	double d;
+	bool self, lonlat;
+	double m;
+	size_t i0, i1;
+	std::vector<std::vector<double>> out;
+};
+
+
+static void knn_range(PointJoin &p) {
+	const std::vector<double> &x1 = *p.x1, &y1 = *p.y1, &x2 = *p.x2, &y2 = *p.y2;
+	std::vector<std::vector<double>> &out = p.out;
+	out.resize(3);
+	std::vector<size_t> idx;
+	std::vector<double> d2;
+	if (p.lonlat) {
+		const std::vector<std::vector<double>> &s1 = *p.s1;
+		std::vector<std::pair<double, size_t>> cand;
+		for (size_t i=p.i0; i<p.i1; i++) {
+			if (std::isnan(x1[i]) || std::isnan(y1[i])) continue;
+			double q[3] = {s1[0][i], s1[1][i], s1[2][i]};
+			long skip = p.self ? (long)i : -1;
+			p.tree->knn(q, p.k, skip, idx, d2);
+			// all points that could be closer than the k-th by geodesic distance
+			double dmax = 0;
+			for (size_t j=0; j<idx.size(); j++) {
+				dmax = std::max(dmax, distance_lonlat(x1[i], y1[i], x2[idx[j]], y2[idx[j]]));
+			}
+			p.tree->within(q, chord(dmax), idx);
+			cand.resize(0);
+			for (size_t j=0; j<idx.size(); j++) {
+				if ((long)idx[j] == skip) continue;
+				cand.push_back(std::make_pair(distance_lonlat(x1[i], y1[i], x2[idx[j]], y2[idx[j]]), idx[j]));
+			}
+			size_t kk = std::min(p.k, cand.size());
+			std::partial_sort(cand.begin(), cand.begin() + kk, cand.end());
+			for (size_t j=0; j<kk; j++) {
+				out[0].push_back(i);
+				out[1].push_back(cand[j].second);
+				out[2].push_back(cand[j].first);
+			}
+		}
+	} else {
+		for (size_t i=p.i0; i<p.i1; i++) {
+			if (std::isnan(x1[i]) || std::isnan(y1[i])) continue;
+			double q[2] = {x1[i], y1[i]};
+			p.tree->knn(q, p.k, p.self ? (long)i : -1, idx, d2);
+			for (size_t j=0; j<idx.size(); j++) {
+				out[0].push_back(i);
+				out[1].push_back(idx[j]);
+				out[2].push_back(std::sqrt(d2[j]) * p.m);
+			}
+		}
+	}
+}
+
+
+static void within_range(PointJoin &p) {
+	const std::vector<double> &x1 = *p.x1, &y1 = *p.y1, &x2 = *p.x2, &y2 = *p.y2;
+	std::vector<std::vector<double>> &out = p.out;
+	out.resize(3);
+	std::vector<size_t> idx;
+	if (p.lonlat) {
+		const std::vector<std::vector<double>> &s1 = *p.s1;
+		double r = chord(p.d);
+		for (size_t i=p.i0; i<p.i1; i++) {
+			if (std::isnan(x1[i]) || std::isnan(y1[i])) continue;
+			double q[3] = {s1[0][i], s1[1][i], s1[2][i]};
+			p.tree->within(q, r, idx);
+			std::sort(idx.begin(), idx.end());
+			for (size_t j=0; j<idx.size(); j++) {
+				if (p.self && (idx[j] == i)) continue;
+				double dd = distance_lonlat(x1[i], y1[i], x2[idx[j]], y2[idx[j]]);
+				if (dd <= p.d) {
+					out[0].push_back(i);
+					out[1].push_back(idx[j]);
+					out[2].push_back(dd);
+				}
+			}
+		}
+	} else {
+		double r = p.d / p.m;
+		for (size_t i=p.i0; i<p.i1; i++) {
+			if (std::isnan(x1[i]) || std::isnan(y1[i])) continue;
+			double q[2] = {x1[i], y1[i]};
+			p.tree->within(q, r, idx);
+			std::sort(idx.begin(), idx.end());
+			for (size_t j=0; j<idx.size(); j++) {
+				if (p.self && (idx[j] == i)) continue;
+				out[0].push_back(i);
+				out[1].push_back(idx[j]);
+				out[2].push_back(distance_plane(x1[i], y1[i], x2[idx[j]], y2[idx[j]]) * p.m);
+			}
+		}
+	}
+}
+
+
+#ifdef useGDAL
+static void knn_job(void *data) {
+	knn_range(*static_cast<PointJoin*>(data));
+}
+static void within_job(void *data) {
+	within_range(*static_cast<PointJoin*>(data));
+}
+#endif
+
+
+// the queries are divided over the threads (GDAL_NUM_THREADS) in ranges
+// of points, and the results are combined in the order of the points
+static std::vector<std::vector<double>> run_joins(PointJoin &p, size_t n, bool knn) {
+	size_t nthreads = 1;
+#ifdef useGDAL
+	// there is little to gain for a few points
+	nthreads = std::min((size_t)gdal_read_threads(), n / 1000);
+	CPLWorkerThreadPool pool;
+	if ((nthreads > 1) && (!pool.Setup(nthreads, NULL, NULL))) {
+		nthreads = 1;
+	}
+#endif
+	nthreads = std::max((size_t)1, nthreads);
+	size_t step = (n + nthreads - 1) / nthreads;
+	std::vector<PointJoin> jobs(nthreads, p);
+	for (size_t t=0; t<nthreads; t++) {
+		jobs[t].i0 = std::min(n, t * step);
+		jobs[t].i1 = std::min(n, (t+1) * step);
+	}
+#ifdef useGDAL
+	if (nthreads > 1) {
+		if (p.lonlat) {
+			// initializes the static constants of the geodesic library
+			distance_lonlat(0, 0, 1, 1);
+		}
+		for (size_t t=0; t<nthreads; t++) {
+			pool.SubmitJob(knn ? knn_job : within_job, &jobs[t]);
+		}
+		pool.WaitCompletion();
+	} else {
+		knn ? knn_range(jobs[0]) : within_range(jobs[0]);
+	}
+#else
+	knn ? knn_range(jobs[0]) : within_range(jobs[0]);
+#endif
+	if (nthreads == 1) return jobs[0].out;
+	std::vector<std::vector<double>> out(3);
+	for (size_t t=0; t<nthreads; t++) {
+		for (size_t j=0; j<3; j++) {
+			out[j].insert(out[j].end(), jobs[t].out[j].begin(), jobs[t].out[j].end());
+		}
+	}
+	return out;
+}
+
+
+std::vector<std::vector<double>> knn_points(const std::vector<double> &x1, const std::vector<double> &y1, const std::vector<double> &x2, const std::vector<double> &y2, size_t k, bool self, bool lonlat, double m) {
+
+	std::vector<std::vector<double>> out(3);
+	size_t n = x1.size();
+	k = std::min(k, self ? x2.size() - 1 : x2.size());
+	if ((n == 0) || (k == 0)) return out;
+
+	PointJoin p;
+	p.x1 = &x1; p.y1 = &y1; p.x2 = &x2; p.y2 = &y2;
+	p.k = k;
+	p.d = 0;
+	p.self = self;
+	p.lonlat = lonlat;
+	p.m = m;
+	if (lonlat) {
+		std::vector<std::vector<double>> s2 = to_sphere(x2, y2);
+		std::vector<std::vector<double>> s1 = self ? s2 : to_sphere(x1, y1);
+		KDTree tree(s2);
+		p.s1 = &s1;
+		p.tree = &tree;
+		return run_joins(p, n, true);
+	}
+	KDTree tree({x2, y2});
+	p.s1 = NULL;
+	p.tree = &tree;
+	return run_joins(p, n, true);
+}
+
+
+std::vector<std::vector<double>> within_points(const std::vector<double> &x1, const std::vector<double> &y1, const std::vector<double> &x2, const std::vector<double> &y2, double d, bool self, bool lonlat, double m) {
+
+	std::vector<std::vector<double>> out(3);
+	size_t n = x1.size();
+	if ((n == 0) || (x2.size() == 0) || (d < 0)) return out;
+
+	PointJoin p;
+	p.x1 = &x1; p.y1 = &y1; p.x2 = &x2; p.y2 = &y2;
+	p.k = 0;
+	p.d = d;
+	p.self = self;
+	p.lonlat = lonlat;
+	p.m = m;
+	if (lonlat) {
+		std::vector<std::vector<double>> s2 = to_sphere(x2, y2);
+		std::vector<std::vector<double>> s1 = self ? s2 : to_sphere(x1, y1);
+		KDTree tree(s2);
+		p.s1 = &s1;
+		p.tree = &tree;
+		return run_joins(p, n, false);
+	}
+	KDTree tree({x2, y2});
+	p.s1 = NULL;
+	p.tree = &tree;
+	return run_joins(p, n, false);
+}
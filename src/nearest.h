@@ -0,0 +1,51 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATNEAREST_GUARD
+#define SPATNEAREST_GUARD
+
+#include <vector>
+#include <cstddef>
+
+// static kd-tree of points with two or three coordinates
+class KDTree {
+	public:
+		// xyz has a vector for each dimension
+		KDTree(const std::vector<std::vector<double>> &xyz);
+		// the k nearest points, ordered by (squared) distance. Point "skip" is ignored
+		void knn(const double *q, size_t k, long skip, std::vector<size_t> &idx, std::vector<double> &d2) const;
+		// the points within distance r
+		void within(const double *q, double r, std::vector<size_t> &idx) const;
+
+	private:
+		size_t dim, n;
+		std::vector<double> pts;
+		std::vector<size_t> id;
+		void build(size_t lo, size_t hi, size_t depth);
+		void knn_node(const double *q, size_t k, long skip, size_t lo, size_t hi, size_t depth, std::vector<std::pair<double, size_t>> &heap) const;
+		void within_node(const double *q, double r2, size_t lo, size_t hi, size_t depth, std::vector<size_t> &idx) const;
+		double dist2(const double *q, size_t i) const;
+};
+
+// Joins between two sets of points (or of a set with itself if "self").
+// The result has the (0-based) indices i (of the first set) and j, and
+// the distance between them. For lon/lat the distances are geodesic (m);
+// otherwise they are multiplied with "m" (the length of a map unit in meters)
+std::vector<std::vector<double>> knn_points(const std::vector<double> &x1, const std::vector<double> &y1, const std::vector<double> &x2, const std::vector<double> &y2, size_t k, bool self, bool lonlat, double m);
+std::vector<std::vector<double>> within_points(const std::vector<double> &x1, const std::vector<double> &y1, const std::vector<double> &x2, const std::vector<double> &y2, double d, bool self, bool lonlat, double m);
+
+#endif
@@ -0,0 +1,413 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include <cstdint>
+
+
+// Polygons are made by tracing the boundaries between cells with different
+// values. Boundary edges are collected row by row, only keeping the previous
+// row, so the raster is never in memory. The edges of a class are oriented
+// such that the class is on their left and linked into rings at the end.
+// As there are no edges between cells with the same value, the polygons of
+// a class are dissolved while they are traced.
+
+// directions in (col, row) steps: east, north, west, south.
+// (d + 1) % 4 is a left turn
+static const int dcol[4] = {1, 0, -1, 0};
+static const int drow[4] = {0, -1, 0, 1};
+
+struct PolyEdge {
+	uint64_t from, to;
+	unsigned char dir;
+};
+
+class PolyClasses {
+	public:
+		PolyClasses(bool narm) : narm(narm) {}
+		bool narm;
+		std::vector<double> value;
+		std::vector<std::vector<PolyEdge>> edges;
+
+		size_t get(double v) {
+			if (std::isnan(v)) {
+				if (nacls < 0) {
+					nacls = add(v);
+				}
+				return nacls;
+			}
+			auto it = index.find(v);
+			if (it != index.end()) return it->second;
+			size_t i = add(v);
+			index[v] = i;
+			return i;
+		}
+
+	private:
+		long nacls = -1;
+		std::map<double, size_t> index;
+		size_t add(double v) {
+			value.push_back(v);
+			edges.resize(edges.size()+1);
+			return value.size()-1;
+		}
+};
+
+static inline bool same_value(double a, double b) {
+	return (a == b) || (std::isnan(a) && std::isnan(b));
+}
+
+
+// an open run of vertical edges along a column line
+struct PolyRun {
+	bool open = false;
+	double value;
+	size_t start;
+};
+
+
+class PolyTracer {
+
+	public:
+		PolyTracer(size_t nc, bool narm) : nc(nc), nv(nc+1), cls(narm), down(nc+1), up(nc+1) {}
+
+		size_t nc, nv;
+		PolyClasses cls;
+
+		// horizontal edges along row line "r", between row r-1 (prev) and row r (cur).
+		// either can be NULL (outside of the raster)
+		void horizontal(const double *prev, const double *cur, size_t r) {
+			if (cur != NULL) {
+				// top edges of the cells in "cur", going west
+				size_t c = 0;
+				while (c < nc) {
+					if (!include(cur[c]) || ((prev != NULL) && include(prev[c]) && same_value(prev[c], cur[c]))) {
+						c++;
+						continue;
+					}
+					size_t c1 = c;
+					while (((c+1) < nc) && same_value(cur[c+1], cur[c1]) && !((prev != NULL) && include(prev[c+1]) && same_value(prev[c+1], cur[c+1]))) c++;
+					emit(cur[c1], key(r, c+1), key(r, c1), 2);
+					c++;
+				}
+			}
+			if (prev != NULL) {
+				// bottom edges of the cells in "prev", going east
+				size_t c = 0;
+				while (c < nc) {
+					if (!include(prev[c]) || ((cur != NULL) && include(cur[c]) && same_value(prev[c], cur[c]))) {
+						c++;
+						continue;
+					}
+					size_t c1 = c;
+					while (((c+1) < nc) && same_value(prev[c+1], prev[c1]) && !((cur != NULL) && include(cur[c+1]) && same_value(prev[c+1], cur[c+1]))) c++;
+					emit(prev[c1], key(r, c1), key(r, c+1), 0);
+					c++;
+				}
+			}
+		}
+
+		// vertical edges in row r. Runs continue over the rows as long as
+		// the cell to the right (left) has the same value and a different
+		// neighbour
+		void vertical(const double *cur, size_t r) {
+			for (size_t j=0; j<nv; j++) {
+				bool hasL = (j > 0) && include(cur[j-1]);
+				bool hasR = (j < nc) && include(cur[j]);
+				bool differ = !(hasL && hasR && same_value(cur[j-1], cur[j]));
+				if (hasR && differ) {
+					if (down[j].open && !same_value(down[j].value, cur[j])) close_down(j, r);
+					if (!down[j].open) {
+						down[j].open = true;
+						down[j].value = cur[j];
+						down[j].start = r;
+					}
+				} else if (down[j].open) {
+					close_down(j, r);
+				}
+				if (hasL && differ) {
+					if (up[j].open && !same_value(up[j].value, cur[j-1])) close_up(j, r);
+					if (!up[j].open) {
+						up[j].open = true;
+						up[j].value = cur[j-1];
+						up[j].start = r;
+					}
+				} else if (up[j].open) {
+					close_up(j, r);
+				}
+			}
+		}
+
+		void finish(size_t nr) {
+			for (size_t j=0; j<nv; j++) {
+				if (down[j].open) close_down(j, nr);
+				if (up[j].open) close_up(j, nr);
+			}
+		}
+
+		// link the edges of a class into rings of vertex keys. Returns false
+		// if an edge has no successor, i.e. the edges do not form closed rings
+		bool rings(size_t k, std::vector<std::vector<uint64_t>> &out, std::vector<unsigned char> &firstdir) {
+			std::vector<PolyEdge> &e = cls.edges[k];
+			size_t n = e.size();
+			std::vector<std::pair<uint64_t, size_t>> idx(n);
+			for (size_t i=0; i<n; i++) {
+				idx[i] = std::make_pair(e[i].from, i);
+			}
+			std::sort(idx.begin(), idx.end());
+			std::vector<bool> used(n, false);
+			for (size_t i=0; i<n; i++) {
+				if (used[i]) continue;
+				std::vector<uint64_t> ring;
+				ring.push_back(e[i].from);
+				size_t cur = i;
+				while (true) {
+					used[cur] = true;
+					ring.push_back(e[cur].to);
+					auto it = std::lower_bound(idx.begin(), idx.end(), std::make_pair(e[cur].to, (size_t)0));
+					if ((it == idx.end()) || (it->first != e[cur].to)) return false;
+					size_t nxt = it->second;
+					// where two cells of a class only touch at a corner, there are
+					// two outgoing edges. Turning left keeps them apart
+					if (((it+1) != idx.end()) && ((it+1)->first == e[cur].to)) {
+						unsigned char left = (e[cur].dir + 1) % 4;
+						if (e[(it+1)->second].dir == left) nxt = (it+1)->second;
+					}
+					if (nxt == i) break;
+					if (used[nxt]) return false;
+					cur = nxt;
+				}
+				firstdir.push_back(e[i].dir);
+				out.push_back(ring);
+			}
+			cls.edges[k] = std::vector<PolyEdge>();
+			return true;
+		}
+
+	private:
+		std::vector<PolyRun> down, up;
+
+		inline uint64_t key(size_t r, size_t c) {
+			return (uint64_t)r * nv + c;
+		}
+
+		inline bool include(double v) {
+			return !(cls.narm && std::isnan(v));
+		}
+
+		void emit(double v, uint64_t from, uint64_t to, unsigned char dir) {
+			PolyEdge e;
+			e.from = from;
+			e.to = to;
+			e.dir = dir;
+			cls.edges[cls.get(v)].push_back(e);
+		}
+
+		void close_down(size_t j, size_t r) {
+			emit(down[j].value, key(down[j].start, j), key(r, j), 3);
+			down[j].open = false;
+		}
+
+		void close_up(size_t j, size_t r) {
+			emit(up[j].value, key(r, j), key(up[j].start, j), 1);
+			up[j].open = false;
+		}
+};
+
+
+// twice the signed area in (col, row) units; negative for the shells
+// (that have the class on their left) and positive for holes
+static double ring_area(const std::vector<uint64_t> &ring, size_t nv) {
+	double a = 0;
+	for (size_t i=1; i<ring.size(); i++) {
+		double c0 = ring[i-1] % nv, r0 = ring[i-1] / nv;
+		double c1 = ring[i] % nv, r1 = ring[i] / nv;
+		a += c0 * r1 - c1 * r0;
+	}
+	return a;
+}
+
+static bool in_ring(double px, double py, const std::vector<uint64_t> &ring, size_t nv) {
+	bool in = false;
+	for (size_t i=1; i<ring.size(); i++) {
+		double x0 = ring[i-1] % nv, y0 = ring[i-1] / nv;
+		double x1 = ring[i] % nv, y1 = ring[i] / nv;
+		if (((y0 > py) != (y1 > py)) && (px < (x1 - x0) * (py - y0) / (y1 - y0) + x0)) {
+			in = !in;
+		}
+	}
+	return in;
+}
+
+
+SpatVector SpatRaster::polygonize(bool trunc, bool values, bool narm, bool aggregate, SpatOptions &opt) {
+
+	SpatVector out;
+	out.srs = source[0].srs;
+	SpatOptions topt(opt);
+
+	SpatRaster tmp;
+	if (nlyr() > 1) {
+		out.addWarning("only the first layer is polygonized when 'dissolve=TRUE'");
+		tmp = subset({0}, topt);
+	} else {
+		tmp = *this;
+	}
+	std::vector<std::string> nms = getNames();
+	std::string name = nms[0];
+
+	if (!tmp.readStart()) {
+		out.setError(tmp.getError());
+		return out;
+	}
+	size_t nc = ncol();
+	size_t nr = nrow();
+	PolyTracer pt(nc, narm);
+	BlockSize bs = tmp.getBlockSize(opt);
+	std::vector<double> prev;
+	for (size_t i=0; i<bs.n; i++) {
+		std::vector<double> v;
+		tmp.readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+		if (trunc) {
+			for (double &d : v) d = std::trunc(d);
+		}
+		for (size_t j=0; j<bs.nrows[i]; j++) {
+			size_t r = bs.row[i] + j;
+			const double *cur = &v[j * nc];
+			pt.horizontal(prev.empty() ? NULL : &prev[0], cur, r);
+			pt.vertical(cur, r);
+			prev.assign(cur, cur + nc);
+		}
+	}
+	tmp.readStop();
+	if (prev.empty()) return out;
+	pt.horizontal(&prev[0], NULL, nr);
+	pt.finish(nr);
+
+	std::vector<size_t> ord(pt.cls.value.size());
+	std::iota(ord.begin(), ord.end(), 0);
+	std::sort(ord.begin(), ord.end(), [&pt](size_t a, size_t b) {
+		double va = pt.cls.value[a], vb = pt.cls.value[b];
+		if (std::isnan(va)) return false;
+		if (std::isnan(vb)) return true;
+		return va < vb;
+	});
+
+	size_t nv = nc + 1;
+	double xmin = getExtent().xmin;
+	double ymax = getExtent().ymax;
+	double xr = xres();
+	double yr = yres();
+	auto part = [&](const std::vector<uint64_t> &ring, std::vector<double> &x, std::vector<double> &y) {
+		x.resize(ring.size());
+		y.resize(ring.size());
+		for (size_t i=0; i<ring.size(); i++) {
+			x[i] = xmin + (ring[i] % nv) * xr;
+			y[i] = ymax - (ring[i] / nv) * yr;
+		}
+	};
+
+	std::vector<double> atts;
+	for (size_t k : ord) {
+		std::vector<unsigned char> firstdir;
+		std::vector<std::vector<uint64_t>> rings;
+		if (!pt.rings(k, rings, firstdir)) {
+			out.setError("cannot link the edges of the polygons");
+			return out;
+		}
+		std::vector<size_t> shells, holes;
+		std::vector<double> area(rings.size());
+		for (size_t i=0; i<rings.size(); i++) {
+			area[i] = ring_area(rings[i], nv);
+			if (area[i] < 0) {
+				shells.push_back(i);
+			} else {
+				holes.push_back(i);
+			}
+		}
+		// the bounding boxes of the shells, with the shells sorted by their
+		// first row, such that only the shells that start above a point and
+		// have it in their box need to be checked
+		size_t ns = shells.size();
+		std::vector<double> sxmin(ns), sxmax(ns), symin(ns), symax(ns);
+		for (size_t s=0; s<ns; s++) {
+			const std::vector<uint64_t> &ring = rings[shells[s]];
+			sxmin[s] = sxmax[s] = ring[0] % nv;
+			symin[s] = symax[s] = ring[0] / nv;
+			for (size_t i=1; i<ring.size(); i++) {
+				double c = ring[i] % nv, r = ring[i] / nv;
+				sxmin[s] = std::min(sxmin[s], c);
+				sxmax[s] = std::max(sxmax[s], c);
+				symin[s] = std::min(symin[s], r);
+				symax[s] = std::max(symax[s], r);
+			}
+		}
+		std::vector<size_t> byrow(ns);
+		std::iota(byrow.begin(), byrow.end(), 0);
+		std::sort(byrow.begin(), byrow.end(), [&symin](size_t a, size_t b) { return symin[a] < symin[b]; });
+		std::vector<double> firstrow(ns);
+		for (size_t s=0; s<ns; s++) firstrow[s] = symin[byrow[s]];
+
+		std::vector<std::vector<size_t>> shellholes(ns);
+		for (size_t h : holes) {
+			// a point just inside a cell of the class, next to the hole
+			const std::vector<uint64_t> &ring = rings[h];
+			unsigned char d = firstdir[h];
+			unsigned char left = (d + 1) % 4;
+			double px = (ring[0] % nv) + 0.5 * dcol[d] + 0.25 * dcol[left];
+			double py = (ring[0] / nv) + 0.5 * drow[d] + 0.25 * drow[left];
+			// the smallest shell that has the point
+			long best = -1;
+			size_t nabove = std::upper_bound(firstrow.begin(), firstrow.end(), py) - firstrow.begin();
+			for (size_t i=0; i<nabove; i++) {
+				size_t s = byrow[i];
+				if ((py > symax[s]) || (px < sxmin[s]) || (px > sxmax[s])) continue;
+				if ((best >= 0) && (-area[shells[s]] >= -area[shells[best]])) continue;
+				if (in_ring(px, py, rings[shells[s]], nv)) best = s;
+			}
+			if (best >= 0) shellholes[best].push_back(h);
+		}
+
+		SpatGeom g;
+		g.gtype = polygons;
+		for (size_t s=0; s<shells.size(); s++) {
+			std::vector<double> x, y;
+			part(rings[shells[s]], x, y);
+			SpatPart p(x, y);
+			for (size_t h : shellholes[s]) {
+				part(rings[h], x, y);
+				p.addHole(x, y);
+			}
+			g.addPart(p);
+			if (!aggregate) {
+				out.addGeom(g);
+				atts.push_back(pt.cls.value[k]);
+				g = SpatGeom();
+				g.gtype = polygons;
+			}
+		}
+		if (aggregate && (g.size() > 0)) {
+			out.addGeom(g);
+			atts.push_back(pt.cls.value[k]);
+		}
+	}
+
+	if (values) {
+		out.df.add_column(atts, name);
+	}
+	return out;
+}
@@ -24,6 +24,8 @@
 #include "math_utils.h"
 #include "file_utils.h"
 #include "string_utils.h"
+#include "sketch.h"
+#include "cellarea.h"
 
 
 /*
@@ -111,54 +113,6 @@ SpatExtent SpatRaster::ext_from_cell(double cell) {
 	return ext_from_rc(rc[0][0], rc[0][0], rc[1][0], rc[1][0]); 
 }
 
-std::vector<std::string> SpatRaster::make_tiles(SpatRaster x, bool expand, bool narm, std::string filename, SpatOptions &opt) {
-
-	std::vector<std::string> ff;
-	if (!hasValues()) {
-		setError("input raster has no values");
-		return ff;
-	}
-	x = x.geometry(1, false, false, false);
-	SpatExtent e = getExtent();
-	if (expand) {
-		x = x.extend(e, "out", opt);
-	}
-	x = x.crop(e, "out", opt);
-	
-	std::vector<size_t> d(x.ncell());
-	std::iota(d.begin(), d.end(), 1);
-
-	std::string fext = getFileExt(filename);
-	std::string f = noext(filename);
-	ff.reserve(d.size());
-	size_t nl = nlyr();
-	for (size_t i=0; i<d.size(); i++) {
-		std::string fout = f + std::to_string(d[i]) + fext;
-		SpatExtent exi = x.ext_from_cell(i); 
-		opt.set_filenames({fout});
-		SpatRaster out = crop(exi, "near", opt);
-		if (out.hasError()) {
-			setError(out.getError());
-			return ff;
-		}
-		if ( out.hasValues() ) {
-			if (narm) {
-				std::vector<double> rmin = out.range_min();
-				size_t cnt = 0;
-				for (double &v : rmin) {
-					if (std::isnan(v)) cnt++;
-				}
-				if (cnt == nl) {
-					remove(fout.c_str());
-					continue;
-				}
-			}
-			ff.push_back(fout);
-		}
-	}
-	return ff;
-}
-
 
 bool SpatRaster::get_aggregate_dims(std::vector<unsigned> &fact, std::string &message ) {
 
@@ -756,20 +710,34 @@ SpatRaster SpatRaster::stretch(std::vector<double> minv, std::vector<double> max
 		}
 	}
 
+	// the quantiles of all layers that need them are computed in one pass
 	std::vector<bool> hR = hasRange();
+	std::vector<double> rmn = range_min(); 
+	std::vector<double> rmx = range_max(); 
+	std::vector<std::vector<double>> probs(nl);
+	bool getq = false;
 	for (size_t i=0; i<nl; i++) {
 		if (!useS[i]) {
 			if ((minq[i]==0) && (maxq[i]==1) && hR[i]) {
-				std::vector<double> rmn = range_min(); 
-				std::vector<double> rmx = range_max(); 
 				q[i] = {rmn[i], rmx[i]};
 			} else {
-				std::vector<double> probs = {minq[i], maxq[i]};
-				SpatOptions xopt(opt);
-				std::vector<double> v = getValues(i, xopt);
-				q[i] = vquantile(v, probs, true);
+				probs[i] = {minq[i], maxq[i]};
+				getq = true;
 			}
 		}
+	}
+	if (getq) {
+		SpatOptions xopt(opt);
+		std::vector<std::vector<double>> pq = layer_quantiles(probs, xopt);
+		if (hasError()) {
+			out.setError(getError());
+			return out;
+		}
+		for (size_t i=0; i<nl; i++) {
+			if (probs[i].size() > 0) q[i] = pq[i];
+		}
+	}
+	for (size_t i=0; i<nl; i++) {
 		mult[i] = maxv[i] / (q[i][1]-q[i][0]);
 	}
 
@@ -846,19 +814,34 @@ SpatRaster SpatRaster::apply(std::vector<unsigned> ind, std::string fun, bool na
 	}
 
 	std::function<double(std::vector<double>&, bool)> theFun = getFun(fun);
+	bool layerfun = haveLayerFun(fun);
+	std::vector<std::vector<size_t>> groups(nl);
+	for (size_t k=0; k<ird.size(); k++) {
+		groups[ird[k]].push_back(k);
+	}
+	std::vector<double> add;
+	size_t nlin = ind.size();
 
 	for (size_t i=0; i<out.bs.n; i++) {
-        std::vector<double> a;
-		readBlock(a, out.bs, i);
 		unsigned nc = out.bs.nrows[i] * ncol();
 		std::vector<double> b(nc * nl);
-		for (size_t j=0; j<nc; j++) {
-			for (size_t k=0; k<ird.size(); k++) {
-				v[ird[k]][jrd[k]] = a[j+k*nc];
+		if (layerfun) {
+			std::vector<double> a;
+			readBlock(a, out.bs, i);
+			for (size_t k=0; k<nl; k++) {
+				reduceLayers(fun, &a[0], nc, groups[k], add, narm, &b[k*nc]);
 			}
-			for (size_t k=0; k<ui.size(); k++) {
-				size_t off = k * nc + j;
-				b[off] = theFun(v[k], narm);
+		} else {
+			std::vector<double> a = readBlockIP(out.bs, i);
+			for (size_t j=0; j<nc; j++) {
+				const double *aj = &a[j*nlin];
+				for (size_t k=0; k<ird.size(); k++) {
+					v[ird[k]][jrd[k]] = aj[k];
+				}
+				for (size_t k=0; k<ui.size(); k++) {
+					size_t off = k * nc + j;
+					b[off] = theFun(v[k], narm);
+				}
 			}
 		}
 		if (!out.writeBlock(b, i)) return out;
@@ -2402,7 +2385,6 @@ SpatRaster SpatRasterCollection::mosaic(std::string fun, SpatOptions &opt) {
 	}
 
 	SpatExtent eout = out.getExtent();
-	double hyr = out.yres()/2;
 
 	std::string warn = "";
 	for (size_t i=0; i<n; i++) {
@@ -2421,47 +2403,153 @@ SpatRaster SpatRasterCollection::mosaic(std::string fun, SpatOptions &opt) {
 	}
 	if (warn != "") out.addWarning(warn);
 
+	// position of each input in the output grid
+	std::vector<size_t> row0(n), col0(n), nrs(n), ncs(n), nls(n);
+	for (size_t i=0; i<n; i++) {
+		SpatExtent ei = ds[i].getExtent();
+		row0[i] = std::round((eout.ymax - ei.ymax) / out.yres());
+		col0[i] = std::round((ei.xmin - eout.xmin) / out.xres());
+		nrs[i] = ds[i].nrow();
+		ncs[i] = ds[i].ncol();
+		nls[i] = ds[i].nlyr();
+	}
+	// the inputs ordered by their first row. Output blocks span all columns,
+	// so the inputs that overlap with a block can be found by sweeping down
+	// this list; an input is opened when the first block reaches it and
+	// closed after the last block that needs it
+	std::vector<size_t> order(n);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&row0](size_t a, size_t b){ return row0[a] < row0[b]; });
+	std::vector<size_t> active;
+	size_t next = 0;
+
  	if (!out.writeStart(opt)) { return out; }
-	SpatOptions sopt(opt);
-	sopt.progressbar = false;
-	std::vector<double> v;
+	size_t onc = out.ncol();
+	std::vector<double> v, cnt;
+	// for "median", the values of each active input (covering the rows
+	// "pr1" to "pr1 + pnr" of the output)
+	std::vector<std::vector<double>> parts;
+	std::vector<size_t> pr1, pnr;
 	for (size_t i=0; i < out.bs.n; i++) {
-		eout.ymax = out.yFromRow(out.bs.row[i]) + hyr;
-		eout.ymin = out.yFromRow(out.bs.row[i] + out.bs.nrows[i] - 1) - hyr;
-		SpatRasterStack s;
-		for (size_t j=0; j<n; j++) {
-			e = ds[j].getExtent();
-			e = e.intersect(eout);
-			if ( e.valid_notequal() ) {
-				SpatRaster r = ds[j].crop(eout, "near", sopt);
-				//SpatExtent ec = r.getExtent();
-				r = r.extend(eout, "near", sopt);
-				//SpatExtent ee = r.getExtent();
-				if (!s.push_back(r, "", "", "", false)) {
-					out.setError("internal error: " + s.getError());
-					out.writeStop();
-					return out;
+		size_t brow = out.bs.row[i];
+		size_t bend = brow + out.bs.nrows[i];
+		while ((next < n) && (row0[order[next]] < bend)) {
+			size_t j = order[next];
+			if (!ds[j].readStart()) {
+				out.setError(ds[j].getError());
+				for (size_t k=0; k<active.size(); k++) {
+					ds[active[k]].readStop();
 				}
-			}
-		} 
-		size_t ncls = out.bs.nrows[i] * out.ncol() * nl;
-		if (s.size() > 0) {
-			SpatRaster r = s.summary(fun, true, sopt);
-			if (r.hasError()) {
-				out.setError("internal error: " + r.getError());
 				out.writeStop();
 				return out;
 			}
-			if (!r.getValuesSource(0, v)) {
-				out.setError("internal error: " + r.getError());
-				out.writeStop();
-				return out;
+			active.push_back(j);
+			next++;
+		}
+		// "first" is the first input in the collection, not on the map
+		std::sort(active.begin(), active.end());
+
+		size_t lyrcells = out.bs.nrows[i] * onc;
+		size_t ncls = lyrcells * nl;
+		v.assign(ncls, NAN);
+		if (fun == "mean") {
+			cnt.assign(ncls, 0);
+		} else if (fun == "median") {
+			parts.resize(active.size());
+			pr1.assign(active.size(), 0);
+			pnr.assign(active.size(), 0);
+		}
+		for (size_t k=0; k<active.size(); k++) {
+			size_t j = active[k];
+			size_t r1 = std::max(brow, row0[j]);
+			size_t r2 = std::min(bend, row0[j] + nrs[j]);
+			if (r1 >= r2) continue;
+			size_t nr = r2 - r1;
+			std::vector<double> a;
+			ds[j].readValues(a, r1 - row0[j], nr, 0, ncs[j]);
+			if (fun == "median") {
+				parts[k].swap(a);
+				pr1[k] = r1 - brow;
+				pnr[k] = nr;
+				continue;
+			}
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				// inputs with fewer layers are recycled
+				size_t aoff = (lyr % nls[j]) * nr * ncs[j];
+				for (size_t r=0; r<nr; r++) {
+					const double *ar = &a[aoff + r * ncs[j]];
+					size_t voff = lyr * lyrcells + (r1 - brow + r) * onc + col0[j];
+					double *vr = &v[voff];
+					if (fun == "first") {
+						for (size_t c=0; c<ncs[j]; c++) {
+							if (std::isnan(vr[c])) vr[c] = ar[c];
+						}
+					} else if ((fun == "sum") || (fun == "mean")) {
+						for (size_t c=0; c<ncs[j]; c++) {
+							if (std::isnan(ar[c])) continue;
+							vr[c] = std::isnan(vr[c]) ? ar[c] : vr[c] + ar[c];
+						}
+						if (fun == "mean") {
+							double *cr = &cnt[voff];
+							for (size_t c=0; c<ncs[j]; c++) {
+								cr[c] += !std::isnan(ar[c]);
+							}
+						}
+					} else if (fun == "min") {
+						for (size_t c=0; c<ncs[j]; c++) {
+							if (std::isnan(ar[c])) continue;
+							vr[c] = std::isnan(vr[c]) ? ar[c] : std::min(vr[c], ar[c]);
+						}
+					} else { // max
+						for (size_t c=0; c<ncs[j]; c++) {
+							if (std::isnan(ar[c])) continue;
+							vr[c] = std::isnan(vr[c]) ? ar[c] : std::max(vr[c], ar[c]);
+						}
+					}
+				}
 			}
-			recycle(v, ncls);
-		} else {
-			v = std::vector<double>(ncls, NAN); 
 		}
-		if (!out.writeBlock(v, i)) return out;
+		if (fun == "mean") {
+			for (size_t j=0; j<ncls; j++) {
+				v[j] /= cnt[j];
+			}
+		} else if ((fun == "median") && (!active.empty())) {
+			std::vector<double> m;
+			m.reserve(active.size());
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				for (size_t r=0; r<out.bs.nrows[i]; r++) {
+					for (size_t c=0; c<onc; c++) {
+						m.resize(0);
+						for (size_t k=0; k<active.size(); k++) {
+							size_t j = active[k];
+							if ((pnr[k] == 0) || (r < pr1[k]) || (r >= (pr1[k] + pnr[k]))) continue;
+							if ((c < col0[j]) || (c >= (col0[j] + ncs[j]))) continue;
+							size_t aoff = (lyr % nls[j]) * pnr[k] * ncs[j];
+							double d = parts[k][aoff + (r - pr1[k]) * ncs[j] + c - col0[j]];
+							if (!std::isnan(d)) m.push_back(d);
+						}
+						v[lyr * lyrcells + r * onc + c] = vmedian(m, false);
+					}
+				}
+			}
+		}
+		if (!out.writeBlock(v, i)) {
+			for (size_t k=0; k<active.size(); k++) {
+				ds[active[k]].readStop();
+			}
+			return out;
+		}
+
+		for (int k=(active.size()-1); k>=0; k--) {
+			size_t j = active[k];
+			if ((row0[j] + nrs[j]) <= bend) {
+				ds[j].readStop();
+				active.erase(active.begin() + k);
+			}
+		}
+	}
+	for (size_t k=0; k<active.size(); k++) {
+		ds[active[k]].readStop();
 	}
 	out.writeStop();
 	return(out);
@@ -2624,7 +2712,7 @@ void do_stats(std::vector<double> &v, std::string fun, bool narm, double &stat,
 SpatDataFrame SpatRaster::global(std::string fun, bool narm, SpatOptions &opt) {
 
 	SpatDataFrame out;
-	std::vector<std::string> f {"sum", "mean", "min", "max", "range", "prod", "rms", "sd", "std", "stdpop", "isNA", "notNA"};
+	std::vector<std::string> f {"sum", "mean", "min", "max", "range", "prod", "rms", "sd", "std", "stdpop", "isNA", "notNA", "distinct"};
 	if (std::find(f.begin(), f.end(), fun) == f.end()) {
 		out.setError("not a valid function");
 		return(out);
@@ -2635,6 +2723,31 @@ SpatDataFrame SpatRaster::global(std::string fun, bool narm, SpatOptions &opt) {
 		return(out);
 	}
 
+	if (fun == "distinct") {
+		// approximate number of distinct values
+		std::vector<DistinctSketch> sk(nlyr());
+		if (!readStart()) {
+			out.setError(getError());
+			return(out);
+		}
+		BlockSize bs = getBlockSize(opt);
+		for (size_t i=0; i<bs.n; i++) {
+			std::vector<double> v;
+			readBlock(v, bs, i);
+			size_t off = bs.nrows[i] * ncol();
+			for (size_t lyr=0; lyr<nlyr(); lyr++) {
+				sk[lyr].add(&v[lyr * off], off);
+			}
+		}
+		readStop();
+		std::vector<double> d(nlyr());
+		for (size_t lyr=0; lyr<nlyr(); lyr++) {
+			d[lyr] = sk[lyr].count();
+		}
+		out.add_column(d, fun);
+		return(out);
+	}
+
 	std::string sdfun = fun;
 	if ((fun == "std") || (fun == "sdpop")) {
 		sdfun = "std";
@@ -2713,6 +2826,54 @@ SpatDataFrame SpatRaster::global(std::string fun, bool narm, SpatOptions &opt) {
 
 
 
+// weighted sum or mean of the values of each layer. getw fills the weights
+// of nrows rows, starting at row
+static void weighted_stats(SpatRaster &x, std::function<void(size_t, size_t, std::vector<double>&)> getw, std::string fun, bool narm, SpatDataFrame &out, SpatOptions &opt) {
+
+	std::vector<double> stats(x.nlyr());
+	double stats2 = 0;
+	std::vector<double> n(x.nlyr());
+	std::vector<double> w(x.nlyr());
+
+	BlockSize bs = x.getBlockSize(opt);
+	for (size_t i=0; i<bs.n; i++) {
+		std::vector<double> v, wv;
+		x.readValues(v, bs.row[i], bs.nrows[i], 0, x.ncol());
+		getw(bs.row[i], bs.nrows[i], wv);
+
+		unsigned off = bs.nrows[i] * x.ncol() ;
+		for (size_t lyr=0; lyr<x.nlyr(); lyr++) {
+			double wsum = 0;
+			unsigned offset = lyr * off;
+			std::vector<double> vv(v.begin()+offset,  v.begin()+offset+off);
+			for (size_t j=0; j<vv.size(); j++) {
+				if (!std::isnan(vv[j]) && !std::isnan(wv[j])) {
+					vv[j] *= wv[j];
+					wsum += wv[j];
+				} else {
+					vv[j] = NAN;
+				}
+			}
+			do_stats(vv, fun, narm, stats[lyr], stats2, n[lyr], i);
+			w[lyr] += wsum; 
+		}
+	}
+
+	if (fun=="mean") {
+		for (size_t lyr=0; lyr<x.nlyr(); lyr++) {
+			if (n[lyr] > 0 && w[lyr] != 0) {
+				stats[lyr] /= w[lyr];
+			} else {
+				stats[lyr] = NAN;
+			}
+		}
+		out.add_column(stats, "weighted_mean");
+	} else {
+		out.add_column(stats, "weighted_sum");
+	}
+}
+
+
 SpatDataFrame SpatRaster::global_weighted_mean(SpatRaster &weights, std::string fun, bool narm, SpatOptions &opt) {
 
 	SpatDataFrame out;
@@ -2737,10 +2898,6 @@ SpatDataFrame SpatRaster::global_weighted_mean(SpatRaster &weights, std::string
 		return(out);
 	}
 
-	std::vector<double> stats(nlyr());
-	double stats2 = 0;
-	std::vector<double> n(nlyr());
-	std::vector<double> w(nlyr());
 	if (!readStart()) {
 		out.setError(getError());
 		return(out);
@@ -2749,46 +2906,43 @@ SpatDataFrame SpatRaster::global_weighted_mean(SpatRaster &weights, std::string
 		out.setError(weights.getError());
 		return(out);
 	}
-
-	BlockSize bs = getBlockSize(opt);
-	for (size_t i=0; i<bs.n; i++) {
-		std::vector<double> v, wv;
-		readValues(v, bs.row[i], bs.nrows[i], 0, ncol());
-		weights.readValues(wv, bs.row[i], bs.nrows[i], 0, ncol());
-
-		unsigned off = bs.nrows[i] * ncol() ;
-		for (size_t lyr=0; lyr<nlyr(); lyr++) {
-			double wsum = 0;
-			unsigned offset = lyr * off;
-			std::vector<double> vv(v.begin()+offset,  v.begin()+offset+off);
-			for (size_t j=0; j<vv.size(); j++) {
-				if (!std::isnan(vv[j]) && !std::isnan(wv[j])) {
-					vv[j] *= wv[j];
-					wsum += wv[j];
-				} else {
-					vv[j] = NAN;
-				}
-			}
-			do_stats(vv, fun, narm, stats[lyr], stats2, n[lyr], i);
-			w[lyr] += wsum; 
-		}
-	}
+	size_t nc = ncol();
+	weighted_stats(*this, [&weights, nc](size_t row, size_t nrows, std::vector<double> &wv) {
+		weights.readValues(wv, row, nrows, 0, nc);
+	}, fun, narm, out, opt);
 	readStop();
 	weights.readStop();
+	return(out);
+}
 
-	if (fun=="mean") {
-		for (size_t lyr=0; lyr<nlyr(); lyr++) {
-			if (n[lyr] > 0 && w[lyr] != 0) {
-				stats[lyr] /= w[lyr];
-			} else {
-				stats[lyr] = NAN;
-			}
-		}
-		out.add_column(stats, "weighted_mean");
-	} else {
-		out.add_column(stats, "weighted_sum");
-	}
 
+// weighted by the area of the cells, without making a raster with the areas
+SpatDataFrame SpatRaster::global_weighted_area(std::string fun, bool narm, SpatOptions &opt) {
+
+	SpatDataFrame out;
+
+	std::vector<std::string> f {"sum", "mean"};
+	if (std::find(f.begin(), f.end(), fun) == f.end()) {
+		out.setError("not a valid function");
+		return(out);
+	}
+	if (!hasValues()) {
+		out.setError("SpatRaster has no values");
+		return(out);
+	}
+	SpatCellArea ca(*this, "m", false, opt);
+	if (ca.error != "") {
+		out.setError(ca.error);
+		return(out);
+	}
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	weighted_stats(*this, [&ca](size_t row, size_t nrows, std::vector<double> &wv) {
+		ca.cells(row, nrows, wv);
+	}, fun, narm, out, opt);
+	readStop();
 	return(out);
 }
 
@@ -3817,13 +3971,13 @@ bool SpatRaster::replaceCellValues(std::vector<double> &cells, std::vector<doubl
 		if (!source[i].memory) {
 			if (!canProcessInMemory(opt)) {
 				try {
-					readAll();
+					readAll(opt);
 				} catch(...) {
 					setError("cannot process this raster in memory");
 					return false;
 				}
 			} else {
-				readAll();
+				readAll(opt);
 			}
 			break;
 		}
@@ -3832,11 +3986,12 @@ bool SpatRaster::replaceCellValues(std::vector<double> &cells, std::vector<doubl
 		size_t addlyr = 0;
 		for (size_t i=0; i<ns; i++) {
 			size_t nl = source[i].nlyr;
+			double *sv = source[i].values.unique();
 			for (size_t j=0; j<nl; j++) {
 				size_t off = nc * j;
 				size_t koff = cs * (j+addlyr);
 				for (size_t k=0; k<cs; k++) {
-					source[i].values[off + cells[k]] = v[koff + k];
+					sv[off + (size_t)cells[k]] = v[koff + k];
 				}
 			}
 			source[i].setRange();
@@ -3847,10 +4002,11 @@ bool SpatRaster::replaceCellValues(std::vector<double> &cells, std::vector<doubl
 		//double maxv = vmax(v, true);
 		for (size_t i=0; i<ns; i++) {
 			size_t nl = source[i].nlyr;
+			double *sv = source[i].values.unique();
 			for (size_t j=0; j<nl; j++) {
 				size_t off = nc * j;
 				for (size_t k=0; k<cs; k++) {
-					source[i].values[off + cells[k]] = v[k];
+					sv[off + (size_t)cells[k]] = v[k];
 				}
 			}
 			source[i].setRange();
@@ -21,39 +21,138 @@
 #include <cmath>
 #include <algorithm>
 #include <map>
+#include <cstring>
 
 #include "vecmath.h"
 #include "math_utils.h"
 #include "string_utils.h"
-
-std::map<double, unsigned long long> table(std::vector<double> &v) {
-	std::map<double, unsigned long long> count;
-	for_each( v.begin(), v.end(), [&count]( double val ){
-			if(!std::isnan(val)) count[val]++;
+#include "sketch.h"
+#include "cellarea.h"
+
+#ifdef useGDAL
+#include "gdalio.h"
+#include "cpl_worker_thread_pool.h"
+#endif
+
+// counts of distinct values. Integers within a known (small) range are
+// counted in a dense histogram; other values go into an open addressing
+// hash table. The histogram sizes of all tables together are limited by
+// "budget", and a histogram is only allocated when it gets a value
+class ValueTable {
+	public:
+		// dense histogram for the integers lo, lo+1, ..., lo+ndense-1
+		double lo = 0;
+		size_t ndense = 0;
+		std::vector<unsigned long long> dense;
+		// hash table; slots with a zero count are empty
+		std::vector<double> keys;
+		std::vector<unsigned long long> counts;
+		size_t nkeys = 0;
+		unsigned long long nas = 0;
+
+		ValueTable(double min, double max, size_t &budget) {
+			if (std::isfinite(min) && std::isfinite(max)) {
+				lo = std::floor(min);
+				double n = std::floor(max) - lo + 1;
+				if ((n > 0) && (n <= budget)) {
+					ndense = n;
+					budget -= ndense;
+				}
+			}
+			keys.resize(64);
+			counts.resize(64, 0);
 		}
-	);
-	return count;
-}
 
+		static size_t hash(double d) {
+			uint64_t h;
+			std::memcpy(&h, &d, sizeof(double));
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ULL;
+			h ^= h >> 33;
+			return h;
+		}
 
-std::map<double, unsigned long long int> ctable(std::map<double, unsigned long long int> &x, std::map<double, unsigned long long int> &y) {
-	for(auto p : y) {
-		x[p.first] += p.second;
-	}
-	return(x);
-}
+		void insert(double d, unsigned long long n) {
+			size_t mask = keys.size() - 1;
+			size_t i = hash(d) & mask;
+			while ((counts[i] != 0) && (keys[i] != d)) {
+				i = (i + 1) & mask;
+			}
+			if (counts[i] == 0) {
+				keys[i] = d;
+				nkeys++;
+			}
+			counts[i] += n;
+		}
 
+		void grow() {
+			std::vector<double> k(keys.size() * 2);
+			std::vector<unsigned long long> c(counts.size() * 2, 0);
+			k.swap(keys);
+			c.swap(counts);
+			nkeys = 0;
+			for (size_t i=0; i<k.size(); i++) {
+				if (c[i] != 0) insert(k[i], c[i]);
+			}
+		}
 
-std::vector<double> vtable(std::map<double, unsigned long long int> &x) {
-	std::vector<std::vector<double>> out(2);
-	for( auto p : x ) {
-		out[0].push_back(p.first);
-		out[1].push_back(p.second);
-	}
-	out[0].insert(out[0].end(), out[1].begin(), out[1].end());
-	return out[0];
-}
+		void add(const double* v, size_t n) {
+			size_t nd = ndense;
+			for (size_t i=0; i<n; i++) {
+				double d = v[i];
+				if (std::isnan(d)) {
+					nas++;
+					continue;
+				}
+				double j = d - lo;
+				if ((j >= 0) && (j < nd) && (j == std::floor(j))) {
+					if (dense.empty()) dense.resize(ndense, 0);
+					dense[(size_t) j]++;
+				} else {
+					if ((2 * (nkeys + 1)) > keys.size()) grow();
+					// -0 and 0 are the same value
+					insert(d + 0.0, 1);
+				}
+			}
+		}
 
+		// sorted values followed by their counts
+		std::vector<double> values(bool withcounts) {
+			std::vector<std::pair<double, unsigned long long>> x;
+			x.reserve(nkeys);
+			for (size_t i=0; i<keys.size(); i++) {
+				if (counts[i] != 0) x.push_back({keys[i], counts[i]});
+			}
+			std::sort(x.begin(), x.end());
+			std::vector<double> out;
+			for (size_t i=0; i<dense.size(); i++) {
+				if (dense[i] != 0) out.push_back(lo + i);
+			}
+			size_t nd = out.size();
+			for (size_t i=0; i<x.size(); i++) {
+				out.push_back(x[i].first);
+			}
+			if (nd > 0 && x.size() > 0) {
+				std::inplace_merge(out.begin(), out.begin() + nd, out.end());
+			}
+			if (withcounts) {
+				size_t n = out.size();
+				out.reserve(2 * n);
+				for (size_t i=0; i<n; i++) {
+					double j = out[i] - lo;
+					if ((j >= 0) && (j < dense.size()) && (j == std::floor(j))) {
+						out.push_back(dense[(size_t) j]);
+					} else {
+						auto it = std::lower_bound(x.begin(), x.end(), std::make_pair(out[i], (unsigned long long)0));
+						out.push_back(it->second);
+					}
+				}
+			}
+			return out;
+		}
+};
 
 
 std::vector<std::vector<double>> SpatRaster::freq(bool bylayer, bool round, int digits, SpatOptions &opt) {
@@ -66,41 +165,46 @@ std::vector<std::vector<double>> SpatRaster::freq(bool bylayer, bool round, int
 		return(out);
 	}
 
-	if (bylayer) {
-		out.resize(nl);
-		std::vector<std::map<double, unsigned long long int>> tabs(nl);
-		for (size_t i = 0; i < bs.n; i++) {
-			unsigned nrc = bs.nrows[i] * nc;
-			std::vector<double> v; 
-			readValues(v, bs.row[i], bs.nrows[i], 0, nc);
-			if (round) {
-				for(double& d : v) d = roundn(d, digits);
-			}
-			for (size_t lyr=0; lyr<nl; lyr++) {
-				unsigned off = lyr*nrc;
-				std::vector<double> vv(v.begin()+off, v.begin() + off + nrc);
-				std::map<double, unsigned long long int> tab = table(vv);
-				tabs[lyr] = ctable(tabs[lyr], tab);
-			}
+	// a dense histogram can be used if the range is known
+	std::vector<bool> hr = hasRange();
+	std::vector<double> rmin = range_min();
+	std::vector<double> rmax = range_max();
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		if (!hr[lyr]) {
+			rmin[lyr] = NAN;
+			rmax[lyr] = NAN;
 		}
+	}
+
+	size_t budget = 1048576;
+	std::vector<ValueTable> tabs;
+	if (bylayer) {
 		for (size_t lyr=0; lyr<nl; lyr++) {
-			out[lyr] = vtable(tabs[lyr]);
+			tabs.push_back(ValueTable(rmin[lyr], rmax[lyr], budget));
 		}
 	} else {
-		out.resize(1);
-		std::map<double, long long unsigned> tabs;
-		for (size_t i = 0; i < bs.n; i++) {
-			std::vector<double> v;
-			readValues(v, bs.row[i], bs.nrows[i], 0, nc);
-			if (round) {
-				for (double& d : v) d = roundn(d, digits);
+		tabs.push_back(ValueTable(vmin(rmin, false), vmax(rmax, false), budget));
+	}
+	for (size_t i = 0; i < bs.n; i++) {
+		size_t nrc = bs.nrows[i] * nc;
+		std::vector<double> v;
+		readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+		if (round) {
+			for(double& d : v) d = roundn(d, digits);
+		}
+		if (bylayer) {
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				tabs[lyr].add(&v[lyr*nrc], nrc);
 			}
-			std::map<double, long long unsigned> tab = table(v);
-			tabs = ctable(tabs, tab);
+		} else {
+			tabs[0].add(&v[0], v.size());
 		}
-		out[0] = vtable(tabs);
 	}
 	readStop();
+	out.resize(tabs.size());
+	for (size_t i=0; i<tabs.size(); i++) {
+		out[i] = tabs[i].values(true);
+	}
 	return(out);
 }
 
@@ -195,15 +299,12 @@ SpatRaster SpatRaster::quantile(std::vector<double> probs, bool narm, SpatOption
 	std::vector<double> v(nl);
 
 	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a;
-		readBlock(a, out.bs, i);
+		std::vector<double> a = readBlockIP(out.bs, i);
 		unsigned nc = out.bs.nrows[i] * out.ncol();
 		std::vector<double> b(nc * n);
 		for (size_t j=0; j<nc; j++) {
-			for (size_t k=0; k<nl; k++) {
-				v[k] = a[j+k*nc];
-			}
-			std::vector<double> p = vquantile(v, probs, narm);
+			v.assign(a.begin()+j*nl, a.begin()+(j+1)*nl);
+			std::vector<double> p = vquantile_select(v, probs, narm);
 			for (size_t k=0; k<n; k++) {
 				b[j+(k*nc)] = p[k];
 			}
@@ -227,26 +328,6 @@ void unique_values_alt(std::vector<double> &d) {
 }
 
 
-void unique_values(std::vector<double> &d, bool narm) {
-	if (narm) {
-		d.erase(std::remove_if(d.begin(), d.end(),
-				[](const double& value) { return std::isnan(value); }), d.end());
-		std::set<double> u { d.begin(), d.end()};
-		std::copy(u.begin(), u.end(), d.begin());
-		d.erase(d.begin()+u.size(), d.end());
-	} else {
-		size_t s = d.size();
-		d.erase(std::remove_if(d.begin(), d.end(),
-				[](const double& value) { return std::isnan(value); }), d.end());
-		bool addNAN = s > d.size();
-		std::set<double> u { d.begin(), d.end()};
-		std::copy(u.begin(), u.end(), d.begin());
-		d.erase(d.begin()+u.size(), d.end());
-		if (addNAN) d.push_back(NAN);
-	}
-}
-
-
 std::vector<std::vector<double>> SpatRaster::unique(bool bylayer, bool narm, SpatOptions &opt) {
 
 	std::vector<std::vector<double>> out;
@@ -264,14 +345,26 @@ std::vector<std::vector<double>> SpatRaster::unique(bool bylayer, bool narm, Spa
 
 	if (nl == 1) bylayer = true;
 	if (bylayer) {
+		std::vector<bool> hr = hasRange();
+		std::vector<double> rmin = range_min();
+		std::vector<double> rmax = range_max();
+		size_t budget = 1048576;
+		std::vector<ValueTable> tabs;
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			tabs.push_back(hr[lyr] ? ValueTable(rmin[lyr], rmax[lyr], budget) : ValueTable(NAN, NAN, budget));
+		}
 		for (size_t i = 0; i < bs.n; i++) {
-			unsigned n = bs.nrows[i] * nc;
+			size_t n = bs.nrows[i] * nc;
 			std::vector<double> v;
 			readValues(v, bs.row[i], bs.nrows[i], 0, nc);
 			for (size_t lyr=0; lyr<nl; lyr++) {
-				unsigned off = lyr*n;
-				out[lyr].insert(out[lyr].end(), v.begin()+off, v.begin()+off+n);
-				unique_values(out[lyr], narm);
+				tabs[lyr].add(&v[lyr*n], n);
+			}
+		}
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			out[lyr] = tabs[lyr].values(false);
+			if ((!narm) && (tabs[lyr].nas > 0)) {
+				out[lyr].push_back(NAN);
 			}
 		}
 	} else {
@@ -426,6 +519,7 @@ SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOp
 	}
 	if (!z.readStart()) {
 		out.setError(z.getError());
+		readStop();
 		return(out);
 	}
 	opt.ncopies = 6;
@@ -502,6 +596,301 @@ SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOp
 }
 
 
+
+// area-weighted sum or mean by zone. The weights come from the cell areas,
+// so that on a lon/lat grid the cells near the poles count less
+SpatDataFrame SpatRaster::zonal_weighted_area(SpatRaster z, std::string fun, bool narm, SpatOptions &opt) {
+
+	SpatDataFrame out;
+	if ((fun != "sum") && (fun != "mean")) {
+		out.setError("not a valid function");
+		return(out);
+	}
+	if (!hasValues()) {
+		out.setError("SpatRaster has no values");
+		return(out);
+	}
+	if (!z.hasValues()) {
+		out.setError("zonal SpatRaster has no values");
+		return(out);
+	}
+	if (!compare_geom(z, false, true, opt.get_tolerance())) {
+		out.setError("dimensions and/or extent do not match");
+		return(out);
+	}
+	if (z.nlyr() > 1) {
+		SpatOptions xopt(opt);
+		std::vector<unsigned> lyr = {0};
+		z = z.subset(lyr, xopt);
+		out.addWarning("only the first zonal layer is used"); 
+	}
+	SpatCellArea ca(*this, "m", false, opt);
+	if (ca.error != "") {
+		out.setError(ca.error);
+		return(out);
+	}
+
+	size_t nl = nlyr();
+	std::vector<double> u = z.unique(true, true, opt)[0];
+	std::map<double, size_t> zi;
+	for (size_t i=0; i<u.size(); i++) zi[u[i]] = i;
+	std::vector<std::vector<double>> stats(nl, std::vector<double>(u.size(), 0));
+	std::vector<std::vector<double>> wsum(nl, std::vector<double>(u.size(), 0));
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!z.readStart()) {
+		out.setError(z.getError());
+		readStop();
+		return(out);
+	}
+	opt.ncopies = 6;
+	size_t nc = ncol();
+	BlockSize bs = getBlockSize(opt);
+	for (size_t i=0; i<bs.n; i++) {
+		std::vector<double> v, zv, a;
+		readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+		z.readValues(zv, bs.row[i], bs.nrows[i], 0, nc);
+		ca.cells(bs.row[i], bs.nrows[i], a);
+		size_t off = bs.nrows[i] * nc;
+		for (size_t j=0; j<off; j++) {
+			if (std::isnan(zv[j])) continue;
+			size_t k = zi[zv[j]];
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				double d = v[lyr * off + j];
+				if (narm && std::isnan(d)) continue;
+				stats[lyr][k] += d * a[j];
+				wsum[lyr][k] += a[j];
+			}
+		}
+	}
+	readStop();
+	z.readStop();
+
+	if (fun == "mean") {
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			for (size_t k=0; k<u.size(); k++) {
+				stats[lyr][k] = wsum[lyr][k] > 0 ? stats[lyr][k] / wsum[lyr][k] : NAN;
+			}
+		}
+	}
+	out.add_column(u, "zone");
+	std::vector<std::string> nms = getNames();
+	for (size_t i=0; i<nl; i++) {
+		out.add_column(stats[i], nms[i]);
+	}
+	return(out);
+}
+
+
+// approximate quantiles of all values of each layer, computed in a single
+// pass over the data. Layers with no probs are skipped
+std::vector<std::vector<double>> SpatRaster::layer_quantiles(std::vector<std::vector<double>> probs, SpatOptions &opt) {
+
+	size_t nl = nlyr();
+	std::vector<std::vector<double>> out(nl);
+	probs.resize(nl);
+	std::vector<QuantileSketch> sk(nl);
+	if (!readStart()) {
+		return(out);
+	}
+	BlockSize bs = getBlockSize(opt);
+	for (size_t i=0; i<bs.n; i++) {
+		std::vector<double> v;
+		readValues(v, bs.row[i], bs.nrows[i], 0, ncol());
+		size_t off = bs.nrows[i] * ncol();
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			if (probs[lyr].size() > 0) {
+				sk[lyr].add(&v[lyr * off], off);
+			}
+		}
+	}
+	readStop();
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		out[lyr] = sk[lyr].quantile(probs[lyr]);
+	}
+	return out;
+}
+
+
+SpatDataFrame SpatRaster::global_quantile(std::vector<double> probs, SpatOptions &opt) {
+
+	SpatDataFrame out;
+	if (!hasValues()) {
+		out.setError("SpatRaster has no values");
+		return(out);
+	}
+	for (size_t i=0; i<probs.size(); i++) {
+		if (std::isnan(probs[i]) || (probs[i] < 0) || (probs[i] > 1)) {
+			out.setError("probs must be between 0 and 1");
+			return(out);
+		}
+	}
+	size_t nl = nlyr();
+	std::vector<std::vector<double>> q = layer_quantiles(std::vector<std::vector<double>>(nl, probs), opt);
+	if (hasError()) {
+		out.setError(getError());
+		return out;
+	}
+	std::vector<std::string> nms = double_to_string(probs, "q");
+	for (size_t i=0; i<probs.size(); i++) {
+		std::vector<double> d(nl);
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			d[lyr] = q[lyr][i];
+		}
+		out.add_column(d, nms[i]);
+	}
+	return out;
+}
+
+
+// the sketches of the zones for the blocks handled by one thread. The zone
+// of a cell is found by binary search in the sorted zones; neighbouring
+// cells are mostly in the same zone, so the last zone is tried first
+struct ZoneQuantileJob {
+	const std::vector<double> *zones;
+	std::vector<double> v, zv;
+	std::vector<std::vector<QuantileSketch>> sk;
+};
+
+static void zone_quantile_block(ZoneQuantileJob &job) {
+	const std::vector<double> &u = *job.zones;
+	size_t nl = job.sk.size();
+	size_t off = job.zv.size();
+	size_t k = 0;
+	for (size_t j=0; j<off; j++) {
+		double z = job.zv[j];
+		if (std::isnan(z)) continue;
+		if (u[k] != z) {
+			size_t i = std::lower_bound(u.begin(), u.end(), z) - u.begin();
+			if ((i == u.size()) || (u[i] != z)) continue;
+			k = i;
+		}
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			job.sk[lyr][k].add(&job.v[lyr*off + j], 1);
+		}
+	}
+}
+
+#ifdef useGDAL
+static void zone_quantile_job(void *data) {
+	zone_quantile_block(*static_cast<ZoneQuantileJob*>(data));
+}
+#endif
+
+
+SpatDataFrame SpatRaster::zonal_quantile(SpatRaster z, std::vector<double> probs, SpatOptions &opt) {
+
+	SpatDataFrame out;
+	if (!hasValues()) {
+		out.setError("SpatRaster has no values");
+		return(out);
+	}
+	if (!z.hasValues()) {
+		out.setError("zonal SpatRaster has no values");
+		return(out);
+	}
+	if (!compare_geom(z, false, true, opt.get_tolerance())) {
+		out.setError("dimensions and/or extent do not match");
+		return(out);
+	}
+	for (size_t i=0; i<probs.size(); i++) {
+		if (std::isnan(probs[i]) || (probs[i] < 0) || (probs[i] > 1)) {
+			out.setError("probs must be between 0 and 1");
+			return(out);
+		}
+	}
+	if (z.nlyr() > 1) {
+		SpatOptions xopt(opt);
+		std::vector<unsigned> lyr = {0};
+		z = z.subset(lyr, xopt);
+		out.addWarning("only the first zonal layer is used"); 
+	}
+
+	size_t nl = nlyr();
+	std::vector<double> u = z.unique(true, true, opt)[0];
+	std::sort(u.begin(), u.end());
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!z.readStart()) {
+		out.setError(z.getError());
+		readStop();
+		return(out);
+	}
+	// blocks are read in batches, one block per thread. Each thread
+	// has its own sketches, that are merged at the end
+	size_t nthreads = 1;
+#ifdef useGDAL
+	nthreads = std::max((unsigned)1, gdal_read_threads());
+#endif
+	SpatOptions ops(opt);
+	ops.ncopies = 4 * nthreads;
+	BlockSize bs = getBlockSize(ops);
+	nthreads = std::min(nthreads, (size_t)bs.n);
+#ifdef useGDAL
+	CPLWorkerThreadPool pool;
+	if ((nthreads > 1) && (!pool.Setup(nthreads, NULL, NULL))) {
+		nthreads = 1;
+	}
+#endif
+	std::vector<ZoneQuantileJob> jobs(nthreads);
+	for (size_t t=0; t<nthreads; t++) {
+		jobs[t].zones = &u;
+		jobs[t].sk.resize(nl, std::vector<QuantileSketch>(u.size()));
+	}
+	for (size_t i=0; i<bs.n; i+=nthreads) {
+		size_t nb = std::min(nthreads, (size_t)bs.n - i);
+		for (size_t t=0; t<nb; t++) {
+			readValues(jobs[t].v, bs.row[i+t], bs.nrows[i+t], 0, ncol());
+			z.readValues(jobs[t].zv, bs.row[i+t], bs.nrows[i+t], 0, ncol());
+		}
+#ifdef useGDAL
+		if (nb > 1) {
+			for (size_t t=0; t<nb; t++) pool.SubmitJob(zone_quantile_job, &jobs[t]);
+			pool.WaitCompletion();
+		} else {
+			zone_quantile_block(jobs[0]);
+		}
+#else
+		zone_quantile_block(jobs[0]);
+#endif
+	}
+	std::vector<std::vector<QuantileSketch>> &sk = jobs[0].sk;
+	for (size_t t=1; t<nthreads; t++) {
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			for (size_t k=0; k<u.size(); k++) {
+				sk[lyr][k].merge(jobs[t].sk[lyr][k]);
+			}
+		}
+	}
+	readStop();
+	z.readStop();
+
+	out.add_column(u, "zone");
+	std::vector<std::string> nms = getNames();
+	std::vector<std::string> qnms = double_to_string(probs, "q");
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		std::vector<std::vector<double>> q(probs.size(), std::vector<double>(u.size()));
+		for (size_t k=0; k<u.size(); k++) {
+			std::vector<double> p = sk[lyr][k].quantile(probs);
+			for (size_t i=0; i<probs.size(); i++) {
+				q[i][k] = p[i];
+			}
+		}
+		for (size_t i=0; i<probs.size(); i++) {
+			std::string nm = nl > 1 ? nms[lyr] + "_" + qnms[i] : qnms[i];
+			out.add_column(q[i], nm);
+		}
+	}
+	return(out);
+}
+
+
 /*
 
 SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOptions &opt) {
@@ -551,6 +940,7 @@ SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOp
 	}
 	if (!z.readStart()) {
 		out.setError(z.getError());
+		readStop();
 		return(out);
 	}
 	opt.ncopies = 6;
@@ -61,92 +61,102 @@ bool SpatRaster::readStop() {
 
 // 2D BSQ
 void SpatRaster::readBlock2(std::vector<std::vector<double>> &v, BlockSize bs, unsigned i) {
-	std::vector<double> x;
-	readValues(x, bs.row[i], bs.nrows[i], 0, ncol());
-	v.resize(nlyr());
 	size_t off = bs.nrows[i] * ncol();
-	for (size_t i=0; i<nlyr(); i++) {
-		v[i] = std::vector<double>(x.begin()+(i*off), x.begin()+((i+1)*off));
+	size_t nl = nlyr();
+	v.resize(nl);
+	if (!hasValues()) {
+		for (size_t j=0; j<nl; j++) {
+			v[j].assign(off, NAN);
+		}
+		return;
+	}
+	// single layer sources are read directly into their vector
+	size_t lyr = 0;
+	std::vector<double> x;
+	for (size_t src=0; src<nsrc(); src++) {
+		size_t snl = source[src].nlyr;
+		double *d;
+		if (snl == 1) {
+			v[lyr].resize(off);
+			d = &v[lyr][0];
+		} else {
+			x.resize(off * snl);
+			d = &x[0];
+		}
+		if (source[src].memory) {
+			readChunkMEM(d, src, bs.row[i], bs.nrows[i], 0, ncol(), 1, off);
+		} else {
+			#ifdef useGDAL
+			if (source[src].multidim) {
+				readValuesMulti(d, src, bs.row[i], bs.nrows[i], 0, ncol(), 1, off);
+			} else {
+				std::string errmsg;
+				if (!readChunkGDALbuffer(d, src, bs.row[i], bs.nrows[i], 0, ncol(), 1, off, errmsg)) {
+					setError(errmsg);
+				}
+			}
+			#endif // useGDAL
+		}
+		if (snl > 1) {
+			for (size_t j=0; j<snl; j++) {
+				v[lyr+j].assign(x.begin()+(j*off), x.begin()+((j+1)*off));
+			}
+		}
+		lyr += snl;
 	}
 }
 
 // BIP
 std::vector<double> SpatRaster::readBlockIP(BlockSize bs, unsigned i) {
-	std::vector<double> x; 
-	readValues(x, bs.row[i], bs.nrows[i], 0, ncol());
-	std::vector<double> v(x.size());
-	size_t off = bs.nrows[i] * ncol();
-	size_t nl = nlyr();
-	for (size_t i=0; i<nl; i++) {
-		std::vector<double> lyr = std::vector<double>(x.begin()+(i*off), x.begin()+((i+1)*off));
-		for (size_t j=0; j<off; j++){
-			size_t jj = j * nl + i;
-			v[jj] = lyr[j];
-		}
+	std::vector<double> v(bs.nrows[i] * ncol() * nlyr());
+	if (!v.empty()) {
+		readValuesBuffer(&v[0], bs.row[i], bs.nrows[i], 0, ncol(), true);
 	}
 	return(v);
 }
 
 
-void SpatRaster::readChunkMEM(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols){
+// value of layer k and cell j is written to out[k*bandstride + j*cellstride]
+void SpatRaster::readChunkMEM(double *out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols, size_t cellstride, size_t bandstride){
 
 	size_t nl = source[src].nlyr;
-
+	const double *v = source[src].values.data();
+	size_t nc, ncells;
+	
 	if (source[src].hasWindow) {
 		row += source[src].window.off_row;
 		col += source[src].window.off_col;
-		size_t endrow = row + nrows;
-		size_t endcol = col + ncols;
-		size_t nc = source[src].window.full_ncol;
-		double ncells = source[src].window.full_nrow * nc;
+		nc = source[src].window.full_ncol;
+		ncells = source[src].window.full_nrow * nc;
+	} else {
+		nc = ncol();
+		ncells = ncell();
+	}
 
+	size_t endrow = row + nrows;
+	if (cellstride == 1) {
 		for (size_t lyr=0; lyr < nl; lyr++) {
-			size_t add = ncells * lyr;
-			for (size_t r = row; r < endrow; r++) {
-				size_t off = add + r * nc;
-				out.insert(out.end(), source[src].values.begin()+off+col, source[src].values.begin()+off+endcol);
-			}
-		}
-			/*
-			else if (source[0].window.expanded) {
-				unsigned add = ncells * lyr;
-				std::vector<double> v1(source[0].window.expand[0] * ncols, NAN);
-				out.insert(out.end(), v1.begin(), v1.end());
-				v1.resize(source[0].window.expand[1], NAN);
-				std::vector<double> v2(source[0].window.expand[2], NAN);
-				for (size_t r = wrow; r < endrow; r++) {
-					unsigned a = add + r * source[0].window.full_ncol;
-					out.insert(out.end(), v1.begin(), v1.end());
-					out.insert(out.end(), source[src].values.begin()+a+wcol, source[src].values.begin()+a+endcol);
-					out.insert(out.end(), v2.begin(), v2.end());
-				}
-				v1.resize(source[0].window.expand[3] * ncols, NAN);
-				out.insert(out.end(), v1.begin(), v1.end());
-			}
-			*/
-
-	} else { //	no window
-		size_t nc = ncol();
-		if (row==0 && nrows==nrow() && col==0 && ncols==nc) {
-			out.insert(out.end(), source[src].values.begin(), source[src].values.end());
-		} else {
-			double ncells = ncell();
+			double *d = out + lyr * bandstride;
 			if (col==0 && ncols==nc) {
-				for (size_t lyr=0; lyr < nl; lyr++) {
-					size_t add = ncells * lyr;
-					size_t a = add + row * nc;
-					size_t b = a + nrows * nc;
-					out.insert(out.end(), source[src].values.begin()+a, source[src].values.begin()+b);
-				}
+				const double *a = v + ncells * lyr + row * nc;
+				std::copy(a, a + nrows * nc, d);
 			} else {
-				size_t endrow = row + nrows;
-				size_t endcol = col + ncols;
-				for (size_t lyr=0; lyr < nl; lyr++) {
-					size_t add = ncells * lyr;
-					for (size_t r = row; r < endrow; r++) {
-						size_t a = add + r * nc;
-						out.insert(out.end(), source[src].values.begin()+a+col, source[src].values.begin()+a+endcol);
-					}
+				size_t add = ncells * lyr;
+				for (size_t r = row; r < endrow; r++) {
+					const double *a = v + add + r * nc + col;
+					d = std::copy(a, a + ncols, d);
+				}
+			}
+		}
+	} else {
+		for (size_t lyr=0; lyr < nl; lyr++) {
+			double *d = out + lyr * bandstride;
+			size_t add = ncells * lyr;
+			for (size_t r = row; r < endrow; r++) {
+				const double *a = v + add + r * nc + col;
+				for (size_t c = 0; c < ncols; c++) {
+					*d = a[c];
+					d += cellstride;
 				}
 			}
 		}
@@ -156,114 +166,81 @@ void SpatRaster::readChunkMEM(std::vector<double> &out, size_t src, size_t row,
 
 
 std::vector<double> SpatRaster::readValuesR(size_t row, size_t nrows, size_t col, size_t ncols){
-
 	std::vector<double> out;
+	readValues(out, row, nrows, col, ncols);
+	return out;
+}
+
 
+void SpatRaster::readValues(std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols){
 	if (((row + nrows) > nrow()) || ((col + ncols) > ncol())) {
 		setError("invalid rows/columns");
-		return out;
+		return;
 	}
-
-
-	//row = std::min(std::max(size_t(0), row), nrow()-1);
-	//col = std::min(std::max(size_t(0), col), ncol()-1);
-	//nrows = std::max(size_t(1), std::min(nrows, nrow()-row));
-	//ncols = std::max(size_t(1), std::min(ncols, ncol()-col));
 	if ((nrows==0) | (ncols==0)) {
-		return out;
-	}
-
-	if (!hasValues()) {
-		out.resize(nrows * ncols * nlyr(), NAN);
-		addWarning("raster has no values");
-		return out; // or NAs?
-	}
-
-
-	unsigned n = nsrc();
-
-	out.reserve(nrows * ncols * nlyr());
-	for (size_t src=0; src<n; src++) {
-		if (source[src].memory) {
-			readChunkMEM(out, src, row, nrows, col, ncols);
-		} else {
-			// read from file
-			#ifdef useGDAL
-
-/* 
-				if (source[0].window.expanded) {
-					std::vector<double> gout;
-					readChunkGDAL(gout, src, source[0].window.off_row, nrows, source[0].window.off_col, ncols);
-
-					size_t rrow = row + source[0].window.off_row;
-					size_t rcol = col + source[0].window.off_col;
-					unsigned endrow = rrow + nrows;
-					unsigned endcol = rcol + ncols;
-					unsigned ncells = source[0].window.full_nrow * source[0].window.full_ncol;
-					unsigned nl = source[src].nlyr;
-
-					for (size_t lyr=0; lyr < nl; lyr++) {
-						unsigned add = ncells * lyr;
-						std::vector<double> v1(source[0].window.expand[0] * ncols, NAN);
-						out.insert(out.end(), v1.begin(), v1.end());
-						v1.resize(source[0].window.expand[1], NAN);
-						std::vector<double> v2(source[0].window.expand[2], NAN);
-						for (size_t r = rrow; r < endrow; r++) {
-							unsigned a = add + r * source[0].window.full_ncol;
-							out.insert(out.end(), v1.begin(), v1.end());
-							out.insert(out.end(), gout.begin()+a+rcol, gout.begin()+a+endcol);
-							out.insert(out.end(), v2.begin(), v2.end());
-						}
-						v1.resize(source[0].window.expand[3] * ncols, NAN);
-						out.insert(out.end(), v1.begin(), v1.end());
-					}
-				}
-				*/
-			readChunkGDAL(out, src, row, nrows, col, ncols);
-			#endif // useGDAL
-		}
+		return;
 	}
-	return out;
+	out.resize(0);
+	out.resize(nrows * ncols * nlyr());
+	readValuesBuffer(&out[0], row, nrows, col, ncols, false);
 }
 
-void SpatRaster::readValues(std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols){
+
+// read into a buffer that has room for nrows * ncols * nlyr values, 
+// either band sequential (bip=false) or band interleaved by cell (bip=true)
+bool SpatRaster::readValuesBuffer(double *out, size_t row, size_t nrows, size_t col, size_t ncols, bool bip){
 
 	if (((row + nrows) > nrow()) || ((col + ncols) > ncol())) {
 		setError("invalid rows/columns");
-		return;
+		return false;
 	}
 
-	if ((nrows==0) | (ncols==0)) {
-		return;
+	size_t ncells = nrows * ncols;
+	if (ncells == 0) {
+		return true;
 	}
 
+	size_t nl = nlyr();
 	if (!hasValues()) {
-		out.resize(nrows * ncols * nlyr(), NAN);
+		std::fill(out, out + ncells * nl, NAN);
 		addWarning("raster has no values");
-		return; // or NAs?
+		return true; // or NAs?
 	}
 
+	size_t cellstride = bip ? nl : 1;
+	size_t bandstride = bip ? 1 : ncells;
 
+	// each source is read into its own slice of "out"
 	unsigned n = nsrc();
-	out.resize(0);
-	out.reserve(nrows * ncols * nlyr());
-
+	std::vector<unsigned> gsrc;
+	std::vector<size_t> goff;
+	size_t lyr = 0;
 	for (size_t src=0; src<n; src++) {
+		size_t off = lyr * bandstride;
 		if (source[src].memory) {
-			readChunkMEM(out, src, row, nrows, col, ncols);
+			readChunkMEM(out + off, src, row, nrows, col, ncols, cellstride, bandstride);
+		} else if (source[src].multidim) {
+			readValuesMulti(out + off, src, row, nrows, col, ncols, cellstride, bandstride);
 		} else {
-			// read from file
-			#ifdef useGDAL
-			readChunkGDAL(out, src, row, nrows, col, ncols);
-			#endif // useGDAL
+			gsrc.push_back(src);
+			goff.push_back(off);
 		}
+		lyr += source[src].nlyr;
 	}
-	return;
+
+	#ifdef useGDAL
+	if (!gsrc.empty()) {
+		return readChunksGDAL(out, gsrc, goff, row, nrows, col, ncols, cellstride, bandstride);
+	}
+	#endif // useGDAL
+	return true;
 }
 
 
 
-bool SpatRaster::readAll() {
+// With opt.memmap, uncompressed double precision files are mapped into
+// memory (read-only) instead of read; their values are only copied if changed
+bool SpatRaster::readAll(SpatOptions &opt) {
 	if (!hasValues()) {
 		return true; 
 	}
@@ -273,7 +250,17 @@ bool SpatRaster::readAll() {
 	size_t n = nsrc();
 	for (size_t src=0; src<n; src++) {
 		if (!source[src].memory) {
-			readChunkGDAL(source[src].values, src, row, nrows, col, ncols);
+			bool mapped = false;
+			#ifdef useGDAL
+			if (opt.memmap) {
+				mapped = mapValuesGDAL(src);
+			}
+			#endif
+			if (!mapped) {
+				std::vector<double> v;
+				readChunkGDAL(v, src, row, nrows, col, ncols);
+				source[src].values = std::move(v);
+			}
 			source[src].memory = true;
 			source[src].filename = "";
 			std::iota(source[src].layers.begin(), source[src].layers.end(), 0);			
@@ -332,8 +319,9 @@ std::vector<double> SpatRaster::getValues(long lyr, SpatOptions &opt) {
 		std::vector<unsigned> sl = findLyr(lyr);
 		unsigned src=sl[0];
 		if (source[src].memory) {
-			size_t start = sl[1] * ncell();
-			out = std::vector<double>(source[src].values.begin()+start, source[src].values.begin()+start+ncell());
+			size_t nc = ncell();
+			size_t start = sl[1] * nc;
+			out = std::vector<double>(source[src].values.begin()+start, source[src].values.begin()+start+nc);
 		} else {
 			#ifdef useGDAL
 			out = readValuesGDAL(src, 0, nrow(), 0, ncol(), sl[1]);
@@ -31,12 +31,15 @@
 #include "spatTime.h"
 #include "recycle.h"
 #include "gdalio.h"
+#include "gdal_pool.h"
 
 //#include "NA.h"
 
 #include "gdal_priv.h"
 #include "cpl_conv.h" // for CPLMalloc()
 #include "cpl_string.h"
+#include "cpl_multiproc.h"
+#include "cpl_worker_thread_pool.h"
 #include "ogr_spatialref.h"
 
 #include "gdal_rat.h"
@@ -938,7 +941,7 @@ bool SpatRaster::constructFromFile(std::string fname, std::vector<int> subds, st
 
 
 bool SpatRaster::readStartGDAL(unsigned src) {
-    GDALDataset *poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, source[src].open_ops);
+    GDALDataset *poDataset = openGDALpooled(source[src].filename, source[src].open_ops);
 	if( poDataset == NULL )  {
 		setError("cannot read from " + source[src].filename );
 		return false;
@@ -950,7 +953,8 @@ bool SpatRaster::readStartGDAL(unsigned src) {
 
 bool SpatRaster::readStopGDAL(unsigned src) {
 	if (source[src].gdalconnection != NULL) {
-		GDALClose( (GDALDatasetH) source[src].gdalconnection);
+		closeGDALpooled(source[src].gdalconnection);
+		source[src].gdalconnection = NULL;
 	}
 	source[src].open_read = false;
 	return true;
@@ -958,85 +962,127 @@ bool SpatRaster::readStopGDAL(unsigned src) {
 
 
 
-void NAso(std::vector<double> &d, size_t n, const std::vector<double> &flags, const std::vector<double> &scale, const std::vector<double>  &offset, const std::vector<bool> &haveso, const bool haveUserNAflag, const double userNAflag){
-	size_t nl = flags.size();
+// decode the values of a layer in a single pass: file NA flag to NaN, scale and offset,
+// user NA flag to NaN. The options are template arguments such that the loop 
+// has no branches and can be vectorized by the compiler
+template <bool FLAG, bool LOWFLAG, bool SO, bool USERFLAG>
+void decode_layer(double *b, size_t n, size_t cellstride, const double flag, const double scale, const double offset, const double userflag) {
 	double na = NAN;
+	if (cellstride == 1) {
+		for (size_t j=0; j<n; j++) {
+			double v = b[j];
+			if (FLAG) v = (LOWFLAG ? (v < flag) : (v == flag)) ? na : v;
+			if (SO) v = v * scale + offset;
+			if (USERFLAG) v = (v == userflag) ? na : v;
+			b[j] = v;
+		}
+	} else {
+		size_t end = n * cellstride;
+		for (size_t j=0; j<end; j+=cellstride) {
+			double v = b[j];
+			if (FLAG) v = (LOWFLAG ? (v < flag) : (v == flag)) ? na : v;
+			if (SO) v = v * scale + offset;
+			if (USERFLAG) v = (v == userflag) ? na : v;
+			b[j] = v;
+		}
+	}
+}
 
-	for (size_t i=0; i<nl; i++) {
-		size_t start = i*n;
-		if (!std::isnan(flags[i])) {
-			double flag = flags[i];
-			// a hack to avoid problems with double derived from float - double comparison
-			if (flag < -3.4e+37) {
-				flag = -3.4e+37;
-				for (size_t j=start; j<(start+n); j++) {
-					if (d[j] < flag) {
-						d[j] = NAN;
-					} 
-				}
-			} else {
-				std::replace(d.begin()+start, d.begin()+start+n, flag, na); 
-			}
+template <bool FLAG, bool LOWFLAG>
+void decode_layer_so(double *b, size_t n, size_t cellstride, const double flag, bool so, const double scale, const double offset, bool user, const double userflag) {
+	if (so) {
+		if (user) {
+			decode_layer<FLAG, LOWFLAG, true, true>(b, n, cellstride, flag, scale, offset, userflag);
+		} else {
+			decode_layer<FLAG, LOWFLAG, true, false>(b, n, cellstride, flag, scale, offset, userflag);
 		}
-		if (haveso[i]) {
-			for (size_t j=start; j<(start+n); j++) {
-				d[j] = d[j] * scale[i] + offset[i];
-			}
+	} else {
+		if (user) {
+			decode_layer<FLAG, LOWFLAG, false, true>(b, n, cellstride, flag, scale, offset, userflag);
+		} else {
+			decode_layer<FLAG, LOWFLAG, false, false>(b, n, cellstride, flag, scale, offset, userflag);
 		}
 	}
-	if (haveUserNAflag) {
-		std::replace(d.begin(), d.end(), userNAflag, na); 
+}
+
+
+// value of layer i and cell j is d[i*bandstride + j*cellstride]
+void NAso(double *d, size_t n, size_t cellstride, size_t bandstride, const std::vector<double> &flags, const std::vector<double> &scale, const std::vector<double>  &offset, const std::vector<bool> &haveso, const bool haveUserNAflag, const double userNAflag){
+	size_t nl = flags.size();
+	bool user = haveUserNAflag && (!std::isnan(userNAflag));
+	for (size_t i=0; i<nl; i++) {
+		double *b = d + i * bandstride;
+		double flag = flags[i];
+		if (std::isnan(flag)) {
+			if (haveso[i] || user) {
+				decode_layer_so<false, false>(b, n, cellstride, flag, haveso[i], scale[i], offset[i], user, userNAflag);
+			}
+		} else if (flag < -3.4e+37) {
+			// a hack to avoid problems with double derived from float - double comparison
+			decode_layer_so<true, true>(b, n, cellstride, -3.4e+37, haveso[i], scale[i], offset[i], user, userNAflag);
+		} else {
+			decode_layer_so<true, false>(b, n, cellstride, flag, haveso[i], scale[i], offset[i], user, userNAflag);
+		}
 	}
 }
 
+void NAso(std::vector<double> &d, size_t n, const std::vector<double> &flags, const std::vector<double> &scale, const std::vector<double>  &offset, const std::vector<bool> &haveso, const bool haveUserNAflag, const double userNAflag){
+	if (d.empty()) return;
+	NAso(&d[0], n, 1, n, flags, scale, offset, haveso, haveUserNAflag, userNAflag);
+}
 
-void vflip(std::vector<double> &v, const size_t &ncell, const size_t &nrows, const size_t &ncols, const size_t &nl) {
+
+void vflip(double *v, const size_t &ncell, const size_t &nrows, const size_t &ncols, const size_t &nl, size_t cellstride, size_t bandstride) {
+	size_t nr = nrows/2;
 	for (size_t i=0; i<nl; i++) {
-		size_t off = i*ncell;
-		size_t nr = nrows/2;
+		double *b = v + i * bandstride;
 		for (size_t j=0; j<nr; j++) {
-			size_t d1 = off + j * ncols;
-			size_t d2 = off + (nrows-j-1) * ncols;
-			std::vector<double> r(v.begin()+d1, v.begin()+d1+ncols);
-			std::copy(v.begin()+d2, v.begin()+d2+ncols, v.begin()+d1);
-			std::copy(r.begin(), r.end(), v.begin()+d2);
+			double *d1 = b + j * ncols * cellstride;
+			double *d2 = b + (nrows-j-1) * ncols * cellstride;
+			if (cellstride == 1) {
+				std::swap_ranges(d1, d1+ncols, d2);
+			} else {
+				for (size_t k=0; k<(ncols*cellstride); k+=cellstride) {
+					std::swap(d1[k], d2[k]);
+				}
+			}
 		}
 	}
 }
 
+void vflip(std::vector<double> &v, const size_t &ncell, const size_t &nrows, const size_t &ncols, const size_t &nl) {
+	if (v.empty()) return;
+	vflip(&v[0], ncell, nrows, ncols, nl, 1, ncell);
+}
 
-void SpatRaster::readChunkGDAL(std::vector<double> &data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols) {
 
+// reads into a buffer that has room for ncols * nrows * nlyr values. 
+// The value of layer i and cell j is written to data[i*bandstride + j*cellstride]; 
+// that is, use (1, ncell) for band-sequential and (nlyr, 1) for band-interleaved values.
+// It does not set errors or warnings, such that it can be used in a worker thread
+bool SpatRaster::readChunkGDALbuffer(double *data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols, size_t cellstride, size_t bandstride, std::string &errmsg) {
 
 	if (source[src].flipped) {
 		row = nrow() - row - nrows;
 	}
 
-
-	if (source[src].multidim) {
-		readValuesMulti(data, src, row, nrows, col, ncols);
-		return;
-	}
-
 	if (source[src].hasWindow) { // ignoring the expanded case.
 		row = row + source[src].window.off_row;
 		col = col + source[src].window.off_col;
 	}
 
-	std::vector<double> errout;
 	if (source[src].rotated) {
-		setError("cannot read from rotated files. First use 'rectify'");
-		return;
+		errmsg = "cannot read from rotated files. First use 'rectify'";
+		return false;
 	}
 
 	if (!source[src].open_read) {
-		setError("the file is not open for reading");
-		return;
+		errmsg = "the file is not open for reading";
+		return false;
 	}
 
-	unsigned ncell = ncols * nrows;
+	size_t ncell = ncols * nrows;
 	unsigned nl = source[src].nlyr;
-	std::vector<double> out(ncell * nl);
 	int hasNA;
 	std::vector<double> naflags(nl, NAN);
 	CPLErr err = CE_None;
@@ -1049,48 +1095,275 @@ void SpatRaster::readChunkGDAL(std::vector<double> &data, unsigned src, size_t r
 		}
 	}
 
+	GSpacing pixelspace = cellstride * sizeof(double);
+	GSpacing linespace = pixelspace * ncols;
+	GSpacing bandspace = bandstride * sizeof(double);
 	if (panBandMap.size() > 0) {
-		err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, &out[0], ncols, nrows, GDT_Float64, nl, &panBandMap[0], 0, 0, 0, NULL);
+		err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, data, ncols, nrows, GDT_Float64, nl, &panBandMap[0], pixelspace, linespace, bandspace, NULL);
 	} else {
-		err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, &out[0], ncols, nrows, GDT_Float64, nl, NULL, 0, 0, 0, NULL);
+		err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, data, ncols, nrows, GDT_Float64, nl, NULL, pixelspace, linespace, bandspace, NULL);
+	}
+
+	if (err != CE_None ) {
+		errmsg = "cannot read values";
+		return false;
 	}
 
 	GDALRasterBand  *poBand;
-	if (err == CE_None ) { 
-		for (size_t i=0; i<nl; i++) {
-			poBand = source[src].gdalconnection->GetRasterBand(source[src].layers[i]+1);
-			double naflag = poBand->GetNoDataValue(&hasNA);
-			if (hasNA)  naflags[i] = naflag;
+	for (size_t i=0; i<nl; i++) {
+		poBand = source[src].gdalconnection->GetRasterBand(source[src].layers[i]+1);
+		double naflag = poBand->GetNoDataValue(&hasNA);
+		if (hasNA)  naflags[i] = naflag;
+	}
+	NAso(data, ncell, cellstride, bandstride, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
+
+	if (source[src].flipped) {
+		vflip(data, ncell, nrows, ncols, nl, cellstride, bandstride);
+	}
+	return true;
+}
+
+
+void SpatRaster::readChunkGDAL(std::vector<double> &data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols) {
+
+	size_t off = data.size();
+	size_t ncell = ncols * nrows;
+	data.resize(off + ncell * source[src].nlyr);
+	if (source[src].multidim) {
+		if (!readValuesMulti(&data[off], src, row, nrows, col, ncols, 1, ncell)) {
+			data.resize(off);
 		}
-		NAso(out, ncell, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
+		return;
+	}
+	std::string errmsg;
+	if (!readChunkGDALbuffer(&data[off], src, row, nrows, col, ncols, 1, ncell, errmsg)) {
+		data.resize(off);
+		setError(errmsg);
 	}
+}
 
-/*
-	for (size_t i=0; i < nl; i++) {
-		cell = ncell * i;
-		poBand = source[src].gdalconnection->GetRasterBand(source[src].layers[i] + 1);
+
+static bool little_endian() {
+	uint16_t x = 1;
+	return *((uint8_t *) &x) == 1;
+}
+
+// byte offset of the values of each band in an uncompressed GeoTIFF with
+// double precision values in native byte order. Returns false unless all
+// strips of a band are stored one after the other
+static bool tiff_band_offsets(GDALDataset *poDS, const std::vector<unsigned> &bands, std::vector<size_t> &offsets) {
+	const char *cmp = poDS->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE");
+	if ((cmp != NULL) && (!EQUAL(cmp, "NONE"))) return false;
+	char head[2];
+	std::ifstream f(poDS->GetDescription(), std::ios::binary);
+	if (!f.read(head, 2)) return false;
+	if (((head[0] == 'I') && (head[1] == 'I')) != little_endian()) return false;
+
+	size_t nc = poDS->GetRasterXSize();
+	size_t nr = poDS->GetRasterYSize();
+	for (size_t i=0; i<bands.size(); i++) {
+		GDALRasterBand *poBand = poDS->GetRasterBand(bands[i]+1);
+		int bx, by;
+		poBand->GetBlockSize(&bx, &by);
+		if ((size_t) bx != nc) return false; // tiled
+		size_t nb = (nr + by - 1) / by;
+		size_t expect = 0;
+		for (size_t b=0; b<nb; b++) {
+			const char *off = poBand->GetMetadataItem(("BLOCK_OFFSET_0_" + std::to_string(b)).c_str(), "TIFF");
+			const char *sz = poBand->GetMetadataItem(("BLOCK_SIZE_0_" + std::to_string(b)).c_str(), "TIFF");
+			if ((off == NULL) || (sz == NULL)) return false;
+			size_t o = std::stoull(off);
+			size_t rows = std::min((size_t) by, nr - b * by);
+			if ((o == 0) || (std::stoull(sz) != (rows * nc * sizeof(double)))) return false;
+			if (b == 0) {
+				offsets.push_back(o);
+			} else if (o != expect) {
+				return false;
+			}
+			expect = o + rows * nc * sizeof(double);
+		}
+	}
+	return true;
+}
+
+// byte offset of the values of each band in a band-sequential ENVI file
+// with double precision values in native byte order
+static bool envi_band_offsets(GDALDataset *poDS, const std::vector<unsigned> &bands, std::vector<size_t> &offsets) {
+	char **files = poDS->GetFileList();
+	std::string hdr;
+	for (int i=0; i<CSLCount(files); i++) {
+		std::string f = files[i];
+		std::string ext = getFileExt(f);
+		lowercase(ext);
+		if (ext == ".hdr") hdr = f;
+	}
+	CSLDestroy(files);
+	if (hdr.empty()) return false;
+	std::ifstream f(hdr);
+	std::string line;
+	size_t header = 0;
+	bool bsq = false, order = false;
+	while (std::getline(f, line)) {
+		size_t eq = line.find('=');
+		if (eq == std::string::npos) continue;
+		std::string key = line.substr(0, eq);
+		std::string value = line.substr(eq+1);
+		lrtrim(key);
+		lrtrim(value);
+		lowercase(key);
+		lowercase(value);
+		if (key == "header offset") {
+			header = std::stoull(value);
+		} else if (key == "interleave") {
+			bsq = value == "bsq";
+		} else if (key == "byte order") {
+			order = (value == "0") == little_endian();
+		} else if ((key == "file compression") && (value != "0")) {
+			return false;
+		}
+	}
+	if (!(bsq && order)) return false;
+	size_t bandsize = poDS->GetRasterXSize() * poDS->GetRasterYSize() * sizeof(double);
+	for (size_t i=0; i<bands.size(); i++) {
+		offsets.push_back(header + bands[i] * bandsize);
+	}
+	return true;
+}
+
+
+// map the values of a source that is opened for reading into memory.
+// That is only possible if they are stored as double precision numbers in
+// the order used in memory, and do not need to be decoded
+bool SpatRaster::mapValuesGDAL(unsigned src) {
+	SpatRasterSource &s = source[src];
+	if (s.multidim || s.hasWindow || s.flipped || s.rotated || (!s.open_read)) return false;
+	if (s.hasNAflag && (!std::isnan(s.NAflag))) return false;
+	GDALDataset *poDS = s.gdalconnection;
+	if (poDS == NULL) return false;
+	std::string fname = poDS->GetDescription();
+	if (!file_exists(fname)) return false;
+
+	for (size_t i=0; i<s.nlyr; i++) {
+		if (s.has_scale_offset[i]) return false;
+		GDALRasterBand *poBand = poDS->GetRasterBand(s.layers[i]+1);
+		if (poBand->GetRasterDataType() != GDT_Float64) return false;
+		int hasNA;
 		double naflag = poBand->GetNoDataValue(&hasNA);
-		if (!hasNA) { naflag = NAN; }
-		GDALDataType gdtype = poBand->GetRasterDataType();
-		if (gdtype == GDT_Float64) {
-			err = poBand->RasterIO(GF_Read, col, row, ncols, nrows, &out[cell], ncols, nrows, gdtype, 0, 0);
-			if (err != CE_None ) { break; }
-			set_NA(out, naflag);
+		if (hasNA && (!std::isnan(naflag))) return false;
+	}
+
+	std::vector<size_t> offsets;
+	std::string driver = poDS->GetDriver()->GetDescription();
+	bool ok = false;
+	try {
+		if (driver == "GTiff") {
+			ok = tiff_band_offsets(poDS, s.layers, offsets);
+		} else if (driver == "ENVI") {
+			ok = envi_band_offsets(poDS, s.layers, offsets);
 		}
+	} catch(...) {
+		ok = false;
 	}
-*/
-	if (err != CE_None ) {
-		setError("cannot read values");
-		return;
+	if (!ok) return false;
+	// the layers must be contiguous in the file
+	size_t nc = ncell();
+	for (size_t i=1; i<offsets.size(); i++) {
+		if (offsets[i] != (offsets[i-1] + nc * sizeof(double))) return false;
 	}
+	return s.values.map_file(fname, offsets[0], nc * s.nlyr);
+}
 
-	if (source[src].flipped) {
-		vflip(out, ncell, nrows, ncols, nl);
+
+// the number of threads used to read from multiple files at once.
+// Set with the GDAL configuration option GDAL_NUM_THREADS (default is 1)
+unsigned gdal_read_threads() {
+	const char* nt = CPLGetConfigOption("GDAL_NUM_THREADS", "1");
+	int n;
+	if (EQUAL(nt, "ALL_CPUS")) {
+		n = CPLGetNumCPUs();
+	} else {
+		n = atoi(nt);
 	}
-	data.insert(data.end(), out.begin(), out.end());
+	return n < 1 ? 1 : n;
 }
 
 
+struct GDALChunkJob {
+	SpatRaster *r;
+	double *data;
+	unsigned src;
+	size_t row, col;
+	unsigned nrows, ncols;
+	size_t cellstride, bandstride;
+	bool success;
+	std::string msg;
+};
+
+static void readChunkGDALjob(void *p) {
+	GDALChunkJob *job = static_cast<GDALChunkJob*>(p);
+	// the default error handler calls R, which is not allowed from this thread
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+	job->success = job->r->readChunkGDALbuffer(job->data, job->src, job->row, job->nrows, job->col, job->ncols, job->cellstride, job->bandstride, job->msg);
+	if ((!job->success) && (CPLGetLastErrorMsg()[0] != '\0')) {
+		job->msg += " (" + std::string(CPLGetLastErrorMsg()) + ")";
+	}
+	CPLPopErrorHandler();
+}
+
+
+// read from several (open) file sources, each into its own slice of "data"
+bool SpatRaster::readChunksGDAL(double *data, const std::vector<unsigned> &srcs, const std::vector<size_t> &offsets, size_t row, unsigned nrows, size_t col, unsigned ncols, size_t cellstride, size_t bandstride) {
+
+	size_t n = srcs.size();
+	unsigned nthreads = std::min((size_t)gdal_read_threads(), n);
+
+	if (nthreads < 2) {
+		std::string errmsg;
+		for (size_t i=0; i<n; i++) {
+			if (!readChunkGDALbuffer(data + offsets[i], srcs[i], row, nrows, col, ncols, cellstride, bandstride, errmsg)) {
+				setError(errmsg);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// each source has its own GDALDataset, opened by readStart, 
+	// so each job uses a different handle
+	std::vector<GDALChunkJob> jobs(n);
+	for (size_t i=0; i<n; i++) {
+		jobs[i].r = this;
+		jobs[i].data = data + offsets[i];
+		jobs[i].src = srcs[i];
+		jobs[i].row = row;
+		jobs[i].nrows = nrows;
+		jobs[i].col = col;
+		jobs[i].ncols = ncols;
+		jobs[i].cellstride = cellstride;
+		jobs[i].bandstride = bandstride;
+		jobs[i].success = false;
+		jobs[i].msg = "cannot read values";
+	}
+
+	CPLWorkerThreadPool pool;
+	if (!pool.Setup(nthreads, NULL, NULL)) {
+		setError("cannot start threads for reading");
+		return false;
+	}
+	for (size_t i=0; i<n; i++) {
+		pool.SubmitJob(readChunkGDALjob, &jobs[i]);
+	}
+	pool.WaitCompletion();
+
+	for (size_t i=0; i<n; i++) {
+		if (!jobs[i].success) {
+			setError(jobs[i].msg);
+			return false;
+		}
+	}
+	return true;
+}
+
 
 
 std::vector<double> SpatRaster::readValuesGDAL(unsigned src, size_t row, size_t nrows, size_t col, size_t ncols, int lyr) {
@@ -1109,7 +1382,7 @@ std::vector<double> SpatRaster::readValuesGDAL(unsigned src, size_t row, size_t
 		col = col + source[src].window.off_col;
 	}
 
-    GDALDataset *poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, source[src].open_ops);
+    GDALDataset *poDataset = openGDALpooled(source[src].filename, source[src].open_ops);
 	GDALRasterBand *poBand;
 
     if( poDataset == NULL )  {
@@ -1151,7 +1424,7 @@ std::vector<double> SpatRaster::readValuesGDAL(unsigned src, size_t row, size_t
 		NAso(out, ncell, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
 	}
 
-	GDALClose((GDALDatasetH) poDataset);
+	closeGDALpooled(poDataset);
 	if (err != CE_None ) {
 		setError("cannot read values");
 		return errout;
@@ -1181,7 +1454,7 @@ std::vector<double> SpatRaster::readGDALsample(unsigned src, size_t srows, size_
 		scols = std::min(scols, ncols);
 	} 
 
-    GDALDataset *poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, source[src].open_ops);
+    GDALDataset *poDataset = openGDALpooled(source[src].filename, source[src].open_ops);
     if( poDataset == NULL )  {
 		setError("no data");
 		return errout;
@@ -1238,7 +1511,7 @@ std::vector<double> SpatRaster::readGDALsample(unsigned src, size_t srows, size_
 	}
 */
 
-	GDALClose((GDALDatasetH) poDataset);
+	closeGDALpooled(poDataset);
 	if (err != CE_None ) {
 		setError("cannot read values");
 		return errout;
@@ -1260,8 +1533,11 @@ std::vector<std::vector<double>> SpatRaster::readRowColGDAL(unsigned src, std::v
 		setError("cannot read from rotated files. First use 'rectify'");
 		return errout;
 	}
+	if (rows.empty()) {
+		return std::vector<std::vector<double>>(source[src].layers.size());
+	}
 
-    GDALDataset *poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, source[src].open_ops);
+    GDALDataset *poDataset = openGDALpooled(source[src].filename, source[src].open_ops);
 
 	GDALRasterBand *poBand;
 
@@ -1310,10 +1586,11 @@ std::vector<std::vector<double>> SpatRaster::readRowColGDAL(unsigned src, std::v
 			double naflag = poBand->GetNoDataValue(&hasNA);
 			if (hasNA)  naflags[i] = naflag;
 		}
-		NAso(out, n, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
+		// the values are interleaved by cell
+		NAso(&out[0], n, nl, 1, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
 	}
 
-	GDALClose((GDALDatasetH) poDataset);
+	closeGDALpooled(poDataset);
 	if (err != CE_None ) {
 		setError("cannot read values");
 		return errout;
@@ -1341,8 +1618,11 @@ std::vector<double> SpatRaster::readRowColGDALFlat(unsigned src, std::vector<int
 		setError("cannot read from rotated files. First use 'rectify'");
 		return errout;
 	}
+	if (rows.empty()) {
+		return errout;
+	}
 
-    GDALDataset *poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, source[src].open_ops);
+    GDALDataset *poDataset = openGDALpooled(source[src].filename, source[src].open_ops);
 
 	GDALRasterBand *poBand;
 
@@ -1391,10 +1671,11 @@ std::vector<double> SpatRaster::readRowColGDALFlat(unsigned src, std::vector<int
 			double naflag = poBand->GetNoDataValue(&hasNA);
 			if (hasNA)  naflags[i] = naflag;
 		}
-		NAso(out, n, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
+		// the values are interleaved by cell
+		NAso(&out[0], n, nl, 1, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
 	}
 
-	GDALClose((GDALDatasetH) poDataset);
+	closeGDALpooled(poDataset);
 	if (err != CE_None ) {
 		setError("cannot read values");
 		return errout;
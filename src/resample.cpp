@@ -0,0 +1,354 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include <cmath>
+#include <algorithm>
+
+
+// for each output cell along one axis, the source cells that contribute
+// to it (idx) and their weights (w); from ptr[k] to ptr[k+1]
+struct ResampleAxis {
+	std::vector<size_t> ptr;
+	std::vector<size_t> idx;
+	std::vector<double> w;
+	size_t first = 0;
+	size_t last = 0;
+	bool any = false;
+};
+
+
+static double resample_kernel(double x, bool cubic) {
+	x = std::fabs(x);
+	if (cubic) { // Keys, with a = -0.5, as used by GDAL
+		if (x < 1) return (1.5 * x - 2.5) * x * x + 1;
+		if (x < 2) return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+		return 0;
+	}
+	return x < 1 ? 1 - x : 0;
+}
+
+
+// "s0" is the position of the first output cell edge and "ratio" the size
+// of an output cell, both in source cells (the source starts at zero).
+static void resample_axis(ResampleAxis &a, double s0, double ratio, size_t nout, size_t nsrc, const std::string &method) {
+
+	a.ptr.resize(nout+1, 0);
+	a.first = nsrc;
+	a.last = 0;
+	bool kernel = (method == "bilinear") || (method == "cubic");
+	bool cubic = method == "cubic";
+	// when aggregating, the kernel is stretched to cover the output cell
+	double scale = std::min(1.0, 1.0 / ratio);
+	double radius = (cubic ? 2.0 : 1.0) / scale;
+
+	for (size_t k=0; k<nout; k++) {
+		a.ptr[k] = a.idx.size();
+		double center = s0 + (k + 0.5) * ratio;
+		if ((center < 0) || (center >= nsrc)) continue;
+		if (method == "near") {
+			size_t i = std::min((size_t) std::floor(center + 1e-10), nsrc-1);
+			a.idx.push_back(i);
+			a.w.push_back(1);
+		} else if (kernel) {
+			double c = center - 0.5;
+			long lo = std::max(0L, (long) std::ceil(c - radius));
+			long hi = std::min((long)nsrc - 1, (long) std::floor(c + radius));
+			for (long i=lo; i<=hi; i++) {
+				double w = resample_kernel((i - c) * scale, cubic);
+				if (w != 0) {
+					a.idx.push_back(i);
+					a.w.push_back(w);
+				}
+			}
+		} else { // average, sum, min, max, mode: all overlapping cells
+			double b = s0 + k * ratio;
+			double e = b + ratio;
+			long lo = std::max(0L, (long) std::floor(b));
+			long hi = std::min((long)nsrc - 1, (long) std::ceil(e) - 1);
+			for (long i=lo; i<=hi; i++) {
+				double w = std::min(i + 1.0, e) - std::max((double)i, b);
+				if (w > 1e-10) {
+					a.idx.push_back(i);
+					a.w.push_back(w);
+				}
+			}
+		}
+		if (a.idx.size() > a.ptr[k]) {
+			a.first = std::min(a.first, a.idx[a.ptr[k]]);
+			a.last = std::max(a.last, a.idx.back());
+			a.any = true;
+		}
+	}
+	a.ptr[nout] = a.idx.size();
+}
+
+
+enum ResampleFun {rs_near, rs_mean, rs_sum, rs_mode, rs_min, rs_max};
+
+
+// the source cells of one output cell are the rows yi[ry0:ry1] and the
+// columns xi[cx0:cx1] of "s", that starts at row sr0 and has snc columns
+struct ResampleCell {
+	const double *s;
+	size_t sr0, snc;
+	size_t ry0, ry1, cx0, cx1;
+};
+
+
+// the weighted mean or sum of the cells that are not NA
+static double resample_weighted(const ResampleCell &k, const ResampleAxis &ax, const ResampleAxis &ay, const std::vector<size_t> &yi, const std::vector<size_t> &xi, bool mean) {
+	double sw = 0, sv = 0;
+	for (size_t ky=k.ry0; ky<k.ry1; ky++) {
+		const double *srow = k.s + (yi[ky] - k.sr0) * k.snc;
+		double wy = ay.w[ky];
+		for (size_t kx=k.cx0; kx<k.cx1; kx++) {
+			double d = srow[xi[kx]];
+			if (std::isnan(d)) continue;
+			double w = wy * ax.w[kx];
+			sw += w;
+			sv += w * d;
+		}
+	}
+	if (sw > 0) {
+		return mean ? sv / sw : sv;
+	}
+	return NAN;
+}
+
+
+// the most frequent value. Ties go to the value that occurs first
+static double resample_mode(const ResampleCell &k, const std::vector<size_t> &yi, const std::vector<size_t> &xi, std::vector<std::pair<double, size_t>> &vals) {
+	vals.resize(0);
+	for (size_t ky=k.ry0; ky<k.ry1; ky++) {
+		const double *srow = k.s + (yi[ky] - k.sr0) * k.snc;
+		for (size_t kx=k.cx0; kx<k.cx1; kx++) {
+			double d = srow[xi[kx]];
+			if (!std::isnan(d)) vals.push_back(std::make_pair(d, vals.size()));
+		}
+	}
+	std::sort(vals.begin(), vals.end());
+	double val = NAN;
+	size_t mx = 0, first = 0;
+	for (size_t i=0; i<vals.size(); ) {
+		size_t j = i + 1;
+		while ((j < vals.size()) && (vals[j].first == vals[i].first)) j++;
+		size_t n = j - i;
+		if ((n > mx) || ((n == mx) && (vals[i].second < first))) {
+			mx = n;
+			first = vals[i].second;
+			val = vals[i].first;
+		}
+		i = j;
+	}
+	return val;
+}
+
+
+static double resample_minmax(const ResampleCell &k, const std::vector<size_t> &yi, const std::vector<size_t> &xi, bool domin) {
+	double val = NAN;
+	for (size_t ky=k.ry0; ky<k.ry1; ky++) {
+		const double *srow = k.s + (yi[ky] - k.sr0) * k.snc;
+		for (size_t kx=k.cx0; kx<k.cx1; kx++) {
+			double d = srow[xi[kx]];
+			if (std::isnan(d)) continue;
+			if (std::isnan(val)) {
+				val = d;
+			} else {
+				val = domin ? std::min(val, d) : std::max(val, d);
+			}
+		}
+	}
+	return val;
+}
+
+
+bool is_native_resample_method(const std::string &method) {
+	std::vector<std::string> m {"near", "bilinear", "cubic", "average", "sum", "min", "max", "mode"};
+	return std::find(m.begin(), m.end(), method) != m.end();
+}
+
+
+// resampling between rasters with the same crs and without rotation. The
+// source cells and weights are computed once for each output column and
+// each output row, and the source rows needed for a block of output rows
+// are read at once.
+bool SpatRaster::resample_native(SpatRaster &out, std::string method, SpatOptions &opt) {
+
+	if (!is_native_resample_method(method)) {
+		out.setError("not a valid method: " + method);
+		return false;
+	}
+
+	SpatExtent ein = getExtent();
+	SpatExtent eout = out.getExtent();
+	double xr = xres();
+	double yr = yres();
+	size_t onc = out.ncol();
+	size_t nl = nlyr();
+
+	ResampleAxis ax, ay;
+	resample_axis(ax, (eout.xmin - ein.xmin) / xr, out.xres() / xr, onc, ncol(), method);
+	resample_axis(ay, (ein.ymax - eout.ymax) / yr, out.yres() / yr, out.nrow(), nrow(), method);
+
+	if (!readStart()) {
+		out.setError(getError());
+		return false;
+	}
+	if (!out.writeStart(opt)) {
+		readStop();
+		return false;
+	}
+
+	ResampleFun fun = rs_mean;
+	if (method == "near") {
+		fun = rs_near;
+	} else if (method == "sum") {
+		fun = rs_sum;
+	} else if (method == "mode") {
+		fun = rs_mode;
+	} else if (method == "min") {
+		fun = rs_min;
+	} else if (method == "max") {
+		fun = rs_max;
+	}
+	bool weighted = (fun == rs_mean) || (fun == rs_sum);
+	// the sum of the weights of each output column and row
+	std::vector<double> swx(onc, 0), swy(out.nrow(), 0);
+	for (size_t c=0; c<onc; c++) {
+		for (size_t kx=ax.ptr[c]; kx<ax.ptr[c+1]; kx++) swx[c] += ax.w[kx];
+	}
+	for (size_t r=0; r<out.nrow(); r++) {
+		for (size_t ky=ay.ptr[r]; ky<ay.ptr[r+1]; ky++) swy[r] += ay.w[ky];
+	}
+	std::vector<std::pair<double, size_t>> vals;
+	std::vector<double> hs;
+	// column indices relative to the first column that is read
+	size_t sc0 = ax.first;
+	size_t snc = ax.any ? ax.last - ax.first + 1 : 0;
+	std::vector<size_t> xi = ax.idx;
+	for (size_t &j : xi) j -= sc0;
+
+	// the number of source rows that can be read at once. The output rows
+	// of a block are computed in strips that need at most that many rows
+	// (but at least one output row)
+	size_t smax = std::max((size_t)1, chunkSize(opt));
+
+	for (size_t i = 0; i < out.bs.n; i++) {
+		size_t nr = out.bs.nrows[i];
+		std::vector<double> v(nl * nr * onc, NAN);
+
+		for (size_t q0 = 0; (q0 < nr) && ax.any; ) {
+			// the source rows used by this strip of output rows
+			size_t r0 = out.bs.row[i] + q0;
+			size_t sr0 = nrow();
+			size_t sr1 = 0;
+			size_t q1 = q0;
+			for (; q1 < nr; q1++) {
+				size_t r = out.bs.row[i] + q1;
+				if (ay.ptr[r+1] == ay.ptr[r]) continue;
+				size_t a = std::min(sr0, ay.idx[ay.ptr[r]]);
+				size_t b = std::max(sr1, ay.idx[ay.ptr[r+1]-1]);
+				if ((q1 > q0) && (a <= b) && ((b - a + 1) > smax)) break;
+				sr0 = a;
+				sr1 = b;
+			}
+			size_t qn = q1 - q0;
+			q0 = q1;
+			if (sr0 > sr1) continue;
+			size_t snr = sr1 - sr0 + 1;
+			std::vector<double> s;
+			readValues(s, sr0, snr, sc0, snc);
+			if (s.size() != (nl * snr * snc)) {
+				readStop();
+				out.writeStop();
+				out.setError("cannot read values");
+				return false;
+			}
+
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				ResampleCell k;
+				k.s = &s[lyr * snr * snc];
+				k.sr0 = sr0;
+				k.snc = snc;
+				double *vl = &v[(lyr * nr + r0 - out.bs.row[i]) * onc];
+				if (weighted) {
+					// the weights are separable: first the weighted sums of
+					// the columns of each source row (NAN if a cell is NA)
+					hs.resize(snr * onc);
+					for (size_t sr=0; sr<snr; sr++) {
+						const double *srow = k.s + sr * snc;
+						double *h = &hs[sr * onc];
+						for (size_t c=0; c<onc; c++) {
+							double sv = NAN;
+							if (ax.ptr[c+1] > ax.ptr[c]) {
+								sv = 0;
+								for (size_t kx=ax.ptr[c]; kx<ax.ptr[c+1]; kx++) {
+									sv += ax.w[kx] * srow[xi[kx]];
+								}
+							}
+							h[c] = sv;
+						}
+					}
+				}
+				for (size_t r=0; r<qn; r++) {
+					k.ry0 = ay.ptr[r0+r];
+					k.ry1 = ay.ptr[r0+r+1];
+					if (k.ry0 == k.ry1) continue;
+					double *vr = vl + r * onc;
+					for (size_t c=0; c<onc; c++) {
+						k.cx0 = ax.ptr[c];
+						k.cx1 = ax.ptr[c+1];
+						if (k.cx0 == k.cx1) continue;
+						switch (fun) {
+							case rs_near:
+								vr[c] = k.s[(ay.idx[k.ry0] - sr0) * snc + xi[k.cx0]];
+								break;
+							case rs_mean:
+							case rs_sum: {
+								double sv = 0;
+								for (size_t ky=k.ry0; ky<k.ry1; ky++) {
+									sv += ay.w[ky] * hs[(ay.idx[ky] - sr0) * onc + c];
+								}
+								if (std::isnan(sv)) {
+									// some cells are NA
+									vr[c] = resample_weighted(k, ax, ay, ay.idx, xi, fun == rs_mean);
+								} else {
+									vr[c] = fun == rs_mean ? sv / (swy[r0+r] * swx[c]) : sv;
+								}
+								break;
+							}
+							case rs_mode:
+								vr[c] = resample_mode(k, ay.idx, xi, vals);
+								break;
+							default:
+								vr[c] = resample_minmax(k, ay.idx, xi, fun == rs_min);
+						}
+					}
+				}
+			}
+		}
+		if (!out.writeBlock(v, i)) {
+			readStop();
+			return false;
+		}
+	}
+	readStop();
+	out.writeStop();
+	return true;
+}
+
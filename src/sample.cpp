@@ -22,6 +22,7 @@
 #include <random>
 #include <unordered_set>
 #include "string_utils.h"
+#include "sketch.h"
 
 
 void getSampleRowCol(std::vector<size_t> &oldrow, std::vector<size_t> &oldcol, size_t nrows, size_t ncols, size_t snrow, size_t sncol) {
@@ -113,7 +114,7 @@ SpatRaster SpatRaster::sampleRegularRaster(unsigned size) {
 			#endif
 		}
 		if (hasError()) return out;
-		out.source[0].values.insert(out.source[0].values.end(), v.begin(), v.end());
+		out.source[0].values.append(v.data(), v.data() + v.size());
 	}
 	out.source[0].memory = true;
 	out.source[0].hasValues = true;
@@ -152,7 +153,7 @@ SpatRaster SpatRaster::sampleRowColRaster(size_t nr, size_t nc) {
 			#endif
 		}
 		if (hasError()) return out;
-		out.source[0].values.insert(out.source[0].values.end(), v.begin(), v.end());
+		out.source[0].values.append(v.data(), v.data() + v.size());
 	}
 	out.source[0].memory = true;
 	out.source[0].hasValues = true;
@@ -333,6 +334,8 @@ std::vector<size_t> sample_no_replace(size_t size, size_t N, unsigned seed){
 	}
 	std::default_random_engine gen(seed);   
 
+	// The cells are returned in ascending order, such that they can be
+	// read block by block
 	if (size >= .66 * N) {
 		sample.resize(N);
 		std::iota(std::begin(sample), std::end(sample), 0);
@@ -340,20 +343,21 @@ std::vector<size_t> sample_no_replace(size_t size, size_t N, unsigned seed){
 		if (size < N) {
 			sample.erase(sample.begin()+size, sample.end());
 		}
+		std::sort(sample.begin(), sample.end());
 		return sample;
 	}
 
-	std::uniform_real_distribution<> U( 0, std::nextafter(1.0, std::numeric_limits<double>::max() ) );
-
-	sample.reserve(size); 
-	for (size_t i=0; i<N; i++) {
-		if ( ((N-i) * U(gen)) <  (size - sample.size()) ) {
-			sample.push_back(i);
-    		if (sample.size() == size ) {
-				break;
-			}
+	// Floyd's algorithm; O(size) instead of a pass over all N cells.
+	std::unordered_set<size_t> sampleset;
+	sampleset.reserve(size * 2);
+	for (size_t j=(N-size); j<N; j++) {
+		std::uniform_int_distribution<size_t> U(0, j);
+		if (!sampleset.insert(U(gen)).second) {
+			sampleset.insert(j);
 		}
 	}
+	sample.insert(sample.begin(), sampleset.begin(), sampleset.end());
+	std::sort(sample.begin(), sample.end());
 	return sample;
 }
 
@@ -459,13 +463,10 @@ std::vector<size_t> sample(size_t size, size_t N, bool replace, std::vector<doub
 std::vector<std::vector<double>> SpatRaster::sampleRandomValues(unsigned size, bool replace, unsigned seed) {
 
 	double nc = ncell();
-	std::vector<size_t> cells;
 	std::vector<double> w;
-	if (replace) {
-		cells = sample(size, nc, false, w, seed);
-	} else {
-		cells = sample(size, nc, true, w, seed);
-	}
+	std::vector<size_t> cells = sample(size, nc, replace, w, seed);
+	// in order, such that consecutive cells come from the same block
+	std::sort(cells.begin(), cells.end());
 
 	std::vector<double> dcells(cells.begin(), cells.end());
 	std::vector<std::vector<double>> d = extractCell(dcells);
@@ -492,7 +493,7 @@ SpatRaster SpatRaster::sampleRandomRaster(unsigned size, bool replace, unsigned
 	std::vector<std::vector<double>> vv = sampleRandomValues(nsize, replace, seed);
 
 	for (size_t i=0; i<vv.size(); i++) {
-		out.source[0].values.insert(out.source[0].values.end(), vv[i].begin(), vv[i].end());
+		out.source[0].values.append(vv[i].data(), vv[i].data() + vv[i].size());
 	}
 	out.source[0].memory = true;
 	out.source[0].hasValues = true;
@@ -501,6 +502,89 @@ SpatRaster SpatRaster::sampleRandomRaster(unsigned size, bool replace, unsigned
 	return out;
 }
 
+// a random sample of the cells that are not NA in any layer, taken in a
+// single pass over the blocks, without first counting the cells to sample from
+std::vector<double> SpatRaster::sampleRandomNotNA(size_t size, unsigned seed, SpatOptions &opt) {
+
+	ReservoirSample rs(size, seed);
+	if ((size == 0) || (!hasValues())) return rs.sample;
+	if (!readStart()) {
+		return rs.sample;
+	}
+	size_t nl = nlyr();
+	size_t nc = ncol();
+	BlockSize bs = getBlockSize(opt);
+	std::vector<double> cells;
+	for (size_t i=0; i<bs.n; i++) {
+		std::vector<double> v;
+		readBlock(v, bs, i);
+		size_t off = bs.nrows[i] * nc;
+		std::vector<bool> keep(off, true);
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			size_t loff = lyr * off;
+			for (size_t j=0; j<off; j++) {
+				if (std::isnan(v[loff+j])) keep[j] = false;
+			}
+		}
+		cells.resize(0);
+		double start = bs.row[i] * nc;
+		for (size_t j=0; j<off; j++) {
+			if (keep[j]) cells.push_back(start + j);
+		}
+		rs.add(cells.data(), cells.size());
+	}
+	readStop();
+	std::sort(rs.sample.begin(), rs.sample.end());
+	return rs.sample;
+}
+
+
+// up to "size" randomly selected cells for each value (class) of the first
+// layer, taken in a single pass over the blocks. Returns the cell numbers
+// and their class, ordered by class and cell
+std::vector<std::vector<double>> SpatRaster::sampleStratifiedCells(size_t size, unsigned seed, SpatOptions &opt) {
+
+	std::vector<std::vector<double>> out(2);
+	if ((size == 0) || (!hasValues())) return out;
+	if (!readStart()) {
+		return out;
+	}
+	std::map<double, ReservoirSample> strata;
+	size_t nc = ncol();
+	BlockSize bs = getBlockSize(opt);
+	for (size_t i=0; i<bs.n; i++) {
+		std::vector<double> v;
+		readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+		size_t off = bs.nrows[i] * nc;
+		double start = bs.row[i] * nc;
+		// classes tend to come in runs of cells
+		double last = NAN;
+		ReservoirSample *rs = NULL;
+		for (size_t j=0; j<off; j++) {
+			if (std::isnan(v[j])) continue;
+			if (v[j] != last) {
+				last = v[j];
+				auto it = strata.find(last);
+				if (it == strata.end()) {
+					it = strata.insert(std::make_pair(last, ReservoirSample(size, seed + strata.size()))).first;
+				}
+				rs = &(it->second);
+			}
+			double cell = start + j;
+			rs->add(&cell, 1);
+		}
+	}
+	readStop();
+	for (auto &s : strata) {
+		std::vector<double> &cells = s.second.sample;
+		std::sort(cells.begin(), cells.end());
+		out[0].insert(out[0].end(), cells.begin(), cells.end());
+		out[1].resize(out[0].size(), s.first);
+	}
+	return out;
+}
+
+
 std::vector<size_t> SpatExtent::test_sample(size_t size, size_t N, bool replace, std::vector<double> w, unsigned seed) {
 	return sample(size, N, replace, w, seed);
 }
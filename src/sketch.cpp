@@ -0,0 +1,286 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "sketch.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+
+// splitmix64; used as random number generator and as hash function
+static inline uint64_t mix64(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static inline uint64_t next_random(uint64_t &seed) {
+	seed = mix64(seed);
+	return seed;
+}
+
+
+QuantileSketch::QuantileSketch(size_t k) : k(std::max(k, (size_t)8)) {
+	grow();
+}
+
+// level h has a weight of 2^h. Lower levels have a smaller capacity
+size_t QuantileSketch::capacity(size_t h) {
+	double depth = levels.size() - h - 1;
+	return std::ceil(k * std::pow(2.0/3.0, depth)) + 1;
+}
+
+void QuantileSketch::grow() {
+	levels.resize(levels.size() + 1);
+	maxsize = 0;
+	for (size_t h=0; h<levels.size(); h++) {
+		maxsize += capacity(h);
+	}
+}
+
+void QuantileSketch::compress() {
+	for (size_t h=0; h<levels.size(); h++) {
+		if (levels[h].size() >= capacity(h)) {
+			if ((h+1) >= levels.size()) grow();
+			std::vector<double> &x = levels[h];
+			double last = NAN;
+			bool odd = (x.size() % 2) == 1;
+			if (odd) {
+				last = x.back();
+				x.pop_back();
+			}
+			std::sort(x.begin(), x.end());
+			// keep either the even or the odd items, with twice the weight
+			size_t offset = next_random(seed) & 1;
+			std::vector<double> &y = levels[h+1];
+			for (size_t i=offset; i<x.size(); i+=2) {
+				y.push_back(x[i]);
+			}
+			x.resize(0);
+			if (odd) x.push_back(last);
+			size = 0;
+			for (size_t j=0; j<levels.size(); j++) {
+				size += levels[j].size();
+			}
+			if (size < maxsize) break;
+		}
+	}
+}
+
+void QuantileSketch::add(const double *v, size_t nv) {
+	for (size_t i=0; i<nv; i++) {
+		if (std::isnan(v[i])) continue;
+		if (n == 0) {
+			vmin = v[i];
+			vmax = v[i];
+		} else {
+			vmin = std::min(vmin, v[i]);
+			vmax = std::max(vmax, v[i]);
+		}
+		levels[0].push_back(v[i]);
+		n++;
+		size++;
+		if (size >= maxsize) compress();
+	}
+}
+
+void QuantileSketch::merge(const QuantileSketch &x) {
+	while (levels.size() < x.levels.size()) grow();
+	for (size_t h=0; h<x.levels.size(); h++) {
+		levels[h].insert(levels[h].end(), x.levels[h].begin(), x.levels[h].end());
+		size += x.levels[h].size();
+	}
+	if (n == 0) {
+		vmin = x.vmin;
+		vmax = x.vmax;
+	} else if (x.n > 0) {
+		vmin = std::min(vmin, x.vmin);
+		vmax = std::max(vmax, x.vmax);
+	}
+	n += x.n;
+	while (size >= maxsize) {
+		size_t s = size;
+		compress();
+		if (size == s) break;
+	}
+}
+
+// quantiles with linear interpolation between the values of the
+// neighbouring ranks, as in R's quantile (type 7)
+std::vector<double> QuantileSketch::quantile(const std::vector<double> &probs) {
+	std::vector<double> out(probs.size(), NAN);
+	if (n == 0) return out;
+	std::vector<std::pair<double, uint64_t>> x;
+	x.reserve(size);
+	for (size_t h=0; h<levels.size(); h++) {
+		uint64_t w = 1ULL << h;
+		for (size_t i=0; i<levels[h].size(); i++) {
+			x.push_back(std::make_pair(levels[h][i], w));
+		}
+	}
+	std::sort(x.begin(), x.end());
+	// cumulative weights, scaled to n
+	std::vector<double> cw(x.size());
+	double total = 0;
+	for (size_t i=0; i<x.size(); i++) {
+		total += x[i].second;
+		cw[i] = total;
+	}
+	double f = n / total;
+	for (double &d : cw) d *= f;
+
+	auto at_rank = [&](double r) {
+		size_t i = std::upper_bound(cw.begin(), cw.end(), r) - cw.begin();
+		return x[std::min(i, x.size()-1)].first;
+	};
+	for (size_t i=0; i<probs.size(); i++) {
+		double h = probs[i] * (n - 1);
+		double hf = std::floor(h);
+		double a = at_rank(hf);
+		if (h > hf) {
+			double b = at_rank(hf + 1);
+			out[i] = a + (h - hf) * (b - a);
+		} else {
+			out[i] = a;
+		}
+		out[i] = std::min(vmax, std::max(vmin, out[i]));
+	}
+	for (size_t i=0; i<probs.size(); i++) {
+		if (probs[i] <= 0) out[i] = vmin;
+		if (probs[i] >= 1) out[i] = vmax;
+	}
+	return out;
+}
+
+
+
+DistinctSketch::DistinctSketch() {
+	reg.resize(1 << 14, 0);
+}
+
+void DistinctSketch::add(const double *v, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		if (std::isnan(v[i])) continue;
+		// -0 and 0 are the same value
+		double d = v[i] + 0.0;
+		uint64_t h;
+		std::memcpy(&h, &d, sizeof(double));
+		h = mix64(h);
+		size_t j = h >> 50;
+		uint64_t w = h << 14;
+		uint8_t rho = 1;
+		while ((rho <= 50) && !(w & 0x8000000000000000ULL)) {
+			w <<= 1;
+			rho++;
+		}
+		if (rho > reg[j]) reg[j] = rho;
+	}
+}
+
+void DistinctSketch::merge(const DistinctSketch &x) {
+	for (size_t i=0; i<reg.size(); i++) {
+		reg[i] = std::max(reg[i], x.reg[i]);
+	}
+}
+
+double DistinctSketch::count() {
+	double m = reg.size();
+	double s = 0;
+	size_t zeros = 0;
+	for (size_t i=0; i<reg.size(); i++) {
+		s += std::ldexp(1.0, -reg[i]);
+		zeros += reg[i] == 0;
+	}
+	double alpha = 0.7213 / (1 + 1.079 / m);
+	double e = alpha * m * m / s;
+	// linear counting for small numbers
+	if ((e <= 2.5 * m) && (zeros > 0)) {
+		e = m * std::log(m / zeros);
+	}
+	return std::round(e);
+}
+
+
+
+ReservoirSample::ReservoirSample(size_t size, uint64_t seed) : size(size), seed(seed) {
+	sample.reserve(size);
+}
+
+// uniform number in (0, 1)
+static inline double next_unif(uint64_t &seed) {
+	return ((next_random(seed) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+// Li's "algorithm L": once the reservoir is full, the number of values to
+// skip before the next replacement is drawn directly, such that random
+// numbers are only needed for the values that are kept
+void ReservoirSample::skip() {
+	w *= std::exp(std::log(next_unif(seed)) / size);
+	next = n + (uint64_t) std::floor(std::log(next_unif(seed)) / std::log1p(-w)) + 1;
+}
+
+void ReservoirSample::add(const double *v, size_t nv) {
+	if (size == 0) return;
+	for (size_t i=0; i<nv; i++) {
+		if (std::isnan(v[i])) continue;
+		n++;
+		if (sample.size() < size) {
+			sample.push_back(v[i]);
+			if (sample.size() == size) {
+				w = 1;
+				skip();
+			}
+		} else if (n == next) {
+			sample[next_random(seed) % size] = v[i];
+			skip();
+		}
+	}
+}
+
+// each value in the combined sample comes from "x" with a probability
+// proportional to the number of values that "x" has seen
+void ReservoirSample::merge(const ReservoirSample &x) {
+	if (x.n == 0) return;
+	if (n == 0) {
+		sample = x.sample;
+		n = x.n;
+		w = x.w;
+		next = x.next;
+		return;
+	}
+	std::vector<double> a = sample;
+	std::vector<double> b = x.sample;
+	uint64_t na = n;
+	uint64_t nb = x.n;
+	sample.resize(0);
+	while ((sample.size() < size) && ((a.size() + b.size()) > 0)) {
+		bool froma = b.empty() || ((!a.empty()) && ((next_random(seed) % (na + nb)) < na));
+		std::vector<double> &s = froma ? a : b;
+		size_t j = next_random(seed) % s.size();
+		sample.push_back(s[j]);
+		s[j] = s.back();
+		s.pop_back();
+		if (froma) na--; else nb--;
+	}
+	n += x.n;
+	if (sample.size() == size) {
+		// continue from the expected threshold for the combined number of values
+		w = (double) size / n;
+		next = n + (uint64_t) std::floor(std::log(next_unif(seed)) / std::log1p(-w)) + 1;
+	}
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATSKETCH_GUARD
+#define SPATSKETCH_GUARD
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+
+// Streaming summaries of values that are too many to keep in memory.
+// Each can be updated block by block and merged with another one of the
+// same type (e.g. computed for another tile or zone).
+
+
+// KLL quantile sketch. The result is exact if no more than k values are
+// added, and otherwise has a rank error of about 1.7/k
+class QuantileSketch {
+	public:
+		QuantileSketch(size_t k=1000);
+		void add(const double *v, size_t n);
+		void merge(const QuantileSketch &x);
+		std::vector<double> quantile(const std::vector<double> &probs);
+		uint64_t n = 0;
+
+	private:
+		size_t k;
+		size_t size = 0;
+		size_t maxsize = 0;
+		uint64_t seed = 42;
+		// the extremes are kept exactly
+		double vmin = NAN;
+		double vmax = NAN;
+		std::vector<std::vector<double>> levels;
+		size_t capacity(size_t h);
+		void grow();
+		void compress();
+};
+
+
+// HyperLogLog distinct count with 2^14 registers (a relative error of about 1%)
+class DistinctSketch {
+	public:
+		DistinctSketch();
+		void add(const double *v, size_t n);
+		void merge(const DistinctSketch &x);
+		double count();
+
+	private:
+		std::vector<uint8_t> reg;
+};
+
+
+// uniform random sample of a fixed size (reservoir sampling)
+class ReservoirSample {
+	public:
+		ReservoirSample(size_t size, uint64_t seed);
+		void add(const double *v, size_t n);
+		void merge(const ReservoirSample &x);
+		std::vector<double> sample;
+		uint64_t n = 0;
+
+	private:
+		size_t size;
+		uint64_t seed;
+		double w = 1;
+		uint64_t next = 0;
+		void skip();
+};
+
+
+#endif
@@ -28,6 +28,7 @@ SpatOptions::SpatOptions(const SpatOptions &opt) {
 	memfrac = opt.memfrac;
 	memmax = opt.memmax;
 	todisk = opt.todisk;
+	memmap = opt.memmap;
 	tolerance = opt.tolerance;
 
 	def_datatype = opt.def_datatype;
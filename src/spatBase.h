@@ -118,6 +118,7 @@ class SpatOptions {
 		unsigned ncopies = 4;
 		unsigned minrows = 1;
 		bool threads=false;
+		bool memmap=false;
 		std::string def_datatype = "FLT4S";
 		std::string def_filetype = "GTiff";
 		//std::string def_bandorder = "BIL";
@@ -274,6 +274,12 @@ SpatRaster SpatRaster::geometry(long nlyrs, bool properties, bool time, bool uni
 		out.rgbtype = rgbtype;
 		out.rgblyrs = rgblyrs;
 	}
+	size_t trows, toff;
+	if (nativeBlockRows(trows, toff)) {
+		out.blockrows_hint = trows;
+		out.blockrows_offset = toff;
+		out.blockrows_nrow = nrow();
+	}
 	return out;
 }
 
@@ -350,6 +356,12 @@ std::vector<bool> SpatRaster::inMemory() {
 	return(m);
 }
 
+std::vector<bool> SpatRaster::mappedValues() {
+	std::vector<bool> m(source.size());
+	for (size_t i=0; i<m.size(); i++) { m[i] = source[i].memory && source[i].values.mapped(); }
+	return(m);
+}
+
 std::vector<bool> SpatRaster::hasRange() {
 	std::vector<bool> x;
 	for (size_t i=0; i<source.size(); i++) {
@@ -616,7 +628,8 @@ bool SpatRaster::setNAflag(std::vector<double> flag) {
 
 			if (source[i].memory) {
 				source[i].hasNAflag = false;
-				std::replace(source[i].values.begin(), source[i].values.end(), flag[i], na);
+				double *v = source[i].values.unique();
+				std::replace(v, v + source[i].values.size(), flag[i], na);
 				source[i].setRange();
 			} else {
 				source[i].hasNAflag = true;
@@ -17,7 +17,11 @@
 
 #include <fstream>
 #include <numeric>
+#include <list>
+#include <map>
+#include <unordered_map>
 #include "spatVector.h"
+#include "spatValues.h"
 
 #ifdef useGDAL
 #include "gdal_priv.h"
@@ -56,14 +60,53 @@ class SpatWindow {
 
 
 
+// decoded chunks of a multidimensional array, with the least recently used
+// chunk dropped first when the cache is full
+class SpatChunkCache {
+	public:
+		SpatChunkCache() {}
+		// a copy starts with an empty cache, as the iterators into "lru"
+		// cannot be copied
+		SpatChunkCache(const SpatChunkCache &x) : chunk(x.chunk), nchunks(x.nchunks), maxsize(x.maxsize) {}
+		SpatChunkCache& operator=(const SpatChunkCache &x) {
+			if (this != &x) {
+				clear();
+				chunk = x.chunk;
+				nchunks = x.nchunks;
+				maxsize = x.maxsize;
+			}
+			return *this;
+		}
+		virtual ~SpatChunkCache(){}
+		// chunk size (rows, columns, layers)
+		std::vector<size_t> chunk;
+		// number of chunks (rows, columns)
+		std::vector<size_t> nchunks = {0, 0};
+		// maximum and current number of cached values
+		size_t maxsize = 0;
+		size_t size = 0;
+		std::list<uint64_t> lru;
+		std::unordered_map<uint64_t, std::pair<std::vector<double>, std::list<uint64_t>::iterator>> chunks;
+
+		// the chunk (row, column, layer) packed into a single number
+		uint64_t key(size_t cr, size_t cc, size_t cl) const {
+			return ((uint64_t)cl * nchunks[0] + cr) * nchunks[1] + cc;
+		}
+		std::vector<double>* get(uint64_t key);
+		std::vector<double>* put(uint64_t key, std::vector<double> &v);
+		void clear();
+};
+
+
 class SpatRasterSource {
     private:
 //		std::ofstream ofs;
 	public:
 #ifdef useGDAL
 		GDALDataset* gdalconnection;
-#if GDAL_VERSION_MAJOR >= 3 && GDAL_VERSION_MINOR >= 1	
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,1,0)
 		GDALMDArrayH gdalmdarray;
+		GDALDataType m_datatype;
 #endif
 #endif
 		bool open_read=false;
@@ -97,6 +140,7 @@ class SpatRasterSource {
 		std::vector<size_t> m_subset;
 		bool m_hasNA = false;
 		double m_missing_value;
+		SpatChunkCache m_cache;
 
 		
 		//std::vector<std::string> crs = std::vector<std::string>(2, "");
@@ -116,7 +160,7 @@ class SpatRasterSource {
 		bool hasUnit = false;
 
 		//std::vector< std::vector<double> values;
-        std::vector<double> values;
+        SpatValues values;
         //std::vector<int64_t> ivalues;
         //std::vector<bool> bvalues;
 
@@ -156,7 +200,7 @@ class SpatRasterSource {
 //		std::vector<SpatRasterSource> subset(std::vector<unsigned> lyrs);
 		SpatRasterSource subset(std::vector<unsigned> lyrs);
 //		void getValues(std::vector<double> &v, unsigned lyr, SpatOptions &opt);
-		void appendValues(std::vector<double> &v, unsigned lyr);
+		void appendValues(SpatValues &v, unsigned lyr);
 		
 		void setRange();
 		void resize(unsigned n);
@@ -210,6 +254,11 @@ class SpatRaster {
 		BlockSize bs;
 		//BlockSize getBlockSize(unsigned n, double frac, unsigned steps=0);
 		BlockSize getBlockSize(SpatOptions &opt);
+		bool nativeBlockRows(size_t &rows, size_t &offset);
+		// row tiling inherited (via geometry) from the input raster
+		size_t blockrows_hint = 0;
+		size_t blockrows_offset = 0;
+		size_t blockrows_nrow = 0;
 		std::vector<double> mem_needs(SpatOptions &opt);
 
 		SpatMessages msg;
@@ -286,6 +335,8 @@ class SpatRaster {
 		std::vector<std::string> filenames();
 		bool isSource(std::string filename);
 		std::vector<bool> inMemory();
+		// are the values of a source in memory mapped from a file (see SpatValues)
+		std::vector<bool> mappedValues();
 
 ////////////////////////////////////////////////////
 // property like methods for layers
@@ -311,6 +362,7 @@ class SpatRaster {
 		std::vector<int_64> getTime();
 		std::string getTimeStep();
 		std::vector<std::string> getTimeStr(bool addstep);
+		std::vector<std::string> timeIndex(std::string period);
 		bool setTime(std::vector<int_64> time, std::string step);
 		
 		std::vector<double> getDepth();
@@ -440,7 +492,8 @@ class SpatRaster {
 		bool readStart();
 		std::vector<double> readValuesR(size_t row, size_t nrows, size_t col, size_t ncols);
 		void readValues(std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols);
-		void readChunkMEM(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
+		void readChunkMEM(double *out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols, size_t cellstride, size_t bandstride);
+		bool readValuesBuffer(double *out, size_t row, size_t nrows, size_t col, size_t ncols, bool bip);
 
 		void readBlock(std::vector<double> &v, BlockSize bs, unsigned i){ // inline
 			readValues(v, bs.row[i], bs.nrows[i], 0, ncol());
@@ -451,7 +504,7 @@ class SpatRaster {
 		std::vector<double> readExtent(SpatExtent e);
 		bool readStop();
 
-		bool readAll();
+		bool readAll(SpatOptions &opt);
 
 		bool writeStart(SpatOptions &opt);
 		bool writeBlock(std::vector<double> &v, unsigned i){ // inline
@@ -479,7 +532,8 @@ class SpatRaster {
 
 		bool readStartMulti(unsigned src);
 		bool readStopMulti(unsigned src);
-		bool readValuesMulti(std::vector<double> &data, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
+		bool readValuesMulti(double *data, size_t src, size_t row, size_t nrows, size_t col, size_t ncols, size_t cellstride, size_t bandstride);
+		std::vector<std::vector<double>> readRowColMulti(size_t src, const std::vector<int_64> &rows, const std::vector<int_64> &cols);
 
 
 
@@ -503,6 +557,9 @@ class SpatRaster {
 		bool readStartGDAL(unsigned src);
 		bool readStopGDAL(unsigned src);
 		void readChunkGDAL(std::vector<double> &data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols);
+		bool readChunkGDALbuffer(double *data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols, size_t cellstride, size_t bandstride, std::string &errmsg);
+		bool mapValuesGDAL(unsigned src);
+		bool readChunksGDAL(double *data, const std::vector<unsigned> &srcs, const std::vector<size_t> &offsets, size_t row, unsigned nrows, size_t col, unsigned ncols, size_t cellstride, size_t bandstride);
 
 		bool setWindow(SpatExtent x);
 		bool removeWindow();
@@ -549,6 +606,9 @@ class SpatRaster {
 		SpatRaster arith(double x, std::string oper, bool reverse, SpatOptions &opt);
 		SpatRaster arith(std::vector<double> x, std::string oper, bool reverse, SpatOptions &opt);
 		SpatRaster apply(std::vector<unsigned> ind, std::string fun, bool narm, std::vector<std::string> nms, SpatOptions &opt);
+		SpatRaster tapp(std::string period, std::string fun, bool narm, SpatOptions &opt);
+		SpatRaster roll(unsigned n, std::string type, std::string fun, bool narm, SpatOptions &opt);
+		SpatRaster fillGaps(std::vector<double> z, std::string method, double maxgap, std::vector<int> rule, double yleft, double yright, double f, bool narule, unsigned window, SpatOptions &opt);
 		SpatRaster rapply(SpatRaster x, double first, double last, std::string fun, bool clamp, bool narm, bool circular, SpatOptions &opt);
 		std::vector<std::vector<double>> rappvals(SpatRaster x, double first, double last, bool clamp, bool all, double fill, size_t startrow, size_t nrows, bool circular);
 
@@ -611,6 +671,9 @@ class SpatRaster {
 //		std::vector<double> compute_aggregates(std::vector<double> &in, size_t nr, std::vector<unsigned> dim, std::function<double(std::vector<double>&, bool)> fun, bool narm);
 		SpatDataFrame global(std::string fun, bool narm, SpatOptions &opt);
 		SpatDataFrame global_weighted_mean(SpatRaster &weights, std::string fun, bool narm, SpatOptions &opt);
+		SpatDataFrame global_weighted_area(std::string fun, bool narm, SpatOptions &opt);
+		SpatDataFrame global_quantile(std::vector<double> probs, SpatOptions &opt);
+		std::vector<std::vector<double>> layer_quantiles(std::vector<std::vector<double>> probs, SpatOptions &opt);
 
 		SpatRaster gridDistance(SpatOptions &opt);
 		SpatRaster costDistanceRun(SpatRaster &old, bool &converged, double target, double m, bool lonlat, bool global, bool npole, bool spole, bool grid, SpatOptions &opt);
@@ -686,9 +749,15 @@ class SpatRaster {
 		std::vector<std::vector<double>> sampleRowColValues(size_t nr, size_t nc, SpatOptions &opt);
 		
 		std::vector<std::vector<double>> sampleRandomValues(unsigned size, bool replace, unsigned seed);
+		std::vector<double> sampleRandomNotNA(size_t size, unsigned seed, SpatOptions &opt);
+		std::vector<std::vector<double>> sampleStratifiedCells(size_t size, unsigned seed, SpatOptions &opt);
 
 		SpatRaster scale(std::vector<double> center, bool docenter, std::vector<double> scale, bool doscale, SpatOptions &opt);
-		SpatRaster terrain(std::vector<std::string> v, unsigned neighbors, bool degrees, unsigned seed, SpatOptions &opt);
+		SpatRaster terrain(std::vector<std::string> v, unsigned neighbors, bool degrees, unsigned seed, double angle, double direction, SpatOptions &opt);
+		SpatRaster flowAccumulation(SpatOptions &opt);
+		SpatRaster watershed(std::vector<double> cells, SpatOptions &opt);
+		SpatRaster fillDepressions(SpatOptions &opt);
+		SpatRaster viewshed(std::vector<double> x, std::vector<double> y, double observer, double target, double curvcoef, double maxdist, SpatOptions &opt);
 
 		SpatRaster selRange(SpatRaster x, int z, int recycleby, SpatOptions &opt);
 		SpatRaster selectHighest(size_t n, bool low, SpatOptions &opt);
@@ -726,10 +795,13 @@ class SpatRaster {
 
 		SpatRaster warper(SpatRaster x, std::string crs, std::string method, bool mask, bool align, SpatOptions &opt);
 		SpatRaster resample(SpatRaster x, std::string method, bool mask, bool agg, SpatOptions &opt);
+		bool resample_native(SpatRaster &out, std::string method, SpatOptions &opt);
 		
 		SpatRaster applyGCP(std::vector<double> fx, std::vector<double> fy, std::vector<double> tx, std::vector<double> ty, SpatOptions &opt);
 
 		SpatDataFrame zonal(SpatRaster x, std::string fun, bool narm, SpatOptions &opt);
+		SpatDataFrame zonal_quantile(SpatRaster z, std::vector<double> probs, SpatOptions &opt);
+		SpatDataFrame zonal_weighted_area(SpatRaster z, std::string fun, bool narm, SpatOptions &opt);
 		SpatRaster rgb2col(size_t r,  size_t g, size_t b, SpatOptions &opt);
 		SpatRaster rgb2hsx(std::string type, SpatOptions &opt);	
 		SpatRaster hsx2rgb(SpatOptions &opt);	
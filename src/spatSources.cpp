@@ -233,15 +233,15 @@ void SpatRasterSource::getValues(std::vector<double> &v, unsigned lyr) {
 */
 
 
-void SpatRasterSource::appendValues(std::vector<double> &v, unsigned lyr) {
+// consecutive layers remain a view on the values of this source
+void SpatRasterSource::appendValues(SpatValues &v, unsigned lyr) {
 	size_t nc ;
 	if (hasWindow) {
 		nc = window.full_ncol * window.full_nrow;
 	} else {
 		nc = nrow * ncol;
 	}
-	size_t start = lyr * nc;
-	v.insert(v.end(), values.begin()+start, values.begin()+start+nc);
+	v.append(values.view(lyr * nc, nc));
 }
 
 
@@ -441,7 +441,7 @@ SpatRaster SpatRaster::subset(std::vector<unsigned> lyrs, SpatOptions &opt) {
 bool SpatRasterSource::combine_sources(const SpatRasterSource &x) {
 	if (memory & x.memory) {
 		if ((values.size() + x.values.size()) < (values.max_size()/8) ) {
-			values.insert(values.end(), x.values.begin(), x.values.end());
+			values.append(x.values);
 			layers.resize(nlyr + x.nlyr);
 			std::iota(layers.begin(), layers.end(), 0);
 		} else {
@@ -487,7 +487,7 @@ bool SpatRasterSource::combine_sources(const SpatRasterSource &x) {
 bool SpatRasterSource::combine(SpatRasterSource &x) {
 	if (memory & x.memory) {
 		if ((values.size() + x.values.size()) < (values.max_size()/8) ) {
-			values.insert(values.end(), x.values.begin(), x.values.end());
+			values.append(x.values);
 			layers.resize(nlyr + x.nlyr);
 			std::iota(layers.begin(), layers.end(), 0);
 			x.values.resize(0);
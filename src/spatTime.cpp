@@ -94,13 +94,11 @@ std::vector<int> get_date(SpatTime_t x) {
 			year--;
 			x += yeartime(year);
 		}
-	} else if (x > 0) {
-		while (x > 0) {
+	} else {
+		while (x >= yeartime(year)) {
 			x -= yeartime(year);
 			year++;
 		}
-		year--;
-		x += yeartime(year);
 	}
 	int month;
 	for (month=1; month<13; month++) {
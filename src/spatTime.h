@@ -18,6 +18,7 @@ class SpatTime_v {
 };
 
 
+SpatTime_t get_time(long year, unsigned month, unsigned day, unsigned hr, unsigned min, unsigned sec);
 std::vector<int> get_date(SpatTime_t x);
 std::vector<int> getymd(std::string s);
 SpatTime_t get_time_string(std::string s);
@@ -0,0 +1,159 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatValues.h"
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+SpatBuffer::~SpatBuffer() {
+#ifndef _WIN32
+	if (addr != nullptr) {
+		munmap(addr, len);
+	}
+#endif
+}
+
+
+SpatValues::SpatValues(const std::vector<double> &x) {
+	*this = x;
+}
+
+SpatValues::SpatValues(std::vector<double> &&x) {
+	*this = std::move(x);
+}
+
+SpatValues& SpatValues::operator=(const std::vector<double> &x) {
+	buf = std::make_shared<SpatBuffer>(x);
+	off = 0;
+	n = x.size();
+	return *this;
+}
+
+SpatValues& SpatValues::operator=(std::vector<double> &&x) {
+	n = x.size();
+	buf = std::make_shared<SpatBuffer>(std::move(x));
+	off = 0;
+	return *this;
+}
+
+
+// make sure that this object is the only user of a vector that
+// has exactly its values, copying them if needed
+void SpatValues::detach(size_t reserve) {
+	if (buf && (!shared()) && (!mapped()) && (off == 0) && (n == buf->v.size())) {
+		if (reserve > n) buf->v.reserve(reserve);
+		return;
+	}
+	std::vector<double> v;
+	v.reserve(std::max(reserve, n));
+	if (n > 0) {
+		const double *d = data();
+		v.insert(v.end(), d, d + n);
+	}
+	buf = std::make_shared<SpatBuffer>(std::move(v));
+	off = 0;
+}
+
+double *SpatValues::unique() {
+	if (n == 0) return nullptr;
+	detach(0);
+	return buf->v.data();
+}
+
+void SpatValues::resize(size_t size, double x) {
+	if (size == 0) {
+		buf.reset();
+		off = 0;
+		n = 0;
+		return;
+	}
+	detach(size);
+	buf->v.resize(size, x);
+	n = size;
+}
+
+void SpatValues::reserve(size_t size) {
+	detach(size);
+}
+
+void SpatValues::append(const double *b, const double *e) {
+	if (b == e) return;
+	detach(0);
+	buf->v.insert(buf->v.end(), b, e);
+	n = buf->v.size();
+}
+
+void SpatValues::append(const SpatValues &x) {
+	if (x.n == 0) return;
+	if (n == 0) {
+		*this = x;
+	} else if ((buf == x.buf) && ((off + n) == x.off)) {
+		n += x.n;
+	} else {
+		const double *b = x.begin();
+		append(b, b + x.n);
+	}
+}
+
+SpatValues SpatValues::view(size_t offset, size_t size) const {
+	SpatValues out;
+	if (size > 0) {
+		out.buf = buf;
+		out.off = off + offset;
+		out.n = size;
+	}
+	return out;
+}
+
+
+bool SpatValues::map_file(const std::string &filename, size_t offset, size_t size) {
+#ifdef _WIN32
+	return false;
+#else
+	if ((size == 0) || ((offset % sizeof(double)) != 0)) return false;
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	size_t nbytes = size * sizeof(double);
+	if ((fstat(fd, &st) != 0) || ((size_t) st.st_size < (offset + nbytes))) {
+		close(fd);
+		return false;
+	}
+	// the mapping must start at a page boundary
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t start = offset - (offset % page);
+	size_t len = nbytes + (offset - start);
+	void *addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, start);
+	close(fd);
+	if (addr == MAP_FAILED) return false;
+	std::shared_ptr<SpatBuffer> b = std::make_shared<SpatBuffer>();
+	b->addr = addr;
+	b->len = len;
+	b->mapped = (const double *) ((const char *) addr + (offset - start));
+	buf = b;
+	off = 0;
+	n = size;
+	return true;
+#endif
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATVALUES_GUARD
+#define SPATVALUES_GUARD
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstddef>
+
+
+// the storage of a SpatValues object; either a vector or
+// a read-only memory mapped region of a file
+class SpatBuffer {
+	public:
+		SpatBuffer() {}
+		SpatBuffer(const std::vector<double> &v) : v(v) {}
+		SpatBuffer(std::vector<double> &&v) : v(std::move(v)) {}
+		~SpatBuffer();
+		SpatBuffer(const SpatBuffer&) = delete;
+		SpatBuffer& operator=(const SpatBuffer&) = delete;
+
+		std::vector<double> v;
+		void *addr = nullptr;
+		size_t len = 0;
+		const double *mapped = nullptr;
+		const double *data() const { return mapped ? mapped : v.data(); }
+};
+
+
+// The cell values of an in-memory SpatRasterSource. Copies share the
+// same storage until one of them is changed (copy-on-write), and a
+// range of layers can be a view on the storage of another object.
+// Values can only be changed through "unique", "resize", "reserve"
+// and "append", such that reading never triggers a copy.
+class SpatValues {
+	public:
+		SpatValues() {}
+		SpatValues(const std::vector<double> &x);
+		SpatValues(std::vector<double> &&x);
+		SpatValues& operator=(const std::vector<double> &x);
+		SpatValues& operator=(std::vector<double> &&x);
+
+		size_t size() const { return n; }
+		bool empty() const { return n == 0; }
+		size_t max_size() const { return std::vector<double>().max_size(); }
+		const double *data() const { return n == 0 ? nullptr : buf->data() + off; }
+		const double *begin() const { return data(); }
+		const double *end() const { return data() + n; }
+		double operator[](size_t i) const { return buf->data()[off + i]; }
+
+		// a pointer to values that can be changed. Shared or mapped values are copied first
+		double *unique();
+		void resize(size_t size, double x=0);
+		void reserve(size_t size);
+		void append(const double *b, const double *e);
+		// shares the storage if "x" directly follows these values in the same buffer
+		void append(const SpatValues &x);
+		// "size" values starting at "offset", sharing the storage
+		SpatValues view(size_t offset, size_t size) const;
+
+		bool shared() const { return buf && (buf.use_count() > 1); }
+		bool mapped() const { return buf && (buf->mapped != nullptr); }
+		// map "size" doubles starting at byte "offset" of a file (read-only)
+		bool map_file(const std::string &filename, size_t offset, size_t size);
+
+	private:
+		std::shared_ptr<SpatBuffer> buf;
+		size_t off = 0;
+		size_t n = 0;
+		void detach(size_t reserve);
+};
+
+
+#endif
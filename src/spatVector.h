@@ -187,7 +187,8 @@ class SpatVector {
 		std::vector<double> distance(bool sequential);
 		std::vector<double> linedistLonLat(SpatVector pts);
 
-		std::vector<std::vector<size_t>> knearest(size_t k);
+		std::vector<std::vector<double>> knearest(SpatVector y, size_t k, bool self);
+		std::vector<std::vector<double>> within_distance(SpatVector y, double d, bool self);
 
 		size_t size();
 		SpatVector as_lines();
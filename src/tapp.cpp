@@ -0,0 +1,324 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include "spatTime.h"
+#include "vecmath.h"
+#include <map>
+
+#ifdef useGDAL
+#include "gdalio.h"
+#include "cpl_worker_thread_pool.h"
+#endif
+
+
+static inline int_64 floor_div(int_64 a, int_64 b) {
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static std::string pad2(int x) {
+	return (x < 10 ? "0" : "") + std::to_string(x);
+}
+
+
+// the group (output layer) of each layer for a time period. Groups are
+// numbered in the order in which they first occur. "start" is the start
+// of the period of each group, or empty for climatologies (e.g. "months")
+static bool time_groups(const std::vector<int_64> &time, const std::string &period, std::vector<size_t> &index, std::vector<std::string> &names, std::vector<int_64> &start, std::string &msg) {
+
+	std::vector<std::string> periods {"years", "months", "yearmonths", "seasons", "yearseasons", "dekads", "yeardekads", "weeks", "yearweeks", "doy", "days"};
+	if (std::find(periods.begin(), periods.end(), period) == periods.end()) {
+		msg = "unknown period: " + period;
+		return false;
+	}
+	bool climate = (period == "months") || (period == "seasons") || (period == "dekads") || (period == "weeks") || (period == "doy");
+	const std::vector<std::string> snames {"DJF", "MAM", "JJA", "SON"};
+
+	std::map<int_64, size_t> groups;
+	index.resize(0);
+	names.resize(0);
+	start.resize(0);
+	for (size_t i=0; i<time.size(); i++) {
+		std::vector<int> d = get_date(time[i]);
+		int y = d[0], m = d[1], day = d[2];
+		int_64 days = floor_div(time[i], 86400);
+		int_64 key = 0, first = 0;
+		std::string name;
+		if (period == "years") {
+			key = y;
+			name = "y_" + std::to_string(y);
+			first = get_time(y, 1, 1, 0, 0, 0);
+		} else if (period == "months") {
+			key = m;
+			name = "m_" + std::to_string(m);
+		} else if (period == "yearmonths") {
+			key = y * 100 + m;
+			name = "ym_" + std::to_string(y) + pad2(m);
+			first = get_time(y, m, 1, 0, 0, 0);
+		} else if ((period == "seasons") || (period == "yearseasons")) {
+			// December is part of the winter (DJF) of the next year
+			int s = (m % 12) / 3;
+			if (period == "seasons") {
+				key = s;
+				name = snames[s];
+			} else {
+				int sy = m == 12 ? y + 1 : y;
+				key = sy * 10 + s;
+				name = snames[s] + "_" + std::to_string(sy);
+				first = s == 0 ? get_time(sy-1, 12, 1, 0, 0, 0) : get_time(sy, 3*s, 1, 0, 0, 0);
+			}
+		} else if ((period == "dekads") || (period == "yeardekads")) {
+			int dk = std::min(2, (day-1) / 10);
+			int k = (m-1) * 3 + dk + 1;
+			if (period == "dekads") {
+				key = k;
+				name = "d_" + std::to_string(k);
+			} else {
+				key = y * 100 + k;
+				name = "yd_" + std::to_string(y) + pad2(k);
+				first = get_time(y, m, 1 + dk * 10, 0, 0, 0);
+			}
+		} else if ((period == "weeks") || (period == "yearweeks")) {
+			// ISO 8601: weeks start on Monday, and the first week of a year
+			// has its first Thursday. 1970-01-01 was a Thursday
+			int_64 dow = days - 7 * floor_div(days + 3, 7) + 3;
+			int_64 thu = days - dow + 3;
+			int wy = get_date(thu * 86400)[0];
+			int wk = (thu - floor_div(get_time(wy, 1, 1, 0, 0, 0), 86400)) / 7 + 1;
+			if (period == "weeks") {
+				key = wk;
+				name = "w_" + std::to_string(wk);
+			} else {
+				key = wy * 100 + wk;
+				name = "yw_" + std::to_string(wy) + pad2(wk);
+				first = (days - dow) * 86400;
+			}
+		} else if (period == "doy") {
+			key = days - floor_div(get_time(y, 1, 1, 0, 0, 0), 86400) + 1;
+			name = "doy_" + std::to_string(key);
+		} else { // days
+			key = (int_64) y * 10000 + m * 100 + day;
+			name = "ymd_" + std::to_string(y) + pad2(m) + pad2(day);
+			first = days * 86400;
+		}
+		std::map<int_64, size_t>::iterator it = groups.find(key);
+		if (it == groups.end()) {
+			groups[key] = names.size();
+			index.push_back(names.size());
+			names.push_back(name);
+			if (!climate) start.push_back(first);
+		} else {
+			index.push_back(it->second);
+		}
+	}
+	return true;
+}
+
+
+struct TappJob {
+	const double *a;
+	size_t nc;
+	const std::vector<std::vector<size_t>> *groups;
+	size_t g0, g1;
+	std::string fun;
+	bool narm;
+	double *out;
+};
+
+
+static void tapp_groups(TappJob &job) {
+	std::vector<double> add;
+	for (size_t k=job.g0; k<job.g1; k++) {
+		const std::vector<size_t> &g = (*job.groups)[k];
+		double *out = job.out + k * job.nc;
+		if (g.empty()) {
+			std::fill(out, out + job.nc, NAN);
+		} else {
+			reduceLayers(job.fun, job.a, job.nc, g, add, job.narm, out);
+		}
+	}
+}
+
+
+#ifdef useGDAL
+static void tapp_job(void *data) {
+	tapp_groups(*static_cast<TappJob*>(data));
+}
+#endif
+
+
+// all groups are computed from a single read of each block. The groups
+// of a block are divided over the threads
+static bool reduce_groups(SpatRaster &x, SpatRaster &out, const std::vector<std::vector<size_t>> &groups, const std::string &fun, bool narm, SpatOptions &opt) {
+
+	std::vector<std::string> f {"sum", "mean", "min", "max", "prod", "sd", "std", "count"};
+	if (std::find(f.begin(), f.end(), fun) == f.end()) {
+		out.setError("unknown function argument: " + fun);
+		return false;
+	}
+	if (!x.hasValues()) return true;
+
+	// the blocks of the output must also fit the input layers
+	size_t ng = groups.size();
+	opt.ncopies = std::max(opt.ncopies, (unsigned) (2 * (x.nlyr() + ng) / std::max((size_t)1, ng) + 1));
+
+	if (!x.readStart()) {
+		out.setError(x.getError());
+		return false;
+	}
+ 	if (!out.writeStart(opt)) {
+		x.readStop();
+		return false;
+	}
+
+	size_t nthreads = 1;
+#ifdef useGDAL
+	nthreads = std::min((size_t)gdal_read_threads(), ng);
+	CPLWorkerThreadPool pool;
+	if ((nthreads > 1) && (!pool.Setup(nthreads, NULL, NULL))) {
+		nthreads = 1;
+	}
+#endif
+	nthreads = std::max((size_t)1, nthreads);
+	size_t step = (ng + nthreads - 1) / nthreads;
+
+	for (size_t i=0; i<out.bs.n; i++) {
+		size_t nc = out.bs.nrows[i] * x.ncol();
+		std::vector<double> a;
+		x.readBlock(a, out.bs, i);
+		std::vector<double> b(nc * ng);
+		std::vector<TappJob> jobs(nthreads);
+		for (size_t j=0; j<nthreads; j++) {
+			TappJob &job = jobs[j];
+			job.a = a.data();
+			job.nc = nc;
+			job.groups = &groups;
+			job.g0 = std::min(ng, j * step);
+			job.g1 = std::min(ng, (j+1) * step);
+			job.fun = fun;
+			job.narm = narm;
+			job.out = b.data();
+		}
+#ifdef useGDAL
+		if (nthreads > 1) {
+			for (size_t j=0; j<nthreads; j++) {
+				pool.SubmitJob(tapp_job, &jobs[j]);
+			}
+			pool.WaitCompletion();
+		} else {
+			tapp_groups(jobs[0]);
+		}
+#else
+		tapp_groups(jobs[0]);
+#endif
+		if (!out.writeBlock(b, i)) {
+			x.readStop();
+			return false;
+		}
+	}
+	x.readStop();
+	out.writeStop();
+	return true;
+}
+
+
+static bool raster_time_groups(SpatRaster &x, const std::string &period, std::vector<size_t> &index, std::vector<std::string> &names, std::vector<int_64> &start, std::string &msg) {
+	if (!x.hasTime()) {
+		msg = "the raster has no time values";
+		return false;
+	}
+	if (x.getTimeStep() == "raw") {
+		msg = "the time values of the raster are not dates";
+		return false;
+	}
+	return time_groups(x.getTime(), period, index, names, start, msg);
+}
+
+
+std::vector<std::string> SpatRaster::timeIndex(std::string period) {
+	std::vector<size_t> index;
+	std::vector<std::string> names, out;
+	std::vector<int_64> start;
+	std::string msg;
+	if (!raster_time_groups(*this, period, index, names, start, msg)) {
+		setError(msg);
+		return out;
+	}
+	out.reserve(index.size());
+	for (size_t i : index) out.push_back(names[i]);
+	return out;
+}
+
+
+SpatRaster SpatRaster::tapp(std::string period, std::string fun, bool narm, SpatOptions &opt) {
+
+	std::vector<size_t> index;
+	std::vector<std::string> names;
+	std::vector<int_64> start;
+	std::string msg;
+	if (!raster_time_groups(*this, period, index, names, start, msg)) {
+		SpatRaster out;
+		out.setError(msg);
+		return out;
+	}
+	SpatRaster out = geometry(names.size(), false, false);
+	out.setNames(names);
+	if (!start.empty()) {
+		out.setTime(start, "days");
+	}
+	std::vector<std::vector<size_t>> groups(names.size());
+	for (size_t i=0; i<index.size(); i++) {
+		groups[index[i]].push_back(i);
+	}
+	reduce_groups(*this, out, groups, fun, narm, opt);
+	return out;
+}
+
+
+// a moving window of n layers, centered ("around"), ending ("to") or
+// starting ("from") at each layer. Windows that extend beyond the first or
+// last layer are NA
+SpatRaster SpatRaster::roll(unsigned n, std::string type, std::string fun, bool narm, SpatOptions &opt) {
+
+	size_t nl = nlyr();
+	SpatRaster out = geometry(nl, true);
+	if (n < 1) {
+		out.setError("n should be larger than zero");
+		return out;
+	}
+	size_t off;
+	if (type == "around") {
+		off = (n - 1) / 2;
+	} else if (type == "to") {
+		off = n - 1;
+	} else if (type == "from") {
+		off = 0;
+	} else {
+		out.setError("type should be 'around', 'to' or 'from'");
+		return out;
+	}
+	std::vector<std::vector<size_t>> groups(nl);
+	for (size_t i=0; i<nl; i++) {
+		if ((i < off) || ((i - off + n) > nl)) continue;
+		for (size_t j=(i-off); j<(i-off+n); j++) {
+			groups[i].push_back(j);
+		}
+	}
+	reduce_groups(*this, out, groups, fun, narm, opt);
+	return out;
+}
+
@@ -0,0 +1,343 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include "distance.h"
+#include <cmath>
+#include <random>
+#include <numeric>
+#include <algorithm>
+
+#ifdef useGDAL
+#include "gdalio.h"
+#include "cpl_worker_thread_pool.h"
+#endif
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+
+
+enum TerrainVar { tSlope, tAspect, tTPI, tTRI, tRoughness, tFlowdir, tHillshade, tPlanCurv, tProfCurv };
+
+struct TerrainPars {
+	std::vector<TerrainVar> vars;
+	unsigned ngb;
+	bool degrees;
+	bool lonlat;
+	// cell size; for lon/lat "dx" varies by row and is taken from "ddx"
+	double dx, dy;
+	std::vector<double> ddx;
+	// cell size used for flowdir (for lon/lat, that of the middle row)
+	double fdx, fdy;
+	double zenith, direction;
+	unsigned seed;
+};
+
+struct TerrainJob {
+	const TerrainPars *p;
+	const double *d;
+	size_t nc;
+	// the rows of "d" to compute, and the raster row of the first row of "d"
+	size_t r0, r1, drow;
+	// the raster row of the first row of the output block
+	size_t orow;
+	std::vector<double*> out;
+};
+
+
+static inline double dmod(double x, double n) {
+	return(x - n * std::floor(x/n));
+}
+
+
+// all variables are computed from the same 3x3 window. Cells in the first
+// and last columns, and in the rows for which there is no window, stay NA.
+static void terrain_rows(TerrainJob &job) {
+
+	const TerrainPars &p = *job.p;
+	const double *d = job.d;
+	size_t nc = job.nc;
+	size_t nv = p.vars.size();
+	const double twoPI = 2 * M_PI;
+	const double halfPI = M_PI / 2;
+	const double todeg = 180 / M_PI;
+	const double flow[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+	double fdxy = std::sqrt(p.fdx * p.fdx + p.fdy * p.fdy);
+	double r[8];
+
+	for (size_t row=job.r0; row<job.r1; row++) {
+		size_t grow = job.drow + row;
+		size_t off = (grow - job.orow) * nc;
+		double dx = p.lonlat ? p.ddx[grow] : p.dx;
+		double dy = p.dy;
+		// ties in flowdir are broken the same way, regardless of the blocks
+		std::default_random_engine generator(p.seed + grow);
+		std::uniform_int_distribution<> U(0, 1);
+
+		for (size_t col=1; col<(nc-1); col++) {
+			size_t i = row * nc + col;
+			double nw = d[i-1-nc], n = d[i-nc], ne = d[i+1-nc];
+			double w = d[i-1], z = d[i], e = d[i+1];
+			double sw = d[i-1+nc], s = d[i+nc], se = d[i+1+nc];
+
+			double zx, zy;
+			if (p.ngb == 4) {
+				zx = (w - e) / (2 * dx);
+				zy = (s - n) / (2 * dy);
+			} else {
+				zx = ((nw + 2 * w + sw) - (ne + 2 * e + se)) / (8 * dx);
+				zy = ((sw + 2 * s + se) - (nw + 2 * n + ne)) / (8 * dy);
+			}
+
+			for (size_t k=0; k<nv; k++) {
+				double val;
+				switch (p.vars[k]) {
+					case tSlope:
+						val = std::atan(std::sqrt(zx * zx + zy * zy));
+						if (p.degrees) val *= todeg;
+						break;
+					case tAspect:
+						val = dmod(halfPI - std::atan2(zy, zx), twoPI);
+						if (p.degrees) val *= todeg;
+						break;
+					case tHillshade: {
+						double slp = std::atan(std::sqrt(zx * zx + zy * zy));
+						double asp = dmod(halfPI - std::atan2(zy, zx), twoPI);
+						val = std::cos(slp) * std::cos(p.zenith) + std::sin(slp) * std::sin(p.zenith) * std::cos(p.direction - asp);
+						break;
+					}
+					case tTPI:
+						val = z - (nw + n + ne + w + e + sw + s + se) / 8;
+						break;
+					case tTRI:
+						val = (std::fabs(nw-z) + std::fabs(w-z) + std::fabs(sw-z) + std::fabs(n-z) + std::fabs(s-z) + std::fabs(ne-z) + std::fabs(e-z) + std::fabs(se-z)) / 8;
+						break;
+					case tRoughness: {
+						double a[8] = {w, sw, n, z, s, ne, e, se};
+						double mn = nw, mx = nw;
+						for (size_t j=0; j<8; j++) {
+							if (a[j] > mx) {
+								mx = a[j];
+							} else if (a[j] < mn) {
+								mn = a[j];
+							}
+						}
+						val = mx - mn;
+						break;
+					}
+					case tFlowdir: {
+						if (std::isnan(z)) {
+							val = NAN;
+							break;
+						}
+						r[0] = (z - e) / p.fdx;
+						r[1] = (z - se) / fdxy;
+						r[2] = (z - s) / p.fdy;
+						r[3] = (z - sw) / fdxy;
+						r[4] = (z - w) / p.fdx;
+						r[5] = (z - nw) / fdxy;
+						r[6] = (z - n) / p.fdy;
+						r[7] = (z - ne) / fdxy;
+						// using the lowest neighbor, even if it is higher than the focal cell.
+						double dmin = r[0];
+						int m = 0;
+						for (size_t j=1; j<8; j++) {
+							if (r[j] > dmin) {
+								dmin = r[j];
+								m = j;
+							} else if (r[j] == dmin) {
+								if (U(generator)) {
+									dmin = r[j];
+									m = j;
+								}
+							}
+						}
+						val = flow[m];
+						break;
+					}
+					default: { // curvature (Zevenbergen and Thorne, 1987)
+						double D = ((w + e) / 2 - z) / (dx * dx);
+						double E = ((n + s) / 2 - z) / (dy * dy);
+						double F = (-nw + ne + sw - se) / (4 * dx * dy);
+						double G = (e - w) / (2 * dx);
+						double H = (n - s) / (2 * dy);
+						double GH = G * G + H * H;
+						if (GH == 0) {
+							val = std::isnan(D + E + F) ? NAN : 0;
+						} else if (p.vars[k] == tProfCurv) {
+							val = -2 * (D * G * G + E * H * H + F * G * H) / GH;
+						} else {
+							val = 2 * (D * H * H + E * G * G - F * G * H) / GH;
+						}
+					}
+				}
+				job.out[k][off + col] = val;
+			}
+		}
+	}
+}
+
+
+#ifdef useGDAL
+static void terrain_job(void *data) {
+	terrain_rows(*static_cast<TerrainJob*>(data));
+}
+#endif
+
+
+SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, bool degrees, unsigned seed, double angle, double direction, SpatOptions &opt) {
+
+	SpatRaster out = geometry(v.size());
+	out.setNames(v);
+
+	if (nlyr() > 1) {
+		out.setError("terrain needs a single layer object");
+		return out;
+	}
+
+	TerrainPars p;
+	std::vector<std::string> f {"slope", "aspect", "TPI", "TRI", "roughness", "flowdir", "hillshade", "plancurv", "profcurv"};
+	for (size_t i=0; i<v.size(); i++) {
+		size_t j = std::find(f.begin(), f.end(), v[i]) - f.begin();
+		if (j == f.size()) {
+			out.setError("unknown terrain variable: " + v[i]);
+			return(out);
+		}
+		p.vars.push_back((TerrainVar) j);
+	}
+
+	if ((neighbors != 4) && (neighbors != 8)) {
+		out.setError("neighbors should be 4 or 8");
+		return out;
+	}
+
+	p.ngb = neighbors;
+	p.degrees = degrees;
+	p.seed = seed;
+	p.zenith = (90 - angle) * M_PI / 180;
+	p.direction = direction * M_PI / 180;
+	p.lonlat = is_lonlat();
+	p.dx = xres();
+	p.dy = yres();
+	p.fdx = p.dx;
+	p.fdy = p.dy;
+	if (p.lonlat) {
+		// the width of the cells in each row is only computed once
+		std::vector<int_64> rows(nrow());
+		std::iota(rows.begin(), rows.end(), 0);
+		std::vector<double> y = yFromRow(rows);
+		p.ddx.resize(nrow());
+		for (size_t i=0; i<p.ddx.size(); i++) {
+			p.ddx[i] = distHaversine(-p.dx, y[i], p.dx, y[i]) / 2;
+		}
+		p.dy = distHaversine(0, 0, 0, yres());
+		double yhalf = yFromRow((size_t) nrow()/2);
+		p.fdx = distHaversine(0, yhalf, xres(), yhalf);
+		p.fdy = p.dy;
+	}
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+
+	opt.minrows = 3;
+  	if (!out.writeStart(opt)) {
+		readStop();
+		return out;
+	}
+	size_t nc = ncol();
+	size_t nv = v.size();
+
+	if (nrow() < 3 || nc < 3) {
+		for (size_t i = 0; i < out.bs.n; i++) {
+			std::vector<double> val(out.bs.nrows[i] * nc * nv, NAN);
+			if (!out.writeBlock(val, i)) return out;
+		}
+		out.writeStop();
+		readStop();
+		return out;
+	}
+
+	size_t nthreads = 1;
+#ifdef useGDAL
+	nthreads = gdal_read_threads();
+	CPLWorkerThreadPool pool;
+	if ((nthreads > 1) && (!pool.Setup(nthreads, NULL, NULL))) {
+		nthreads = 1;
+	}
+#endif
+
+	for (size_t i = 0; i < out.bs.n; i++) {
+		// one row above and below the block, if available
+		size_t rrow = out.bs.row[i];
+		size_t rnrw = out.bs.nrows[i];
+		if (i > 0) {
+			rrow--;
+			rnrw++;
+		}
+		if ((out.bs.row[i] + out.bs.nrows[i]) < nrow()) {
+			rnrw++;
+		}
+		std::vector<double> d;
+		readValues(d, rrow, rnrw, 0, nc);
+
+		size_t ncell = out.bs.nrows[i] * nc;
+		std::vector<double> val(ncell * nv, NAN);
+		std::vector<double*> lyrs(nv);
+		for (size_t k=0; k<nv; k++) lyrs[k] = &val[k * ncell];
+
+		// the rows of the block are divided into strips that are computed concurrently
+		size_t nr = rnrw < 3 ? 0 : rnrw - 2;
+		if (nr == 0) {
+			if (!out.writeBlock(val, i)) return out;
+			continue;
+		}
+		size_t nj = std::min(nthreads, nr);
+		size_t step = (nr + nj - 1) / nj;
+		std::vector<TerrainJob> jobs(nj);
+		for (size_t j=0; j<nj; j++) {
+			TerrainJob &job = jobs[j];
+			job.p = &p;
+			job.d = d.data();
+			job.nc = nc;
+			job.r0 = 1 + j * step;
+			job.r1 = std::min(1 + (j+1) * step, rnrw - 1);
+			job.drow = rrow;
+			job.orow = out.bs.row[i];
+			job.out = lyrs;
+		}
+#ifdef useGDAL
+		if (nj > 1) {
+			for (size_t j=0; j<nj; j++) {
+				pool.SubmitJob(terrain_job, &jobs[j]);
+			}
+			pool.WaitCompletion();
+		} else {
+			terrain_rows(jobs[0]);
+		}
+#else
+		terrain_rows(jobs[0]);
+#endif
+		if (!out.writeBlock(val, i)) return out;
+	}
+	out.writeStop();
+	readStop();
+	return out;
+}
+
@@ -0,0 +1,268 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include "file_utils.h"
+#include <cmath>
+
+#ifdef useGDAL
+#include "gdalio.h"
+#include "cpl_worker_thread_pool.h"
+#endif
+
+
+struct TileJob {
+	SpatRaster r;
+	std::string filename;
+	// the first row and column of the tile in the source raster
+	size_t row, col;
+	// the values of the current strip
+	const double *strip;
+	size_t srow, snrow, sncol;
+	std::vector<double> v;
+	bool hasdata = false;
+	bool started = false;
+	// rows with only NA that have not been written yet
+	size_t pending = 0;
+	bool ok = true;
+	// the GDAL error message of a job that failed in a thread
+	std::string msg;
+};
+
+
+// copy the part of a strip of rows that covers the tile
+static void tile_extract(TileJob &t) {
+	size_t nc = t.r.ncol();
+	size_t nl = t.r.nlyr();
+	size_t n = t.snrow * nc;
+	t.v.resize(n * nl);
+	t.hasdata = false;
+	for (size_t k=0; k<nl; k++) {
+		for (size_t i=0; i<t.snrow; i++) {
+			const double *s = t.strip + (k * t.snrow + i) * t.sncol + t.col;
+			double *d = &t.v[k * n + i * nc];
+			for (size_t j=0; j<nc; j++) {
+				d[j] = s[j];
+				t.hasdata = t.hasdata || !std::isnan(s[j]);
+			}
+		}
+	}
+}
+
+
+static void tile_write(TileJob &t) {
+	if (!t.started || !t.ok) return;
+	size_t nc = t.r.ncol();
+	size_t nl = t.r.nlyr();
+	size_t row = t.srow - t.row;
+	if (t.pending > 0) {
+		std::vector<double> na(t.pending * nc * nl, NAN);
+		t.ok = t.r.writeValues(na, row - t.pending, t.pending);
+		t.pending = 0;
+	}
+	if (t.ok) {
+		t.ok = t.r.writeValues(t.v, row, t.snrow);
+	}
+}
+
+
+static void tile_stop(TileJob &t) {
+	if (t.started) {
+		t.ok = t.r.writeStop() && t.ok;
+	}
+}
+
+
+static void tile_extract_job(void *data) {
+	tile_extract(*static_cast<TileJob*>(data));
+}
+
+#ifdef useGDAL
+// the default error handler calls R, which is not allowed from a thread
+static void tile_quiet(TileJob &t, void (*fun)(TileJob&)) {
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+	CPLErrorReset();
+	fun(t);
+	if ((!t.ok) && (CPLGetLastErrorMsg()[0] != '\0')) {
+		t.msg = CPLGetLastErrorMsg();
+	}
+	CPLPopErrorHandler();
+}
+#endif
+
+static void tile_write_job(void *data) {
+#ifdef useGDAL
+	tile_quiet(*static_cast<TileJob*>(data), tile_write);
+#endif
+}
+static void tile_stop_job(void *data) {
+#ifdef useGDAL
+	tile_quiet(*static_cast<TileJob*>(data), tile_stop);
+#endif
+}
+
+
+static std::string tile_error(TileJob &t) {
+	std::string msg = t.r.getError();
+	if (msg.empty()) msg = "cannot write " + t.filename;
+	if (!t.msg.empty()) msg += " (" + t.msg + ")";
+	return msg;
+}
+
+
+static void run_tiles(std::vector<TileJob*> &tiles, void (*fun)(TileJob&), void (*job)(void*), void *pool) {
+#ifdef useGDAL
+	if ((pool != NULL) && (tiles.size() > 1)) {
+		CPLWorkerThreadPool *p = static_cast<CPLWorkerThreadPool*>(pool);
+		for (size_t i=0; i<tiles.size(); i++) {
+			p->SubmitJob(job, tiles[i]);
+		}
+		p->WaitCompletion();
+		return;
+	}
+#endif
+	for (size_t i=0; i<tiles.size(); i++) fun(*tiles[i]);
+}
+
+
+// The tiles are the cells of "x". The source is read once, by strips of
+// rows that are copied to all the tiles in the same row of tiles. The
+// tiles of a strip are written, and at the end closed (and compressed),
+// concurrently. With "narm", a tile is only created when it gets a value
+// that is not NA.
+std::vector<std::string> SpatRaster::make_tiles(SpatRaster x, bool expand, bool narm, std::string filename, SpatOptions &opt) {
+
+	std::vector<std::string> ff;
+	if (!hasValues()) {
+		setError("input raster has no values");
+		return ff;
+	}
+	x = x.geometry(1, false, false, false);
+	SpatExtent e = getExtent();
+	if (expand) {
+		x = x.extend(e, "out", opt);
+	}
+	x = x.crop(e, "out", opt);
+
+	std::string fext = getFileExt(filename);
+	std::string f = noext(filename);
+	size_t nl = nlyr();
+	size_t ntiles = x.ncell();
+	double xr = xres();
+	double yr = yres();
+
+	SpatOptions topt(opt);
+	topt.progressbar = false;
+	SpatRaster g = geometry(nl, true, true, true);
+	std::vector<TileJob> tiles(ntiles);
+	for (size_t i=0; i<ntiles; i++) {
+		TileJob &t = tiles[i];
+		t.filename = f + std::to_string(i+1) + fext;
+		t.r = g.crop(x.ext_from_cell(i), "near", topt);
+		if (t.r.hasError()) {
+			setError(t.r.getError());
+			return ff;
+		}
+		SpatExtent te = t.r.getExtent();
+		t.row = rowFromY(te.ymax - 0.5 * yr);
+		t.col = colFromX(te.xmin + 0.5 * xr);
+	}
+
+	size_t nthreads = 1;
+	void *pool = NULL;
+#ifdef useGDAL
+	nthreads = std::min((size_t)gdal_read_threads(), ntiles);
+	CPLWorkerThreadPool wpool;
+	if ((nthreads > 1) && wpool.Setup(nthreads, NULL, NULL)) {
+		pool = &wpool;
+	}
+#endif
+
+	if (!readStart()) {
+		return ff;
+	}
+	// the number of rows that are read at once
+	BlockSize bs = getBlockSize(opt);
+	size_t maxrows = std::max((size_t)1, (size_t)bs.nrows[0]);
+	size_t nc = ncol();
+	size_t xnc = x.ncol();
+	std::vector<double> v;
+	bool ok = true;
+
+	for (size_t xr0=0; (xr0<ntiles) && ok; xr0+=xnc) {
+		std::vector<TileJob*> trow;
+		for (size_t i=xr0; i<(xr0+xnc); i++) {
+			trow.push_back(&tiles[i]);
+		}
+		size_t r0 = tiles[xr0].row;
+		size_t r1 = r0 + tiles[xr0].r.nrow();
+		for (size_t row=r0; (row<r1) && ok; row+=maxrows) {
+			size_t nr = std::min(maxrows, r1 - row);
+			readValues(v, row, nr, 0, nc);
+			if (hasError()) {
+				ok = false;
+				break;
+			}
+			for (TileJob *t : trow) {
+				t->strip = v.data();
+				t->srow = row;
+				t->snrow = nr;
+				t->sncol = nc;
+			}
+			run_tiles(trow, tile_extract, tile_extract_job, pool);
+
+			// files are created here, not in the threads
+			for (TileJob *t : trow) {
+				if (t->started) continue;
+				if (narm && !t->hasdata) {
+					t->pending += nr;
+					continue;
+				}
+				topt.set_filenames({t->filename});
+				if (!t->r.writeStart(topt)) {
+					setError(t->r.getError());
+					ok = false;
+					break;
+				}
+				t->started = true;
+			}
+			if (!ok) break;
+			run_tiles(trow, tile_write, tile_write_job, pool);
+			for (TileJob *t : trow) {
+				if (!t->ok) {
+					setError(tile_error(*t));
+					ok = false;
+					break;
+				}
+			}
+		}
+		run_tiles(trow, tile_stop, tile_stop_job, pool);
+		for (TileJob *t : trow) {
+			if (ok && !t->ok) {
+				setError(tile_error(*t));
+				ok = false;
+			}
+			if (t->started) {
+				ff.push_back(t->filename);
+			}
+			t->v = std::vector<double>();
+		}
+	}
+	readStop();
+	return ff;
+}
+
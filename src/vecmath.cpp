@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <string>
 #include <functional>
+#include <cmath>
 #include "vecmath.h"
 
 
@@ -72,6 +73,150 @@ std::function<double(std::vector<double>&, bool)> getFun(std::string fun) {
 }
 
 
+// Layers are processed one at a time, updating an accumulator for each
+// cell, so that the inner loops run over contiguous cells without branches
+// and can be vectorized. "cnt" is the number of values that are not NA
+template <typename F>
+void reduce_kernel(const double *a, size_t nc, const std::vector<size_t> &lyrs, const std::vector<double> &add, double init, F f, std::vector<double> &acc, std::vector<double> &cnt) {
+	acc.assign(nc, init);
+	cnt.assign(nc, 0);
+	double *s = &acc[0];
+	double *n = &cnt[0];
+	for (size_t k=0; k<lyrs.size(); k++) {
+		const double *x = a + lyrs[k] * nc;
+		for (size_t j=0; j<nc; j++) {
+			bool na = std::isnan(x[j]);
+			s[j] = na ? s[j] : f(s[j], x[j]);
+			n[j] += na ? 0 : 1;
+		}
+	}
+	for (size_t k=0; k<add.size(); k++) {
+		if (std::isnan(add[k])) continue;
+		double x = add[k];
+		for (size_t j=0; j<nc; j++) {
+			s[j] = f(s[j], x);
+			n[j] += 1;
+		}
+	}
+}
+
+
+bool haveLayerFun(std::string fun) {
+	std::vector<std::string> f {"sum", "mean", "min", "max", "prod", "sd", "std"};
+	return std::find(f.begin(), f.end(), fun) != f.end();
+}
+
+
+// a: nc cells for each layer; out: nc cells
+void reduceLayers(std::string fun, const double *a, size_t nc, const std::vector<size_t> &lyrs, const std::vector<double> &add, bool narm, double *out) {
+
+	std::vector<double> acc, cnt;
+	if (fun == "min") {
+		reduce_kernel(a, nc, lyrs, add, INFINITY, [](double s, double x) { return x < s ? x : s; }, acc, cnt);
+	} else if (fun == "max") {
+		reduce_kernel(a, nc, lyrs, add, -INFINITY, [](double s, double x) { return x > s ? x : s; }, acc, cnt);
+	} else if (fun == "prod") {
+		reduce_kernel(a, nc, lyrs, add, 1, [](double s, double x) { return s * x; }, acc, cnt);
+	} else {
+		reduce_kernel(a, nc, lyrs, add, 0, [](double s, double x) { return s + x; }, acc, cnt);
+	}
+
+	if (fun == "count") {
+		for (size_t j=0; j<nc; j++) {
+			out[j] = cnt[j];
+		}
+		return;
+	}
+
+	// cells with any NA value (or only NA values if narm) are NA
+	double nv = lyrs.size() + add.size();
+	std::vector<char> ok(nc);
+	for (size_t j=0; j<nc; j++) {
+		ok[j] = (cnt[j] > 0) && (narm || (cnt[j] == nv));
+	}
+
+	if ((fun == "mean") || (fun == "sd") || (fun == "std")) {
+		for (size_t j=0; j<nc; j++) {
+			acc[j] = acc[j] / cnt[j];
+		}
+	}
+	if ((fun == "sd") || (fun == "std")) {
+		// sum of squared deviations from the mean
+		std::vector<double> ss(nc, 0);
+		for (size_t k=0; k<lyrs.size(); k++) {
+			const double *x = a + lyrs[k] * nc;
+			for (size_t j=0; j<nc; j++) {
+				double d = x[j] - acc[j];
+				ss[j] += std::isnan(x[j]) ? 0 : d * d;
+			}
+		}
+		for (size_t k=0; k<add.size(); k++) {
+			if (std::isnan(add[k])) continue;
+			for (size_t j=0; j<nc; j++) {
+				double d = add[k] - acc[j];
+				ss[j] += d * d;
+			}
+		}
+		double m = fun == "sd" ? 1 : 0;
+		for (size_t j=0; j<nc; j++) {
+			acc[j] = std::sqrt(ss[j] / (cnt[j] - m));
+			ok[j] = ok[j] && (cnt[j] > m);
+		}
+	}
+	for (size_t j=0; j<nc; j++) {
+		out[j] = ok[j] ? acc[j] : NAN;
+	}
+}
+
+
+// like vquantile, but using partial sorting, and reordering the values of v
+std::vector<double> vquantile_select(std::vector<double> &v, const std::vector<double> &probs, bool narm) {
+	size_t n = v.size();
+	size_t pn = probs.size();
+	if (n == 0) {
+		return std::vector<double>(pn, NAN);
+	}
+	if (n == 1) {
+		return std::vector<double>(pn, v[0]);
+	}
+	v.erase(std::remove_if(v.begin(), v.end(),
+		[](const double& value) { return std::isnan(value); }), v.end());
+	if (((!narm) && (v.size() < n)) || (v.size() == 0)) {
+		return std::vector<double>(pn, NAN);
+	}
+	n = v.size();
+
+	// the positions of the required values, in sorted order
+	std::vector<size_t> idx;
+	idx.reserve(2 * pn);
+	for (size_t i=0; i<pn; i++) {
+		double x = probs[i] * (n-1);
+		idx.push_back(std::floor(x));
+		idx.push_back(std::ceil(x));
+	}
+	std::sort(idx.begin(), idx.end());
+	idx.erase(std::unique(idx.begin(), idx.end()), idx.end());
+	size_t start = 0;
+	for (size_t i=0; i<idx.size(); i++) {
+		std::nth_element(v.begin()+start, v.begin()+idx[i], v.end());
+		start = idx[i] + 1;
+	}
+
+	std::vector<double> q(pn);
+	for (size_t i=0; i<pn; i++) {
+		double x = probs[i] * (n-1);
+		size_t x1 = std::floor(x);
+		size_t x2 = std::ceil(x);
+		if (x1 == x2) {
+			q[i] = v[x1];
+		} else {
+			q[i] = interpolate(x, v[x1], v[x2], x1, x2);
+		}
+	}
+	return q;
+}
+
+
 bool ball(const std::vector<bool>& v) {
     for (size_t i=0; i<v.size(); i++) {
 		if (!v[i]) return false;
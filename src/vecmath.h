@@ -32,6 +32,11 @@ std::function<double(std::vector<double>&, bool)> getFun(std::string fun);
 bool bany(const std::vector<bool>& v);
 bool ball(const std::vector<bool>& v);
 
+// reductions across the layers of a block of band sequential values
+bool haveLayerFun(std::string fun);
+void reduceLayers(std::string fun, const double *a, size_t nc, const std::vector<size_t> &lyrs, const std::vector<double> &add, bool narm, double *out);
+std::vector<double> vquantile_select(std::vector<double> &v, const std::vector<double> &probs, bool narm);
+
 
 template <typename T>
 std::vector<T> flatten(const std::vector<std::vector<T>>& v) {
@@ -280,7 +285,7 @@ template <typename T>
 double vsdpop(std::vector<T>& v, bool narm) {
 	double m = vmean(v, narm);
 	if (std::isnan(m)) return m;
-	double x = v[0];
+	double x = 0;
 	size_t n = 0;
 	for (size_t i=0; i<v.size(); i++) {
 		if (!is_NA(v[i])) {
@@ -0,0 +1,317 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include "distance.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#ifdef useGDAL
+#include "gdalio.h"
+#include "cpl_worker_thread_pool.h"
+#endif
+
+
+struct ViewObserver {
+	long row, col;
+	// cell size in meters (or map units) at the observer
+	double dx, dy;
+};
+
+// the elevation of the window around one observer (the area within
+// maxdist), and the cells of the window that the observer can see
+struct ViewWindow {
+	// the first row and column of the window in the raster
+	long row0, col0;
+	long nr, nc;
+	std::vector<double> z;
+	std::vector<unsigned char> mask;
+	// the observer, relative to the window
+	ViewObserver o;
+	double obsh, tgth;
+	// curvature and refraction correction: curvcoef / earth diameter
+	double curv;
+	double maxdist;
+};
+
+struct ViewJob {
+	std::vector<ViewWindow*> w;
+};
+
+
+// elevation along a ray, linearly interpolated between the two cells that
+// it passes between
+static inline double view_interpolate(const ViewWindow &w, long r, long c, double f, bool alongrow) {
+	double a = w.z[r * w.nc + c];
+	if (f <= 0) return a;
+	double b = alongrow ? w.z[r * w.nc + c + 1] : w.z[(r + 1) * w.nc + c];
+	if (std::isnan(a)) return b;
+	if (std::isnan(b)) return a;
+	return a + f * (b - a);
+}
+
+
+// R2 (Franklin and Ray, 1994): the cells on a ray from the observer to a
+// cell on the edge of the area are visible if the slope to them is not
+// lower than the highest slope to a cell between them and the observer
+static void view_ray(const ViewWindow &w, const ViewObserver &o, double zo, long trow, long tcol, unsigned char *mask) {
+	long dr = trow - o.row;
+	long dc = tcol - o.col;
+	long n = std::max(std::labs(dr), std::labs(dc));
+	double maxslope = -std::numeric_limits<double>::infinity();
+	bool major_col = std::labs(dc) >= std::labs(dr);
+	for (long t=1; t<=n; t++) {
+		double fr = o.row + (double) dr * t / n;
+		double fc = o.col + (double) dc * t / n;
+		double d = std::sqrt(std::pow((fr - o.row) * o.dy, 2) + std::pow((fc - o.col) * o.dx, 2));
+		if (d > w.maxdist) break;
+		long r, c;
+		double z;
+		if (major_col) {
+			c = o.col + (dc > 0 ? t : -t);
+			long r0 = std::floor(fr);
+			z = view_interpolate(w, r0, c, fr - r0, false);
+			r = std::lround(fr);
+		} else {
+			r = o.row + (dr > 0 ? t : -t);
+			long c0 = std::floor(fc);
+			z = view_interpolate(w, r, c0, fc - c0, true);
+			c = std::lround(fc);
+		}
+		if (std::isnan(z)) continue;
+		z -= w.curv * d * d;
+		if (((z + w.tgth - zo) / d) >= maxslope) {
+			mask[r * w.nc + c] = 1;
+		}
+		maxslope = std::max(maxslope, (z - zo) / d);
+	}
+}
+
+
+static void view_observer(ViewWindow &w) {
+	const ViewObserver &o = w.o;
+	w.mask.assign(w.nr * w.nc, 0);
+	double zo = w.z[o.row * w.nc + o.col];
+	if (std::isnan(zo)) return;
+	zo += w.obsh;
+	w.mask[o.row * w.nc + o.col] = 1;
+	long r1 = w.nr - 1;
+	long c1 = w.nc - 1;
+	for (long c=0; c<=c1; c++) {
+		view_ray(w, o, zo, 0, c, w.mask.data());
+		view_ray(w, o, zo, r1, c, w.mask.data());
+	}
+	for (long r=1; r<r1; r++) {
+		view_ray(w, o, zo, r, 0, w.mask.data());
+		view_ray(w, o, zo, r, c1, w.mask.data());
+	}
+}
+
+static void view_observers(ViewJob &job) {
+	for (size_t i=0; i<job.w.size(); i++) {
+		view_observer(*job.w[i]);
+	}
+}
+
+
+#ifdef useGDAL
+static void view_job(void *data) {
+	view_observers(*static_cast<ViewJob*>(data));
+}
+#endif
+
+
+SpatRaster SpatRaster::viewshed(std::vector<double> x, std::vector<double> y, double observer, double target, double curvcoef, double maxdist, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	out.setNames({"viewshed"});
+	if (nlyr() > 1) {
+		out.setError("viewshed needs a single layer object (elevation)");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("the input raster has no values");
+		return out;
+	}
+	if (x.size() != y.size()) {
+		out.setError("the number of x and y coordinates is not the same");
+		return out;
+	}
+	if (!(maxdist > 0)) {
+		out.setError("maxdist should be larger than zero");
+		return out;
+	}
+
+	bool lonlat = is_lonlat();
+	// the curvature correction is in the unit of the distances and elevations
+	double m = lonlat ? 1 : source[0].srs.to_meter();
+	m = std::isnan(m) ? 1 : m;
+	std::vector<int_64> rows = rowFromY(y);
+	std::vector<int_64> cols = colFromX(x);
+	// the window of each observer, in the order of its first row
+	std::vector<ViewWindow> win;
+	size_t wcells = 0;
+	long wrows = 0;
+	for (size_t i=0; i<rows.size(); i++) {
+		if ((rows[i] < 0) || (cols[i] < 0)) continue;
+		ViewWindow w;
+		ViewObserver &o = w.o;
+		o.dx = xres();
+		o.dy = yres();
+		if (lonlat) {
+			o.dx = distHaversine(x[i] - xres()/2, y[i], x[i] + xres()/2, y[i]);
+			o.dy = distHaversine(x[i], y[i] - yres()/2, x[i], y[i] + yres()/2);
+		}
+		long rr = nrow(), rc = ncol();
+		if (std::isfinite(maxdist)) {
+			rr = std::ceil(maxdist / o.dy);
+			rc = std::ceil(maxdist / o.dx);
+		}
+		w.row0 = std::max(0L, (long)rows[i] - rr);
+		w.col0 = std::max(0L, (long)cols[i] - rc);
+		w.nr = std::min((long)nrow() - 1, (long)rows[i] + rr) - w.row0 + 1;
+		w.nc = std::min((long)ncol() - 1, (long)cols[i] + rc) - w.col0 + 1;
+		o.row = rows[i] - w.row0;
+		o.col = cols[i] - w.col0;
+		w.obsh = observer;
+		w.tgth = target;
+		w.maxdist = maxdist;
+		w.curv = m * curvcoef / (2 * 6378137.0);
+		wcells = std::max(wcells, (size_t) (w.nr * w.nc));
+		wrows = std::max(wrows, w.nr);
+		win.push_back(w);
+	}
+	std::stable_sort(win.begin(), win.end(), [](const ViewWindow &a, const ViewWindow &b) {
+		return a.row0 < b.row0;
+	});
+
+	// The observers are processed in batches that are divided over the
+	// threads. The counts are kept for the rows of the current block and
+	// the rows of the windows that overlap it. Use smaller batches if the
+	// windows of a batch do not fit in memory
+	size_t nthreads = 1;
+#ifdef useGDAL
+	nthreads = std::max((size_t)1, std::min((size_t)gdal_read_threads(), win.size()));
+#endif
+	size_t nbatch = 0;
+	if (!win.empty()) {
+		SpatOptions wopt(opt);
+		wopt.set_todisk(false);
+		BlockSize bs = getBlockSize(opt);
+		size_t bsrows = *std::max_element(bs.nrows.begin(), bs.nrows.end());
+		SpatRaster band(bsrows + wrows, ncol(), 1, getExtent(), "");
+		wopt.ncopies = 2;
+		// one window (elevation and mask) per cell of a row of "cells"
+		SpatRaster cells(1, wcells, 1, getExtent(), "");
+		if (band.canProcessInMemory(wopt)) {
+			for (nbatch = 16 * nthreads; nbatch > 0; nbatch /= 2) {
+				wopt.ncopies = 2 * nbatch;
+				if (cells.canProcessInMemory(wopt)) break;
+			}
+		}
+		if (nbatch == 0) {
+			out.setError("the area within maxdist of an observer is too large to process in memory");
+			return out;
+		}
+		nthreads = std::min(nthreads, nbatch);
+	}
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+ 	if (!out.writeStart(opt)) {
+		readStop();
+		return out;
+	}
+
+#ifdef useGDAL
+	CPLWorkerThreadPool pool;
+	if ((nthreads > 1) && (!pool.Setup(nthreads, NULL, NULL))) {
+		nthreads = 1;
+	}
+#endif
+	size_t nc = ncol();
+	// the counts, from raster row "crow"
+	std::vector<double> count;
+	long crow = 0;
+	size_t next = 0;
+	for (size_t i = 0; i < out.bs.n; i++) {
+		long b1 = out.bs.row[i] + out.bs.nrows[i];
+		// all observers with a window that starts before the end of the block
+		while ((next < win.size()) && (win[next].row0 < b1)) {
+			size_t n = next;
+			while ((n < win.size()) && (win[n].row0 < b1) && ((n - next) < nbatch)) n++;
+			for (size_t j=next; j<n; j++) {
+				ViewWindow &w = win[j];
+				readValues(w.z, w.row0, w.nr, w.col0, w.nc);
+				if (hasError()) {
+					readStop();
+					out.writeStop();
+					out.setError(getError());
+					return out;
+				}
+			}
+			std::vector<ViewJob> jobs(nthreads);
+			for (size_t j=next; j<n; j++) {
+				jobs[(j - next) % nthreads].w.push_back(&win[j]);
+			}
+#ifdef useGDAL
+			if (nthreads > 1) {
+				for (size_t j=0; j<nthreads; j++) pool.SubmitJob(view_job, &jobs[j]);
+				pool.WaitCompletion();
+			} else {
+				view_observers(jobs[0]);
+			}
+#else
+			view_observers(jobs[0]);
+#endif
+			for (size_t j=next; j<n; j++) {
+				ViewWindow &w = win[j];
+				size_t need = (w.row0 + w.nr - crow) * nc;
+				if (count.size() < need) count.resize(need, 0);
+				for (long r=0; r<w.nr; r++) {
+					double *cr = &count[(w.row0 + r - crow) * nc + w.col0];
+					const unsigned char *mr = &w.mask[r * w.nc];
+					for (long c=0; c<w.nc; c++) cr[c] += mr[c];
+				}
+				w.z = std::vector<double>();
+				w.mask = std::vector<unsigned char>();
+			}
+			next = n;
+		}
+
+		std::vector<double> v;
+		readValues(v, out.bs.row[i], out.bs.nrows[i], 0, nc);
+		size_t nv = std::min(v.size(), count.size());
+		for (size_t j=0; j<v.size(); j++) {
+			if (std::isnan(v[j])) continue;
+			v[j] = j < nv ? count[j] : 0;
+		}
+		if (!out.writeBlock(v, i)) {
+			readStop();
+			return out;
+		}
+		// the rows of this block are done
+		count.erase(count.begin(), count.begin() + std::min(count.size(), v.size()));
+		crow = b1;
+	}
+	out.writeStop();
+	readStop();
+	return out;
+}
@@ -29,7 +29,7 @@ bool SpatRaster::writeValuesMem(std::vector<double> &vals, size_t startrow, size
 	} 
 
 	if (nlyr() == 1) {
-		source[0].values.insert(source[0].values.end(), vals.begin(), vals.end());
+		source[0].values.append(vals.data(), vals.data() + vals.size());
 		return true;
 	}
 
@@ -40,10 +40,11 @@ bool SpatRaster::writeValuesMem(std::vector<double> &vals, size_t startrow, size
 	size_t nc = ncell();
 	size_t ncols = ncol();
 	size_t chunk = nrows * ncols;
+	double *v = source[0].values.unique();
 	for (size_t i=0; i<nlyr(); i++) {
 		size_t off1 = i * chunk; 
 		size_t off2 = startrow * ncols + i * nc; 
-		std::copy( vals.begin()+off1, vals.begin()+off1+chunk, source[0].values.begin()+off2 );
+		std::copy( vals.begin()+off1, vals.begin()+off1+chunk, v+off2 );
 	}
 	return true;
 }
@@ -56,13 +57,14 @@ bool SpatRaster::writeValuesMemRect(std::vector<double> &vals, size_t startrow,
 
 	size_t nc = ncell();
 	size_t chunk = nrows * ncols;
+	double *v = source[0].values.unique();
 
 	for (size_t i=0; i<nlyr(); i++) {
 		unsigned off = i*chunk;
 		for (size_t r=0; r<nrows; r++) {
 			size_t start1 = r * ncols + off;
 			size_t start2 = (startrow+r)*ncol() + i*nc + startcol;
-			std::copy(vals.begin()+start1, vals.begin()+start1+ncols, source[0].values.begin()+start2);
+			std::copy(vals.begin()+start1, vals.begin()+start1+ncols, v+start2);
 		}
 	}
 	return true;
@@ -31,6 +31,7 @@
 #include "gdal_rat.h"
 
 #include "gdalio.h"
+#include "gdal_pool.h"
 /*
 void add_quotes(std::vector<std::string> &s) {
 	for (size_t i=0; i< s.size(); i++) {
@@ -639,111 +640,76 @@ bool SpatRaster::writeStartGDAL(SpatOptions &opt) {
 }
 
 
-/*
-void min_max_na(std::vector<double> &vals, const double &na, const double &mn, const double &mx) {
-	for (double &v : vals) { 
-		v = std::isnan(v) ? na : (v < mn ? na : (v > mx ? na : v)); 
+// one pass over the values of a layer: values that are NaN or outside of [lmin, lmax] 
+// are set to "na", the others are cast to the output type, and the range is tracked
+// the loop has no branches, so that it can be vectorized by the compiler
+template <typename T>
+void cast_na_minmax(const double *v, T *out, size_t n, const double na, const double lmin, const double lmax, double &vmin, double &vmax) {
+	double mn = std::numeric_limits<double>::infinity();
+	double mx = -mn;
+	for (size_t i=0; i<n; i++) {
+		double d = v[i];
+		bool ok = (d >= lmin) & (d <= lmax);
+		double r = ok ? d : na;
+		out[i] = (T) r;
+		mn = (ok & (d < mn)) ? d : mn;
+		mx = (ok & (d > mx)) ? d : mx;
+	}
+	if (mn > mx) {
+		vmin = NAN;
+		vmax = NAN;
+	} else {
+		vmin = mn;
+		vmax = mx;
 	}
 }
-*/
+
 
 template <typename T>
-void tmp_min_max_na(std::vector<T> &out, const std::vector<double> &v, const double &na, const double &mn, const double &mx) {
-	size_t n = v.size();
-	out.reserve(n);
-	for (size_t i=0; i<n; i++) { 
-		out.push_back(std::isnan(v[i]) ? na : (v[i] < mn ? na : (v[i] > mx ? na : v[i]))); 
+CPLErr write_typed(GDALDataset *poDS, GDALDataType gdt, std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols, size_t nl, const double na, const double lmin, const double lmax, std::vector<double> &vmin, std::vector<double> &vmax) {
+	size_t nc = nrows * ncols;
+	std::vector<T> vv(vals.size());
+	for (size_t i=0; i<nl; i++) {
+		size_t start = nc * i;
+		cast_na_minmax(&vals[start], &vv[start], nc, na, lmin, lmax, vmin[i], vmax[i]);
 	}
+	return poDS->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, gdt, nl, NULL, 0, 0, 0, NULL );
 }
 
 
 bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols){
 
-
 	CPLErr err = CE_None;
-	double vmin, vmax;
 	size_t nc = nrows * ncols;
 	size_t nl = nlyr();
 	std::string datatype = source[0].datatype;
-
-	if ((compute_stats) && (!gdal_stats)) {
-		for (size_t i=0; i < nl; i++) {
-			size_t start = nc * i;
-			if (datatype == "INT4S") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, (double)INT32_MIN, (double)INT32_MAX);
-			} else if (datatype == "INT2S") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, (double)INT16_MIN, (double)INT16_MAX);
-			} else if (datatype == "INT4U") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, 0.0, (double)UINT32_MAX);
-			} else if (datatype == "INT2U") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, 0.0, (double)UINT16_MAX);
-			} else if (datatype == "INT1U") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, 0.0, 255.0);
-			} else {
-				minmax(vals.begin()+start, vals.begin()+start+nc, vmin, vmax);
-			}
-			if (!std::isnan(vmin)) {
-				if (std::isnan(source[0].range_min[i])) {
-					source[0].range_min[i] = vmin;
-					source[0].range_max[i] = vmax;
-				} else {
-					source[0].range_min[i] = std::min(source[0].range_min[i], vmin);
-					source[0].range_max[i] = std::max(source[0].range_max[i], vmax);
-				}
-			}
-		}
-	}
-
+	std::vector<double> vmin(nl), vmax(nl);
 
 	int hasNA=0;
 	double na = source[0].gdalconnection->GetRasterBand(1)->GetNoDataValue(&hasNA);
+	GDALDataset *poDS = source[0].gdalconnection;
 	if ((datatype == "FLT8S") || (datatype == "FLT4S")) {
-		if (hasNA) {
-			size_t n = vals.size();
-			for (size_t i=0; i<n; i++) {
-				if (std::isnan(vals[i])) vals[i] = na;
-			}
+		double inf = std::numeric_limits<double>::infinity();
+		double fna = hasNA ? na : NAN;
+		for (size_t i=0; i < nl; i++) {
+			size_t start = nc * i;
+			cast_na_minmax(&vals[start], &vals[start], nc, fna, -inf, inf, vmin[i], vmax[i]);
 		}
-		err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vals[0], ncols, nrows, GDT_Float64, nl, NULL, 0, 0, 0, NULL );
+		err = poDS->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vals[0], ncols, nrows, GDT_Float64, nl, NULL, 0, 0, 0, NULL );
+	} else if (datatype == "INT4S") {
+		err = write_typed<int32_t>(poDS, GDT_Int32, vals, startrow, nrows, startcol, ncols, nl, na, (double)INT32_MIN, (double)INT32_MAX, vmin, vmax);
+	} else if (datatype == "INT2S") {
+		err = write_typed<int16_t>(poDS, GDT_Int16, vals, startrow, nrows, startcol, ncols, nl, na, (double)INT16_MIN, (double)INT16_MAX, vmin, vmax);
+	} else if (datatype == "INT4U") {
+		err = write_typed<uint32_t>(poDS, GDT_UInt32, vals, startrow, nrows, startcol, ncols, nl, na, 0, (double)UINT32_MAX, vmin, vmax);
+	} else if (datatype == "INT2U") {
+		err = write_typed<uint16_t>(poDS, GDT_UInt16, vals, startrow, nrows, startcol, ncols, nl, na, 0, (double)UINT16_MAX, vmin, vmax);
+	} else if (datatype == "INT1U") {
+		err = write_typed<uint8_t>(poDS, GDT_Byte, vals, startrow, nrows, startcol, ncols, nl, na, 0, 255, vmin, vmax);
 	} else {
-		if (datatype == "INT4S") {
-			//min_max_na(vals, na, (double)INT32_MIN, (double)INT32_MAX);
-			//std::vector<int32_t> vv(vals.begin(), vals.end());
-			std::vector<int32_t> vv;
-			tmp_min_max_na(vv, vals, na, (double)INT32_MIN, (double)INT32_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Int32, nl, NULL, 0, 0, 0, NULL );
-		} else if (datatype == "INT2S") {
-			//min_max_na(vals, na, (double)INT16_MIN, (double)INT16_MAX); 
-			//std::vector<int16_t> vv(vals.begin(), vals.end());
-			std::vector<int16_t> vv;
-			tmp_min_max_na(vv, vals, na, (double)INT16_MIN, (double)INT16_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Int16, nl, NULL, 0, 0, 0, NULL );
-		} else if (datatype == "INT4U") {
-			//min_max_na(vals, na, 0, (double)INT32_MAX * 2 - 1);
-			//std::vector<uint32_t> vv(vals.begin(), vals.end());
-			std::vector<uint32_t> vv;
-			tmp_min_max_na(vv, vals, na, 0, (double)UINT32_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_UInt32, nl, NULL, 0, 0, 0, NULL );
-		} else if (datatype == "INT2U") {
-			//min_max_na(vals, na, 0, (double)INT16_MAX * 2 - 1); 
-			//std::vector<uint16_t> vv(vals.begin(), vals.end());
-			std::vector<uint16_t> vv;
-			tmp_min_max_na(vv, vals, na, 0, (double)UINT16_MAX); 
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_UInt16, nl, NULL, 0, 0, 0, NULL );
-		} else if (datatype == "INT1U") {
-			//min_max_na(vals, na, 0, 255);
-			//std::vector<int8_t> vv(vals.begin(), vals.end());
-			std::vector<int8_t> vv;
-			tmp_min_max_na(vv, vals, na, 0, 255);
-			
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Byte, nl, NULL, 0, 0, 0, NULL );
-
-
-		} else {
-			setError("bad datatype");
-			GDALClose( source[0].gdalconnection );
-			return false;
-		}
+		setError("bad datatype");
+		GDALClose( source[0].gdalconnection );
+		return false;
 	}
 
 	if (err != CE_None ) {
@@ -752,6 +718,20 @@ bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, siz
 		return false;
 	}
 
+	if ((compute_stats) && (!gdal_stats)) {
+		for (size_t i=0; i < nl; i++) {
+			if (!std::isnan(vmin[i])) {
+				if (std::isnan(source[0].range_min[i])) {
+					source[0].range_min[i] = vmin[i];
+					source[0].range_max[i] = vmax[i];
+				} else {
+					source[0].range_min[i] = std::min(source[0].range_min[i], vmin[i]);
+					source[0].range_max[i] = std::max(source[0].range_max[i], vmax[i]);
+				}
+			}
+		}
+	}
+
 	return true;
 }
 
@@ -841,6 +821,8 @@ bool SpatRaster::writeStopGDAL() {
 	} else {
 		GDALClose( (GDALDatasetH) source[0].gdalconnection );
 	}
+	// datasets of a file with the same name that were opened before it was written
+	gdal_pool_forget(source[0].filename);
 	source[0].hasValues = true;
 
 	return true;
@@ -28,6 +28,33 @@
 
 
 
+enum FieldKind { fDouble, fLong, fBool, fTime, fString };
+
+// set all points of a line or ring at once, skipping missing values
+static void setOGRpoints(OGRSimpleCurve *c, const std::vector<double> &x, const std::vector<double> &y, std::vector<double> &tmpx, std::vector<double> &tmpy) {
+	bool hasNA = false;
+	for (size_t k=0; k<x.size(); k++) {
+		if (std::isnan(x[k])) {
+			hasNA = true;
+			break;
+		}
+	}
+	if (!hasNA) {
+		c->setPoints(x.size(), x.data(), y.data());
+		return;
+	}
+	tmpx.resize(0);
+	tmpy.resize(0);
+	for (size_t k=0; k<x.size(); k++) {
+		if (!std::isnan(x[k])) {
+			tmpx.push_back(x[k]);
+			tmpy.push_back(y[k]);
+		}
+	}
+	c->setPoints(tmpx.size(), tmpx.data(), tmpy.data());
+}
+
+
 GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, std::string driver, bool append, bool overwrite, std::vector<std::string> options) {
 
     GDALDataset *poDS = NULL;
@@ -209,122 +236,146 @@ GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, st
 	size_t gcntr = 0;
 	long longNA = NA<long>::value;
 
+	// resolve the field types and the location of the values once
+	std::vector<FieldKind> kinds(nfields);
+	std::vector<unsigned> place(nfields);
+	for (int j=0; j<nfields; j++) {
+		place[j] = df.iplace[j];
+		if (tps[j] == "double") {
+			kinds[j] = fDouble;
+		} else if (tps[j] == "long") {
+			kinds[j] = fLong;
+		} else if (tps[j] == "bool") {
+			kinds[j] = fBool;
+		} else if (tps[j] == "time") {
+			kinds[j] = fTime;
+		} else {
+			kinds[j] = fString;
+		}
+	}
+
+	// a single feature is re-used for all geometries
+	OGRFeature *poFeature = OGRFeature::CreateFeature( poLayer->GetLayerDefn() );
+	std::vector<double> tmpx, tmpy;
+
 	for (size_t i=0; i<ngeoms; i++) {
 
-		OGRFeature *poFeature;
-        poFeature = OGRFeature::CreateFeature( poLayer->GetLayerDefn() );
+		poFeature->SetFID(OGRNullFID);
 		for (int j=0; j<nfields; j++) {
-			if (tps[j] == "double") {
-				double dval = df.getDvalue(i, j);
-				if (!std::isnan(dval)) {
-					poFeature->SetField(j, df.getDvalue(i, j));
+			unsigned k = place[j];
+			switch (kinds[j]) {
+				case fDouble: {
+					double dval = df.dv[k][i];
+					if (std::isnan(dval)) {
+						poFeature->UnsetField(j);
+					} else {
+						poFeature->SetField(j, dval);
+					}
+					break;
 				}
-			} else if (tps[j] == "long") {
-				long ival = df.getIvalue(i, j);
-				if (ival != longNA) {
-					poFeature->SetField(j, (GIntBig)ival);
+				case fLong: {
+					long ival = df.iv[k][i];
+					if (ival == longNA) {
+						poFeature->UnsetField(j);
+					} else {
+						poFeature->SetField(j, (GIntBig)ival);
+					}
+					break;
 				}
-			} else if (tps[j] == "bool") {
-				poFeature->SetField(j, df.getBvalue(i, j));
-			} else if (tps[j] == "time") {
-				SpatTime_t tval = df.getTvalue(i, j);
-				if (tval != longNA) {
-					poFeature->SetField(j, (GIntBig)tval);
+				case fBool:
+					poFeature->SetField(j, (int) df.bv[k][i]);
+					break;
+				case fTime: {
+					SpatTime_t tval = df.tv[k].x[i];
+					if (tval == longNA) {
+						poFeature->UnsetField(j);
+					} else {
+						poFeature->SetField(j, (GIntBig)tval);
+					}
+					break;
 				}
-			} else {
-				std::string s = df.getSvalue(i, j);
-				if (s != df.NAS) {
-					poFeature->SetField(j, df.getSvalue(i, j).c_str());
+				default: {
+					const std::string &sval = df.sv[k][i];
+					if (sval == df.NAS) {
+						poFeature->UnsetField(j);
+					} else {
+						poFeature->SetField(j, sval.c_str());
+					}
 				}
 			}
 		}
-		//r++;
 
+		const SpatGeom &g = geoms[i];
 // points -- also need to do multi-points
-		OGRPoint pt;
 		if (wkb == wkbPoint) {
-			if (!std::isnan(geoms[i].parts[0].x[0])) {
-				pt.setX( geoms[i].parts[0].x[0] );
-				pt.setY( geoms[i].parts[0].y[0] );
+			OGRPoint *pt = new OGRPoint;
+			if (!std::isnan(g.parts[0].x[0])) {
+				pt->setX( g.parts[0].x[0] );
+				pt->setY( g.parts[0].y[0] );
 			}
-			poFeature->SetGeometry( &pt );
+			poFeature->SetGeometryDirectly( pt );
 
 // lines
 		} else if (wkb == wkbMultiLineString) {
-			OGRMultiLineString poGeom;
-			for (size_t j=0; j<geoms[i].size(); j++) {
-				OGRLineString poLine = OGRLineString();
-				for (size_t k=0; k<geoms[i].parts[j].size(); k++) {
-					if (!std::isnan(geoms[i].parts[j].x[k])) {
-						pt.setX(geoms[i].parts[j].x[k]);
-						pt.setY(geoms[i].parts[j].y[k]);
-						poLine.setPoint(k, &pt);
-					}
-				}
-				if (poGeom.addGeometry(&poLine) != OGRERR_NONE ) {
+			OGRMultiLineString *poGeom = new OGRMultiLineString;
+			for (size_t j=0; j<g.parts.size(); j++) {
+				OGRLineString *poLine = new OGRLineString;
+				setOGRpoints(poLine, g.parts[j].x, g.parts[j].y, tmpx, tmpy);
+				if (poGeom->addGeometryDirectly(poLine) != OGRERR_NONE ) {
+					delete poLine;
+					delete poGeom;
+					OGRFeature::DestroyFeature( poFeature );
 					setError("cannot add line");
 					return poDS;
 				}
 			}
-			if (poFeature->SetGeometry( &poGeom ) != OGRERR_NONE) {
+			if (poFeature->SetGeometryDirectly( poGeom ) != OGRERR_NONE) {
+				OGRFeature::DestroyFeature( poFeature );
 				setError("cannot set geometry");
 				return poDS;
 			}
 
 // polygons
 		} else if (wkb == wkbMultiPolygon) {
-			SpatGeom g = getGeom(i);
-			OGRMultiPolygon poGeom;
-			for (size_t j=0; j<g.size(); j++) {
-				OGRLinearRing poRing;
-				SpatPart p = g.getPart(j);
-				for (size_t k=0; k<p.size(); k++) {
-					if (!std::isnan(p.x[k])) {
-						pt.setX(p.x[k]);
-						pt.setY(p.y[k]);
-						poRing.setPoint(k, &pt);
-					}
+			OGRMultiPolygon *poGeom = new OGRMultiPolygon;
+			for (size_t j=0; j<g.parts.size(); j++) {
+				const SpatPart &p = g.parts[j];
+				OGRPolygon *polyGeom = new OGRPolygon;
+				OGRLinearRing *poRing = new OGRLinearRing;
+				setOGRpoints(poRing, p.x, p.y, tmpx, tmpy);
+				bool ok = polyGeom->addRingDirectly(poRing) == OGRERR_NONE;
+				for (size_t h=0; ok && (h < p.holes.size()); h++) {
+					OGRLinearRing *poHole = new OGRLinearRing;
+					setOGRpoints(poHole, p.holes[h].x, p.holes[h].y, tmpx, tmpy);
+					ok = polyGeom->addRingDirectly(poHole) == OGRERR_NONE;
 				}
-				OGRPolygon polyGeom;
-				if (polyGeom.addRing(&poRing) != OGRERR_NONE ) {
+				if (ok) {
+					ok = poGeom->addGeometryDirectly(polyGeom) == OGRERR_NONE;
+				}
+				if (!ok) {
+					delete polyGeom;
+					delete poGeom;
+					OGRFeature::DestroyFeature( poFeature );
 					setError("cannot add ring");
 					return poDS;
 				}
-
-				if (p.hasHoles()) {
-					for (size_t h=0; h < p.nHoles(); h++) {
-						SpatHole hole = p.getHole(h);
-						OGRLinearRing poHole;
-						for (size_t k=0; k<hole.size(); k++) {
-							pt.setX(hole.x[k]);
-							pt.setY(hole.y[k]);
-							poHole.setPoint(k, &pt);
-						}
-						if (polyGeom.addRing(&poHole) != OGRERR_NONE ) {
-							setError("cannot add hole");
-							return poDS;
-						}
-					}
-				}
-				poGeom.addGeometry( &polyGeom);
-				//closeRings
 			}
-
-			//OGRMultiPolygon* mGeom = poGeom.toMultiPolygon();
-			if (poFeature->SetGeometry( &poGeom ) != OGRERR_NONE) {
+			if (poFeature->SetGeometryDirectly( poGeom ) != OGRERR_NONE) {
+				OGRFeature::DestroyFeature( poFeature );
 				setError("cannot set geometry");
 				return poDS;
 			}
 		} else {
+			OGRFeature::DestroyFeature( poFeature );
 			setError("Only points, lines and polygons are currently supported");
 			return poDS;
 		}
 
 		if( poLayer->CreateFeature( poFeature ) != OGRERR_NONE ) {
+			OGRFeature::DestroyFeature( poFeature );
 			setError("Failed to create feature");
 			return poDS;
         }
-        OGRFeature::DestroyFeature( poFeature );
 		gcntr++;
 		if (transaction && (gcntr == nGroupTransactions)) {
 			if (poDS->CommitTransaction() != OGRERR_NONE) {
@@ -334,11 +385,13 @@ GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, st
 			gcntr = 0;
 			transaction = (poDS->StartTransaction() == OGRERR_NONE); 
 			if (! transaction) { 
+				OGRFeature::DestroyFeature( poFeature );
 				setError("transaction failed");
 				return poDS; 
 			} 
 		}
     }
+	OGRFeature::DestroyFeature( poFeature );
 	if (transaction && (gcntr>0) && (poDS->CommitTransaction() != OGRERR_NONE)) {
 		poDS->RollbackTransaction();
 		setError("transaction commit failed");